@@ -39,9 +39,9 @@ DEFINES = -DQT_NO_DEBUG -DQT_GUI_LIB -DQT_CORE_LIB -DQT_SHARED
 CPUSIZE = -mbe32
 
 #CFLAGS  = $(CPUSIZE) -pipe -O2 -Wall -W -D_REENTRANT $(DEFINES) $(INC_DIR)
-CFLAGS  = $(CPUSIZE) -pipe -Wall -D_REENTRANT $(DEFINES) $(INC_DIR)
+CFLAGS  = $(CPUSIZE) -pipe -Wall -D_REENTRANT -pthread $(DEFINES) $(INC_DIR)
 
-LDFLAGS = $(CPUSIZE) -Wl,-O1 $(LIBS_PTH)
+LDFLAGS = $(CPUSIZE) -pthread -Wl,-O1 $(LIBS_PTH)
 
 # MOC compiler
 MOC     = /usr/bin/moc-qt4
@@ -0,0 +1,296 @@
+// @file gqbench.cc
+// @author Alexander Gailey-White
+
+// Benchmark of the GQGMC driver logic on a machine without a GQ GMC.
+// GQGMC runs over a LoopbackTransport (see gqtransport.hh) against
+// in-process device models, which pace their replies like a serial link
+// at the baud rate given, so the figures are those of the driver and
+// the link, not of the kernel's tty layer:
+//
+//   cpm      GETCPM round trips against a ScriptedDevice, with the wire
+//            time of the baud rate and without any, the latter being
+//            the overhead of the driver alone.
+//   history  readHistory() of the whole flash of a GMCDeviceModel,
+//            holding history like data, checked against the image, and
+//            again with a byte of the replies lost every so often, as
+//            on a marginal USB cable, which readHistory() must repair
+//            by asking again for the tails of the short chunks.
+//   replay   the cpm round trips recorded with a RecordTransport and
+//            played back with a ReplayTransport, which must match.
+//
+// Each prints one line. The exit status is 1 if any of them failed.
+
+// Usage: gqgmc-bench [options]
+//   -n <count>    GETCPM round trips, default 1000
+//   -b <baud>     emulated baud rate, default 115200
+//   -F <bytes>    history flash size, default 65536
+//   -l <bytes>    lose one in this many reply bytes, default 20000
+// Example: gqgmc-bench -b 57600, or make bench
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+#include <unistd.h>
+#include <time.h>
+
+#include "gqgmc.hh"
+#include "gqtransport.hh"
+#include "gqdevice.hh"
+using namespace GQLLC;
+
+// Microseconds of the monotonic clock.
+static int64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// A byte costs a start bit, 8 data bits and a stop bit on the wire.
+static uint32_t byteTime(uint32_t baud) {
+  return (baud > 0) ? (10000000 + baud / 2) / baud : 0;
+}
+
+// Make a temporary file name for the benchmark's own files.
+static string tempName(const string & stem) {
+  char name[64];
+  snprintf(name, sizeof(name), "/tmp/gqgmc-bench-%d.%s", int(getpid()),
+           stem.c_str());
+  return name;
+}
+
+// Script the replies GQGMC needs to open the link and read CPM: no reply
+// to HEARTBEAT0, the version, an empty configuration and 30 CPM.
+static void scriptDevice(ScriptedDevice & device, uint32_t baud) {
+  device.setByteTime(byteTime(baud));
+  device.setReply("<HEARTBEAT0>>", "");
+  device.setReply("<GETVER>>", "GMC-300Re 4.20");
+  device.setReply("<GETCFG>>", string(256, '\0'));
+  device.setReply("<GETCPM>>", string("\x00\x1e", 2));
+}
+
+// History like flash: runs of low counts, a few timestamps, and the
+// erased area ahead of the write end.
+static vector<uint8_t> makeFlash(uint32_t size) {
+  vector<uint8_t> flash(size, 0xff);
+  uint32_t end = size - size / 8;
+  srand(1);
+  for (uint32_t i = 0; i < end; i++) {
+    if ((i % 4096) == 0 && (i + 12) <= end) {
+      const uint8_t stamp[12] = { 0x55, 0xaa, 0x00, 24, 1, 1, 0, 0, 0,
+                                  0x55, 0xaa, 0x01 };
+      memcpy(&flash[i], stamp, sizeof(stamp));
+      i += sizeof(stamp) - 1;
+    } else
+      flash[i] = uint8_t((rand() % 8 == 0) ? rand() % 4 : 0);
+  }
+  return flash;
+}
+
+// A counter on a marginal link: once armed, one in interval bytes of its
+// replies, at random, is lost on the way to the host. Lost at a fixed
+// interval instead, the bytes would fall at the same place of every
+// pipelined read of the rest of the flash, which is not what a cable
+// does. The seed is fixed, so that a run can be repeated.
+class LossyDevice : public GQDeviceModel {
+  public:
+  bool armed = false;
+  uint64_t lost = 0;
+
+  LossyDevice(GQDeviceModel * inner, uint32_t interval)
+    : mInner(inner), mInterval(interval), mSeed(1) {
+  }
+
+  virtual void receive(const uint8_t * data, size_t length, int64_t now_us) {
+    mInner->receive(data, length, now_us);
+  }
+
+  // Returns fewer bytes than were ready, maybe none, as a host sees it.
+  virtual size_t transmit(uint8_t * data, size_t length, int64_t now_us) {
+    size_t ready = mInner->transmit(data, length, now_us);
+    size_t kept = 0;
+    for (size_t i = 0; i < ready; i++) {
+      if (armed && (rand_r(&mSeed) % mInterval) == 0)
+        lost++;
+      else
+        data[kept++] = data[i];
+    }
+    return kept;
+  }
+
+  virtual int64_t nextTransmit(int64_t now_us) {
+    return mInner->nextTransmit(now_us);
+  }
+
+  private:
+  GQDeviceModel * mInner;
+  uint32_t mInterval;
+  unsigned mSeed;
+};
+
+// Run count GETCPM round trips and print their latency.
+static bool benchCPM(GQTransport & transport, const string & name,
+                     uint32_t count) {
+  GQGMC gmc;
+  gmc.openTransport(&transport);
+  if (gmc.getErrorCode() != eNoProblem) {
+    cout << name << ": " << gmc.getErrorText(gmc.getErrorCode()) << endl;
+    return false;
+  }
+
+  vector<int64_t> latency;
+  int64_t started = monotonic_us();
+  for (uint32_t i = 0; i < count; i++) {
+    int64_t sent = monotonic_us();
+    if (gmc.getCPM() != 30 || gmc.getErrorCode() != eNoProblem) {
+      cout << name << ": wrong reply to command " << i << endl;
+      return false;
+    }
+    latency.push_back(monotonic_us() - sent);
+  }
+  int64_t elapsed = monotonic_us() - started;
+  gmc.closeUSB();
+
+  sort(latency.begin(), latency.end());
+  cout << name << ": " << count << " commands, " << fixed
+       << setprecision(0) << (count * 1e6) / (elapsed > 0 ? elapsed : 1)
+       << "/s, latency us min " << latency.front()
+       << " median " << latency[latency.size() / 2]
+       << " p99 " << latency[(latency.size() * 99) / 100]
+       << " max " << latency.back() << endl;
+  return true;
+}
+
+// Read the whole flash of an emulated counter and print the rate. With
+// lose_interval not 0, bytes are lost on the way, see LossyDevice.
+static bool benchHistory(uint32_t baud, uint32_t flash_size,
+                         uint32_t lose_interval) {
+  string name = tempName("flash");
+  vector<uint8_t> flash = makeFlash(flash_size);
+  FILE * file = fopen(name.c_str(), "wb");
+  bool written = (file != NULL) &&
+                 (fwrite(flash.data(), 1, flash.size(), file) == flash.size());
+  if (file != NULL)
+    fclose(file);
+
+  GMCDeviceModel device;
+  device.setBaud(baud);
+  bool loaded = written && device.loadFlash(name);
+  unlink(name.c_str());
+  if (!loaded) {
+    cout << "history: cannot write " << name << endl;
+    return false;
+  }
+
+  LossyDevice lossy(&device, (lose_interval > 0) ? lose_interval : 1);
+  LoopbackTransport transport(&lossy);
+  GQGMC gmc;
+  gmc.openTransport(&transport);
+  if (gmc.getErrorCode() != eNoProblem) {
+    cout << "history: " << gmc.getErrorText(gmc.getErrorCode()) << endl;
+    return false;
+  }
+
+  vector<uint8_t> data(flash_size);
+  lossy.armed = (lose_interval > 0);
+  int64_t started = monotonic_us();
+  uint32_t good = gmc.readHistory(0, flash_size, data.data(), 0);
+  int64_t elapsed = monotonic_us() - started;
+  lossy.armed = false;
+
+  uint32_t tails = 0;
+  const vector<uint32_t> & retries = gmc.getChunkRetries();
+  for (uint32_t i = 0; i < retries.size(); i++)
+    tails += retries[i];
+  gmc.closeUSB();
+
+  bool same = (good == flash_size) &&
+              (memcmp(data.data(), flash.data(), flash_size) == 0);
+  double rate = (good * 1e6) / (elapsed > 0 ? elapsed : 1);
+  cout << "history, " << baud << " baud";
+  if (lose_interval > 0)
+    cout << ", " << lossy.lost << " bytes lost, " << tails << " tails";
+  cout << ": " << good << "/" << flash_size << " bytes, " << fixed
+       << setprecision(0) << rate << " bytes/s, " << setprecision(1)
+       << (rate * 100.0) / (baud / 10.0) << "% of the wire rate, "
+       << (same ? "same" : "DIFFERENT") << " as the flash" << endl;
+  return same;
+}
+
+// Record the cpm round trips and play them back.
+static bool benchReplay(uint32_t baud, uint32_t count) {
+  string name = tempName("trace");
+  ScriptedDevice device;
+  scriptDevice(device, baud);
+  LoopbackTransport loopback(&device);
+  RecordTransport recorder(&loopback, name);
+  if (!benchCPM(recorder, "record", count))
+    return false;
+
+  ReplayTransport replay(name);
+  bool ok = benchCPM(replay, "replay", count);
+  unlink(name.c_str());
+
+  cout << "replay: " << (replay.hasDiverged() ? "left" : "followed")
+       << " the trace, " << (replay.isFinished() ? "all" : "NOT all")
+       << " of it played back" << endl;
+  return ok && !replay.hasDiverged() && replay.isFinished();
+}
+
+static void usage() {
+  cerr << "Usage: gqgmc-bench [-n count] [-b baud] [-F bytes] [-l bytes]"
+       << endl;
+}
+
+int
+main(int argc, char **argv) {
+  uint32_t count = 1000;
+  uint32_t baud = 115200;
+  uint32_t flash_size = 65536;
+  uint32_t lose_interval = 20000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:F:l:")) != -1) {
+    switch (opt) {
+      case 'n': count = uint32_t(strtoul(optarg, 0, 0)); break;
+      case 'b': baud = uint32_t(strtoul(optarg, 0, 0)); break;
+      case 'F': flash_size = uint32_t(strtoul(optarg, 0, 0)); break;
+      case 'l': lose_interval = uint32_t(strtoul(optarg, 0, 0)); break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if ((count == 0) || (baud == 0) || (flash_size == 0)) {
+    usage();
+    return 1;
+  }
+
+  bool ok = true;
+
+  ScriptedDevice wired;
+  scriptDevice(wired, baud);
+  LoopbackTransport wired_link(&wired);
+  stringstream name;
+  name << "cpm, " << baud << " baud";
+  ok = benchCPM(wired_link, name.str(), count) && ok;
+
+  ScriptedDevice instant;
+  scriptDevice(instant, 0);
+  LoopbackTransport instant_link(&instant);
+  ok = benchCPM(instant_link, "cpm, no wire time", count) && ok;
+
+  ok = benchHistory(baud, flash_size, 0) && ok;
+  if (lose_interval > 0)
+    ok = benchHistory(baud, flash_size, lose_interval) && ok;
+  ok = benchReplay(baud, count / 10 + 1) && ok;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+// **************************************************************************
+// File: gqcollect.cc
+//
+// Synopsis:
+//   Define the GQCollector class, which collects the heartbeat CPS of a
+//   list of GQ GMCs, each device running through its own connection
+//   state machine.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqcollect.hh
+//
+//
+// C++ includes
+#include <string>
+#include <sstream>
+#include <fstream>
+using namespace std;
+
+// Linux C includes
+#include <time.h>
+
+// These are GQ GMC project specific includes
+#include "gqcollect.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// Time to wait before opening a device again which failed other than by
+// losing its link, eg, one which answered but not as expected. A lost
+// link is instead restored by GQGMC::reconnect() with its own backoff.
+static
+int64_t
+const          kReconnect_Delay_ms = 5000;
+
+// Read the monotonic clock in milliseconds.
+static
+int64_t
+monotonic_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// GQCOLLECTOR CLASS CONSTRUCTOR
+GQCollector::GQCollector(GQCollectorOutput * output)
+  : mOutput(output), mLoop(this)
+{
+} // end GQCollector constructor
+
+GQCollector::~GQCollector()
+{
+  shutdown();
+  for(uint32_t i=0; i<mDevices.size(); i++)
+  {
+    delete mDevices[i]->gmc;
+    delete mDevices[i];
+  }
+} // end GQCollector destructor
+
+// loadDeviceList reads the device list file, see gqcollect.hh for the
+// format.
+bool
+GQCollector::loadDeviceList(const string & file_name)
+{
+  ifstream  list(file_name.c_str());
+  if (!list)
+    return false;
+
+  string line;
+  while (getline(list, line))
+  {
+    istringstream  fields(line);
+    string         path;
+    string         label;
+
+    fields >> path >> label;
+    if (path.empty() || (path[0] == '#'))
+      continue;
+    addDevice(path, label);
+  }
+
+  return true;
+} // end loadDeviceList()
+
+void
+GQCollector::addDevice(const string & path, const string & label)
+{
+  device_t * device = new device_t;
+
+  device->path     = path;
+  device->label    = label.empty() ? path : label;
+  device->gmc      = new GQGMC;
+  device->state    = eOpening;
+  device->retry_ms = 0;
+  device->resyncs  = 0;
+
+  mDevices.push_back(device);
+  return;
+} // end addDevice()
+
+// step is one turn of the collector. Devices which are not streaming
+// are advanced first, as far as they can go, and then the event loop
+// waits for samples. The wait is cut short for the earliest device
+// whose reconnect delay ends, so that it is not kept waiting.
+void
+GQCollector::step(int max_wait_ms)
+{
+  int64_t now  = monotonic_ms();
+  int64_t wait = max_wait_ms;
+
+  for(uint32_t i=0; i<mDevices.size(); i++)
+  {
+    device_t * device = mDevices[i];
+
+    if ((device->state != eStreaming) && (device->retry_ms <= now))
+      advance(device);
+
+    if (device->state == eReconnecting)
+    {
+      int64_t remaining = device->retry_ms - monotonic_ms();
+      if (remaining < wait)
+        wait = (remaining > 0) ? remaining : 0;
+    }
+  }
+
+  mLoop.dispatch(int(wait));
+  return;
+} // end step()
+
+// advance is the state machine of one device. Each state either moves
+// on to the next or, on failure, to eReconnecting. It stops when the
+// device is streaming or has to wait for its reconnect delay.
+void
+GQCollector::advance(device_t * device)
+{
+  GQGMC * gmc = device->gmc;
+
+  while ((device->state != eStreaming) && (device->retry_ms <= monotonic_ms()))
+  {
+    switch(device->state)
+    {
+      case eOpening:
+        gmc->openUSB(device->path);
+        if (gmc->getErrorCode() != eNoProblem)
+        {
+          fail(device, gmc->getErrorText(gmc->getErrorCode()));
+          break;
+        }
+        device->state = eIdentifying;
+        break;
+
+      case eIdentifying:
+      {
+        string version = gmc->getVersion();
+        string serial  = gmc->getSerialNumber();
+        if (gmc->getErrorCode() != eNoProblem)
+        {
+          fail(device, gmc->getErrorText(gmc->getErrorCode()));
+          break;
+        }
+        mOutput->onEvent(device->label, "Identified " + version
+                                        + " serial " + serial);
+        device->state = eConfiguring;
+        break;
+      }
+
+      case eConfiguring:
+        gmc->turnOnCPS();
+        if ((gmc->getErrorCode() != eNoProblem) || !mLoop.addDevice(gmc))
+        {
+          fail(device, "Cannot turn on heartbeat");
+          break;
+        }
+        mStreaming[gmc] = device;
+        device->state   = eStreaming;
+        mOutput->onEvent(device->label, "Streaming");
+        break;
+
+      case eReconnecting:
+      {
+        if (gmc->isLinkLost() == false)
+        {
+          device->state = eOpening;
+          break;
+        }
+        if (gmc->reconnect() == false)
+        {
+          device->retry_ms = monotonic_ms() + gmc->getReconnectDelay();
+          break;
+        }
+
+        // Identified again by reconnect(), and the heartbeat is resumed
+        // if it was on. The gap is an event of its own.
+        stringstream event;
+        event << "Link restored, gap " << gmc->getLastGap() << " ms";
+        mOutput->onEvent(device->label, event.str());
+        device->state = eConfiguring;
+        break;
+      }
+
+      case eStreaming:
+        break;
+    } // end switch
+  } // end while loop
+
+  return;
+} // end advance()
+
+void
+GQCollector::fail(device_t * device, const string & reason)
+{
+  mOutput->onEvent(device->label, reason);
+
+  device->state = eReconnecting;
+  if (device->gmc->isLinkLost())
+    device->retry_ms = monotonic_ms() + device->gmc->getReconnectDelay();
+  else
+  {
+    device->gmc->closeUSB();
+    device->retry_ms = monotonic_ms() + kReconnect_Delay_ms;
+  }
+
+  return;
+} // end fail()
+
+void
+GQCollector::shutdown()
+{
+  for(uint32_t i=0; i<mDevices.size(); i++)
+  {
+    device_t * device = mDevices[i];
+
+    if (device->state == eStreaming)
+    {
+      mLoop.removeDevice(device->gmc);
+      device->gmc->turnOffCPS();
+    }
+    device->gmc->closeUSB();
+    device->state    = eOpening;
+    device->retry_ms = 0;
+  }
+  mStreaming.clear();
+
+  return;
+} // end shutdown()
+
+// onSample passes the sample on. A realignment of the heartbeat stream
+// which preceded it is reported first, since the samples around it may
+// be missing.
+void
+GQCollector::onSample(GQGMC * gmc, const cps_sample_t & sample)
+{
+  device_t * device = mStreaming[gmc];
+
+  if (gmc->getResyncCount() != device->resyncs)
+  {
+    device->resyncs = gmc->getResyncCount();
+
+    stringstream event;
+    event << "Heartbeat resynchronized, " << device->resyncs << " so far";
+    mOutput->onEvent(device->label, event.str());
+  }
+
+  mOutput->onSample(device->label, sample);
+  return;
+} // end onSample()
+
+// onLinkLost is called by the event loop, which has already removed the
+// device from the loop.
+void
+GQCollector::onLinkLost(GQGMC * gmc)
+{
+  device_t * device = mStreaming[gmc];
+
+  mStreaming.erase(gmc);
+  fail(device, "Link lost");
+
+  return;
+} // end onLinkLost()
+
+// end file gqcollect.cc
@@ -0,0 +1,170 @@
+// **************************************************************************
+// File: gqcollect.hh
+//
+// Description:
+//    Declare the GQCollector class, which collects the heartbeat CPS of
+//    a list of GQ GMCs in one process, each device running through its
+//    own connection state machine.
+//
+// COLLECTOR OVERVIEW
+//
+// A site with several counters used to run one gqgmc process per
+// counter, each doing its own polling and formatting. The collector
+// instead takes a list of devices and drives each through the states
+//
+//   eOpening      open the serial port (openUSB())
+//   eIdentifying  read the version and serial number
+//   eConfiguring  turn on the heartbeat (turnOnCPS())
+//   eStreaming    CPS samples arrive through the event loop
+//   eReconnecting a state failed: restore a lost link with reconnect()
+//                 (see gqgmc.cc), which backs off exponentially, or
+//                 wait a few seconds and open again
+//
+// A failure in any state only affects its own device, which moves to
+// eReconnecting and tries again later, while the other devices carry on.
+// When a lost link comes back, the length of the gap is reported.
+// Streaming devices are served by one GQEventLoop (see gqevloop.hh), so
+// the whole collector is a single thread. Samples and state changes of
+// all devices go to one GQCollectorOutput, the shared output pipeline,
+// which sees each device by its label.
+//
+// The states before eStreaming issue ordinary blocking commands. These
+// take a few tens of milliseconds on a healthy link, during which the
+// heartbeat frames of the streaming devices simply wait in their ports.
+//
+// DEVICE LIST FILE
+//
+// The device list is a text file with one device per line, the path of
+// its serial port optionally followed by a label. Blank lines and lines
+// starting with '#' are ignored, eg,
+//
+//   # roof and basement counters
+//   /dev/serial/by-id/usb-1a86_USB2.0-Ser_-if00-port0  roof
+//   /dev/ttyUSB1                                       basement
+//
+#include <string>
+#include <vector>
+#include <map>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+#include "gqevloop.hh"
+
+#ifndef gqcollect_hh_
+#define gqcollect_hh_
+
+namespace GQLLC
+{
+
+  // COLLECTOR OUTPUT
+  //
+  // Abstract class of the shared output pipeline of the collector.
+  class GQCollectorOutput
+  {
+    public:
+
+    virtual
+    ~GQCollectorOutput()
+    {
+    };
+
+    // A CPS sample has arrived from the labelled device.
+    virtual
+    void
+    onSample(const std::string & label, const cps_sample_t & sample) = 0;
+
+    // Something happened to the labelled device, eg, it was identified
+    // or its link was lost. The event is a line of text.
+    virtual
+    void
+    onEvent(const std::string & label, const std::string & event) = 0;
+
+  }; // end class GQCollectorOutput
+
+
+  // COLLECTOR
+  //
+  // The class declaration - see gqcollect.cc for documentation
+  class GQCollector : private GQSampleListener
+  {
+    public:
+
+    // Connection states of a device, see the overview above.
+    enum device_state_t
+    {
+      eOpening, eIdentifying, eConfiguring, eStreaming, eReconnecting
+    };
+
+    // The output is owned by the caller and must outlive the collector.
+    GQCollector(GQCollectorOutput * output);
+
+    virtual
+    ~GQCollector();
+
+    // Method to read a device list file and add its devices. Returns
+    // false if the file cannot be read.
+    bool
+    loadDeviceList(const std::string & file_name);
+
+    // Method to add one device. An empty label is taken as the path.
+    void
+    addDevice(const std::string & path, const std::string & label);
+
+    // Method to get the number of devices.
+    uint32_t
+    getDeviceCount()
+    {
+      return mDevices.size();
+    };
+
+    // Method to advance all state machines and wait up to max_wait_ms
+    // for samples. To be called in a loop.
+    void
+    step(int max_wait_ms);
+
+    // Method to turn off the heartbeat of all devices and close them.
+    void
+    shutdown();
+
+    private:
+
+    // A device and the state of its connection.
+    struct device_t
+    {
+      std::string     path;
+      std::string     label;
+      GQGMC *         gmc;
+      device_state_t  state;
+      int64_t         retry_ms;   // when eReconnecting is over
+      uint32_t        resyncs;    // heartbeat resyncs reported so far
+    };
+
+    GQCollectorOutput *            mOutput;
+    GQEventLoop                    mLoop;
+    std::vector<device_t *>        mDevices;
+    std::map<GQGMC *, device_t *>  mStreaming;
+
+    // Run the state machine of the device until it waits.
+    void
+    advance(device_t * device);
+
+    // Move the device to eReconnecting after a failure.
+    void
+    fail(device_t * device, const std::string & reason);
+
+    // GQSampleListener methods, called by mLoop.
+    virtual
+    void
+    onSample(GQGMC * gmc, const cps_sample_t & sample);
+
+    virtual
+    void
+    onLinkLost(GQGMC * gmc);
+
+  }; // end class GQCollector
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqcollect.cc
+#endif  // gqcollect_hh_
@@ -0,0 +1,583 @@
+// **************************************************************************
+// File: gqdevice.cc
+//
+// Synopsis:
+//   Define the GMCDeviceModel class, an emulation of a GQ GMC which
+//   implements every command of GQ-RFC1201.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqdevice.hh
+//
+//
+// C++ includes
+#include <string>
+#include <fstream>
+#include <iterator>
+using namespace std;
+
+#include <string.h>
+
+// These are GQ GMC project specific includes
+#include "gqdevice.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// GQ GMC COMMANDS
+/*
+ The commands of GQ-RFC1201 which the emulation recognizes, with the
+ number of binary parameter bytes each one takes between its name and
+ the closing ">>". Since parameters are binary, they may well contain
+ '<' or '>', so the parser must know how many to expect rather than
+ look for the ">>".
+*/
+struct command_t
+{
+  const char *  name;
+  int           params;
+};
+
+static const command_t  kCommands[] =
+{
+  { "GETVER",     0 }, { "GETCPM",     0 }, { "GETCPS",     0 },
+  { "HEARTBEAT1", 0 }, { "HEARTBEAT0", 0 }, { "GETVOLT",    0 },
+  { "SPIR",       5 }, { "GETCFG",     0 }, { "ECFG",       0 },
+  { "WCFG",       2 }, { "KEY",        1 }, { "GETSERIAL",  0 },
+  { "POWEROFF",   0 }, { "CFGUPDATE",  0 },
+  { "SETDATEYY",  1 }, { "SETDATEMM",  1 }, { "SETDATEDD",  1 },
+  { "SETTIMEHH",  1 }, { "SETTIMEMM",  1 }, { "SETTIMESS",  1 }
+};
+
+static
+uint32_t
+const          kCommand_Count = sizeof(kCommands) / sizeof(kCommands[0]);
+
+// Longest command name, anything longer is line noise.
+static
+size_t
+const          kMax_Name = 10;
+
+// Most commands which change something acknowledge with 0xAA.
+static
+uint8_t
+const          kAck = 0xAA;
+
+// The flash is erased in sectors of 4K bytes.
+static
+uint32_t
+const          kSector_Size = 0x1000;
+
+// Configuration data offsets used by the emulation, the same as
+// enum cfg_param_t in gqgmc.hh.
+static
+uint32_t
+const          kCfg_SaveDataType    = 32;
+static
+uint32_t
+const          kCfg_DataSaveAddress = 38;
+static
+uint32_t
+const          kCfg_SaveDate        = 52;
+static
+uint32_t
+const          kCfg_MaxBytes        = 58;
+
+
+// GMCDEVICEMODEL CLASS CONSTRUCTOR
+//
+// The defaults emulate a GMC-300 with current firmware, 64K bytes of
+// erased flash, history logging off, a background of 20 CPM and a
+// 57600 baud link.
+GMCDeviceModel::GMCDeviceModel()
+  : mVersion("GMC-300Re 4.20"), mVoltage(98), mRandom(5489u),
+    mCounts(20.0 / 60.0), mNext_tick_us(0), mHeartbeat(false),
+    mOutput_ready_us(0), mByte_us(0), mParam_count(-1), mName_length(0),
+    mWrite_addr(0), mLog_seconds(0), mLog_counts(0), mClock_offset(0),
+    mPowered_off(false)
+{
+  static const uint8_t kSerial[7] = { 0x00, 0x30, 0x00, 0xE3,
+                                      0x4A, 0x35, 0x1A };
+  memcpy(mSerial, kSerial, sizeof(mSerial));
+
+  memset(mCFG_Data, 0, sizeof(mCFG_Data));
+  mCFG_Data[kCfg_MaxBytes] = 0xff;
+
+  setBaud(57600);
+  setFlashSize(0x10000);
+} // end GMCDeviceModel constructor
+
+void
+GMCDeviceModel::setVersion(const string & version)
+{
+  // The reply is always exactly 14 characters.
+  mVersion = version;
+  mVersion.resize(14, ' ');
+  return;
+} // end setVersion()
+
+void
+GMCDeviceModel::setSerialNumber(const uint8_t serial[7])
+{
+  memcpy(mSerial, serial, sizeof(mSerial));
+  return;
+} // end setSerialNumber()
+
+void
+GMCDeviceModel::setMeanCPM(double cpm)
+{
+  mCounts.param(poisson_distribution<int>::param_type(cpm / 60.0));
+  return;
+} // end setMeanCPM()
+
+void
+GMCDeviceModel::setSeed(uint32_t seed)
+{
+  mRandom.seed(seed);
+  return;
+} // end setSeed()
+
+// Each byte is framed by a start and a stop bit, so takes 10 bit times.
+void
+GMCDeviceModel::setBaud(uint32_t baud)
+{
+  mByte_us = (baud > 0) ? (10000000 + baud - 1) / baud : 0;
+  return;
+} // end setBaud()
+
+void
+GMCDeviceModel::setBatteryVoltage(float volts)
+{
+  mVoltage = uint8_t(volts * 10.0f + 0.5f);
+  return;
+} // end setBatteryVoltage()
+
+void
+GMCDeviceModel::setFlashSize(uint32_t size)
+{
+  mFlash.assign(size, 0xff);
+  mWrite_addr = 0;
+  return;
+} // end setFlashSize()
+
+// loadFlash loads a flash image, for example a dump of a real GQ GMC.
+// Logging, if enabled, continues where the image leaves off, that is,
+// at the first erased byte following written data.
+bool
+GMCDeviceModel::loadFlash(const string & file_name)
+{
+  ifstream  image(file_name.c_str(), ios::in | ios::binary);
+  if (!image)
+    return false;
+
+  mFlash.assign(istreambuf_iterator<char>(image), istreambuf_iterator<char>());
+  if (mFlash.size() == 0)
+    return false;
+
+  mWrite_addr = 0;
+  for(uint32_t i=0; i<mFlash.size(); i++)
+  {
+    uint32_t prev = (i + mFlash.size() - 1) % mFlash.size();
+    if ((mFlash[i] == 0xff) && (mFlash[prev] != 0xff))
+    {
+      mWrite_addr = i;
+      break;
+    }
+  }
+
+  return true;
+} // end loadFlash()
+
+bool
+GMCDeviceModel::saveFlash(const string & file_name)
+{
+  ofstream  image(file_name.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!image)
+    return false;
+
+  image.write(reinterpret_cast<const char *>(mFlash.data()), mFlash.size());
+  return bool(image);
+} // end saveFlash()
+
+void
+GMCDeviceModel::setSaveDataType(uint8_t save_data_type)
+{
+  mCFG_Data[kCfg_SaveDataType] = save_data_type;
+  if (save_data_type != 0)
+    startLog();
+  return;
+} // end setSaveDataType()
+
+
+// GQDeviceModel METHODS
+//
+// receive parses the bytes from the host. A command is '<', its name,
+// its binary parameters and ">>". Anything which does not fit is
+// dropped silently, as a GQ GMC does, and the parser waits for the next
+// '<'. Once powered off, the device does not respond at all.
+void
+GMCDeviceModel::receive(const uint8_t * data, size_t length, int64_t now_us)
+{
+  advance(now_us);
+
+  for(size_t i=0; i<length; i++)
+  {
+    uint8_t b = data[i];
+
+    if (mCommand.empty())
+    {
+      if (b == '<') mCommand = "<";
+      continue;
+    }
+    mCommand += char(b);
+
+    // Still reading the name: see if it is complete, or cannot be one.
+    if (mParam_count < 0)
+    {
+      string  name     = mCommand.substr(1);
+      bool    possible = false;
+
+      for(uint32_t c=0; c<kCommand_Count; c++)
+      {
+        if (name == kCommands[c].name)
+        {
+          mParam_count = kCommands[c].params;
+          mName_length = mCommand.size();
+          break;
+        }
+        if (strncmp(kCommands[c].name, name.c_str(), name.size()) == 0)
+          possible = true;
+      }
+
+      if ((mParam_count < 0) && ((possible == false) || (name.size() > kMax_Name)))
+      {
+        mCommand = (b == '<') ? "<" : "";
+      }
+      continue;
+    }
+
+    // Name and parameters read, the command is complete with ">>".
+    if (mCommand.size() == (mName_length + mParam_count + 2))
+    {
+      if (mCommand.compare(mCommand.size() - 2, 2, ">>") == 0)
+        execute(now_us);
+      mCommand.clear();
+      mParam_count = -1;
+    }
+  } // end for loop
+
+  return;
+} // end receive()
+
+size_t
+GMCDeviceModel::transmit(uint8_t * data, size_t length, int64_t now_us)
+{
+  advance(now_us);
+
+  size_t ready = mOutput.size();
+  if (mByte_us > 0)
+  {
+    if (now_us < mOutput_ready_us)
+      return 0;
+    uint64_t paced = uint64_t(now_us - mOutput_ready_us) / mByte_us + 1;
+    if (paced < ready) ready = paced;
+  }
+  if (ready > length) ready = length;
+
+  for(size_t i=0; i<ready; i++)
+  {
+    data[i] = mOutput.front();
+    mOutput.pop_front();
+  }
+  mOutput_ready_us += int64_t(ready) * mByte_us;
+
+  return ready;
+} // end transmit()
+
+// nextTransmit also accounts for the heartbeat: while it is on, the
+// device will have something to say at the end of the running second.
+int64_t
+GMCDeviceModel::nextTransmit(int64_t now_us)
+{
+  advance(now_us);
+
+  if (!mOutput.empty())
+    return (mByte_us > 0) ? mOutput_ready_us : now_us;
+  if (mHeartbeat)
+    return mNext_tick_us + mByte_us;
+  return -1;
+} // end nextTransmit()
+
+
+// PRIVATE METHODS
+//
+// advance brings the emulation up to now_us, one second at a time. The
+// first call starts the clock and fills the last minute of counts so
+// that CPM is meaningful at once.
+void
+GMCDeviceModel::advance(int64_t now_us)
+{
+  if (mNext_tick_us == 0)
+  {
+    for(int i=0; i<60; i++)
+      mLast_minute.push_back(uint16_t(mCounts(mRandom) & 0x3fff));
+    mNext_tick_us = now_us + 1000000;
+    return;
+  }
+
+  while (mNext_tick_us <= now_us)
+  {
+    tick(mNext_tick_us);
+    mNext_tick_us += 1000000;
+  }
+
+  return;
+} // end advance()
+
+// tick ends one second: draw its count, report it by heartbeat and
+// account for it in the history log.
+void
+GMCDeviceModel::tick(int64_t at_us)
+{
+  uint16_t count = uint16_t(mCounts(mRandom));
+  if (count > 0x3fff) count = 0x3fff;
+
+  mLast_minute.push_back(count);
+  while (mLast_minute.size() > 60)
+    mLast_minute.pop_front();
+
+  if (mHeartbeat && !mPowered_off)
+  {
+    uint8_t frame[2] = { uint8_t((count >> 8) & 0x3f), uint8_t(count & 0xff) };
+    reply(frame, sizeof(frame), at_us);
+  }
+
+  uint8_t type = mCFG_Data[kCfg_SaveDataType];
+  if ((type >= 1) && (type <= 3) && !mPowered_off)
+  {
+    static const uint32_t kInterval[4] = { 0, 1, 60, 3600 };
+
+    mLog_counts += count;
+    if (++mLog_seconds >= kInterval[type])
+    {
+      // CPH is the CPM averaged over the hour
+      logSample((type == 3) ? uint16_t(mLog_counts / 60) : uint16_t(mLog_counts));
+      mLog_seconds = 0;
+      mLog_counts  = 0;
+    }
+  }
+
+  return;
+} // end tick()
+
+// reply queues bytes for the host. If the link is idle, the first byte
+// is on the wire one byte time after at_us, otherwise the bytes follow
+// those already queued.
+void
+GMCDeviceModel::reply(const uint8_t * data, size_t length, int64_t at_us)
+{
+  if (mOutput.empty())
+    mOutput_ready_us = at_us + mByte_us;
+  mOutput.insert(mOutput.end(), data, data + length);
+  return;
+} // end reply()
+
+// execute carries out a complete command, held in mCommand.
+void
+GMCDeviceModel::execute(int64_t now_us)
+{
+  if (mPowered_off)
+    return;
+
+  string          name = mCommand.substr(1, mName_length - 1);
+  const uint8_t * p    = reinterpret_cast<const uint8_t *>(&mCommand[mName_length]);
+
+  if (name == "GETVER")
+  {
+    reply(reinterpret_cast<const uint8_t *>(mVersion.data()), 14, now_us);
+  }
+  else if ((name == "GETCPM") || (name == "GETCPS"))
+  {
+    uint32_t count = 0;
+    if (name == "GETCPS")
+      count = mLast_minute.back();
+    else
+      for(size_t i=0; i<mLast_minute.size(); i++) count += mLast_minute[i];
+    if (count > 0x3fff) count = 0x3fff;
+
+    uint8_t data[2] = { uint8_t((count >> 8) & 0x3f), uint8_t(count & 0xff) };
+    reply(data, sizeof(data), now_us);
+  }
+  else if (name == "HEARTBEAT1")
+  {
+    mHeartbeat = true;
+  }
+  else if (name == "HEARTBEAT0")
+  {
+    mHeartbeat = false;
+  }
+  else if (name == "GETVOLT")
+  {
+    reply(&mVoltage, 1, now_us);
+  }
+  else if (name == "SPIR")
+  {
+    uint32_t address = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+    uint32_t length  = (uint32_t(p[3]) <<  8) | p[4];
+
+    vector<uint8_t> data(length);
+    for(uint32_t i=0; i<length; i++)
+      data[i] = mFlash[(address + i) % mFlash.size()];
+    reply(data.data(), data.size(), now_us);
+  }
+  else if (name == "GETCFG")
+  {
+    reply(mCFG_Data, sizeof(mCFG_Data), now_us);
+  }
+  else if (name == "ECFG")
+  {
+    memset(mCFG_Data, 0xff, sizeof(mCFG_Data));
+    reply(&kAck, 1, now_us);
+  }
+  else if (name == "WCFG")
+  {
+    mCFG_Data[p[0]] = p[1];
+    reply(&kAck, 1, now_us);
+  }
+  else if (name == "KEY")
+  {
+    // The front panel is not emulated, and a key returns nothing.
+  }
+  else if (name == "GETSERIAL")
+  {
+    reply(mSerial, sizeof(mSerial), now_us);
+  }
+  else if (name == "POWEROFF")
+  {
+    mPowered_off = true;
+    mHeartbeat   = false;
+  }
+  else if (name == "CFGUPDATE")
+  {
+    // A new saveDataType starts a new logging run, with timestamp.
+    if (mCFG_Data[kCfg_SaveDataType] != 0)
+      startLog();
+    reply(&kAck, 1, now_us);
+  }
+  else if (name.compare(0, 7, "SETDATE") == 0)
+  {
+    setClock((name[7] == 'Y') ? 0 : (name[7] == 'M') ? 1 : 2, p[0]);
+    reply(&kAck, 1, now_us);
+  }
+  else if (name.compare(0, 7, "SETTIME") == 0)
+  {
+    setClock((name[7] == 'H') ? 3 : (name[7] == 'M') ? 4 : 5, p[0]);
+    reply(&kAck, 1, now_us);
+  }
+
+  return;
+} // end execute()
+
+// setClock changes one field of the real time clock: 0 = year (last two
+// digits), 1 = month, 2 = day, 3 = hour, 4 = minute, 5 = second.
+void
+GMCDeviceModel::setClock(int field, uint8_t value)
+{
+  time_t     host = time(0);
+  time_t     now  = host + mClock_offset;
+  struct tm  tm;
+
+  gmtime_r(&now, &tm);
+  switch(field)
+  {
+    case 0: tm.tm_year = 100 + value; break;
+    case 1: tm.tm_mon  = value - 1;   break;
+    case 2: tm.tm_mday = value;       break;
+    case 3: tm.tm_hour = value;       break;
+    case 4: tm.tm_min  = value;       break;
+    case 5: tm.tm_sec  = value;       break;
+  }
+  mClock_offset = timegm(&tm) - host;
+
+  return;
+} // end setClock()
+
+// startLog begins a logging run with a date/timestamp record. The data
+// save address in the configuration then points at the first sample of
+// the run, just behind the timestamp.
+void
+GMCDeviceModel::startLog()
+{
+  time_t     now = time(0) + mClock_offset;
+  struct tm  tm;
+  gmtime_r(&now, &tm);
+
+  uint8_t stamp[12] = { 0x55, 0xAA, 0x00,
+                        uint8_t(tm.tm_year % 100), uint8_t(tm.tm_mon + 1),
+                        uint8_t(tm.tm_mday), uint8_t(tm.tm_hour),
+                        uint8_t(tm.tm_min), uint8_t(tm.tm_sec),
+                        0x55, 0xAA, mCFG_Data[kCfg_SaveDataType] };
+  for(uint32_t i=0; i<sizeof(stamp); i++)
+    writeFlash(stamp[i]);
+
+  setDataSaveAddress(mWrite_addr);
+  memcpy(&mCFG_Data[kCfg_SaveDate], &stamp[3], 6);
+
+  mLog_seconds = 0;
+  mLog_counts  = 0;
+
+  return;
+} // end startLog()
+
+// logSample writes one sample, using the two byte record above 255.
+void
+GMCDeviceModel::logSample(uint16_t value)
+{
+  if (value > 0xff)
+  {
+    writeFlash(0x55);
+    writeFlash(0xAA);
+    writeFlash(0x01);
+    writeFlash(uint8_t(value >> 8));
+  }
+  writeFlash(uint8_t(value & 0xff));
+  return;
+} // end logSample()
+
+// writeFlash writes one byte at the write address. Entering a sector
+// erases the sector after it, so the newest data is always followed by
+// erased flash, also after wrapping around.
+void
+GMCDeviceModel::writeFlash(uint8_t value)
+{
+  uint32_t size = mFlash.size();
+
+  if ((mWrite_addr % kSector_Size) == 0)
+  {
+    uint32_t next = (mWrite_addr + kSector_Size) % size;
+    for(uint32_t i=0; (i<kSector_Size) && ((next + i) < size); i++)
+      mFlash[next + i] = 0xff;
+  }
+
+  mFlash[mWrite_addr] = value;
+  mWrite_addr = (mWrite_addr + 1) % size;
+
+  return;
+} // end writeFlash()
+
+void
+GMCDeviceModel::setDataSaveAddress(uint32_t address)
+{
+  mCFG_Data[kCfg_DataSaveAddress + 0] = uint8_t(address >> 16);
+  mCFG_Data[kCfg_DataSaveAddress + 1] = uint8_t(address >>  8);
+  mCFG_Data[kCfg_DataSaveAddress + 2] = uint8_t(address >>  0);
+  return;
+} // end setDataSaveAddress()
+
+uint32_t
+GMCDeviceModel::getDataSaveAddress()
+{
+  return (uint32_t(mCFG_Data[kCfg_DataSaveAddress + 0]) << 16)
+       | (uint32_t(mCFG_Data[kCfg_DataSaveAddress + 1]) <<  8)
+       |  uint32_t(mCFG_Data[kCfg_DataSaveAddress + 2]);
+} // end getDataSaveAddress()
+
+// end file gqdevice.cc
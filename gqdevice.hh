@@ -0,0 +1,171 @@
+// **************************************************************************
+// File: gqdevice.hh
+//
+// Description:
+//    Declare the GMCDeviceModel class, an emulation of a GQ GMC which
+//    implements every command of GQ-RFC1201. It is the engine of the
+//    gqgmc-sim emulator (see gqsim.cc), and since it is a GQDeviceModel
+//    it can equally sit behind a LoopbackTransport in-process.
+//
+// EMULATION OVERVIEW
+//
+// The emulated GQ GMC counts radiation as a Poisson process with a
+// configurable mean, one draw per second. The last 60 one-second counts
+// make up the CPM. All returned data leaves the device one byte per
+// byte time, 10 bit times at the emulated baud rate, so at 57600 baud a
+// 4K history read takes about 0.7 seconds, just as on the real link.
+//
+// The device keeps a 256 byte NVM configuration and a history flash
+// image. The image can be loaded from a file. When history logging is
+// enabled (saveDataType in the configuration), samples are written to
+// the flash in the format documented at getHistoryData() in gqgmc.cc:
+// a date/timestamp record starting each logging run, one byte per
+// sample, and the 55AA01 two byte record for samples above 255. The
+// logging wraps around at the end of the flash and erases each 4K
+// sector as it enters it, so there is always an erased (0xFF) area
+// ahead of the newest data.
+//
+// There is no thread inside the model. Time advances whenever the
+// host side calls receive(), transmit() or nextTransmit() with the
+// current time, and every second which has passed meanwhile is
+// counted, reported by the heartbeat and logged in turn.
+//
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "gqtransport.hh"
+
+#ifndef gqdevice_hh_
+#define gqdevice_hh_
+
+namespace GQLLC
+{
+
+  // EMULATED GQ GMC
+  //
+  // The class declaration - see gqdevice.cc for documentation
+  class GMCDeviceModel : public GQDeviceModel
+  {
+    public:
+
+    GMCDeviceModel();
+
+    // CONFIGURATION METHODS, to be called before the host attaches.
+
+    // Method to set the 14 character GETVER reply, eg, "GMC-300Re 4.20".
+    void
+    setVersion(const std::string & version);
+
+    // Method to set the 7 byte serial number.
+    void
+    setSerialNumber(const uint8_t serial[7]);
+
+    // Method to set the mean count rate in counts per minute.
+    void
+    setMeanCPM(double cpm);
+
+    // Method to seed the count generator, for repeatable runs.
+    void
+    setSeed(uint32_t seed);
+
+    // Method to set the emulated baud rate, which sets the byte time.
+    void
+    setBaud(uint32_t baud);
+
+    // Method to set the battery voltage, in volts.
+    void
+    setBatteryVoltage(float volts);
+
+    // Method to set the size of the history flash, erased to 0xFF.
+    void
+    setFlashSize(uint32_t size);
+
+    // Method to load the history flash from a file. The flash takes
+    // the size of the file. Returns false if the file cannot be read.
+    bool
+    loadFlash(const std::string & file_name);
+
+    // Method to save the history flash to a file.
+    bool
+    saveFlash(const std::string & file_name);
+
+    // Method to enable history logging, ie, set saveDataType.
+    void
+    setSaveDataType(uint8_t save_data_type);
+
+    // Method to tell whether the host has sent POWEROFF.
+    bool
+    isPoweredOff()
+    {
+      return mPowered_off;
+    };
+
+    // GQDeviceModel METHODS
+    virtual void     receive(const uint8_t * data, size_t length,
+                             int64_t now_us);
+    virtual size_t   transmit(uint8_t * data, size_t length, int64_t now_us);
+    virtual int64_t  nextTransmit(int64_t now_us);
+
+    private:
+
+    // Identity
+    std::string            mVersion;
+    uint8_t                mSerial[7];
+    uint8_t                mVoltage;       // volts times 10
+
+    // Count generation: one Poisson draw per second, the last 60 of
+    // which are kept for CPM, oldest first.
+    std::mt19937           mRandom;
+    std::poisson_distribution<int>  mCounts;
+    std::deque<uint16_t>   mLast_minute;
+    int64_t                mNext_tick_us;  // end of the running second
+
+    // Heartbeat (HEARTBEAT1) on or off
+    bool                   mHeartbeat;
+
+    // Returned bytes and the time the first of them is on the wire.
+    std::deque<uint8_t>    mOutput;
+    int64_t                mOutput_ready_us;
+    uint32_t               mByte_us;
+
+    // Command parser state: the bytes of the command so far, and the
+    // number of parameter bytes expected once the name is recognized.
+    std::string            mCommand;
+    int                    mParam_count;
+    size_t                 mName_length;
+
+    // NVM configuration and history flash
+    uint8_t                mCFG_Data[256];
+    std::vector<uint8_t>   mFlash;
+    uint32_t               mWrite_addr;
+    uint32_t               mLog_seconds;   // seconds into the log interval
+    uint32_t               mLog_counts;    // counts so far in the interval
+
+    // Real time clock, kept as an offset to the host's clock.
+    time_t                 mClock_offset;
+
+    bool                   mPowered_off;
+
+    // Internal methods
+    void     advance(int64_t now_us);
+    void     tick(int64_t at_us);
+    void     reply(const uint8_t * data, size_t length, int64_t at_us);
+    void     execute(int64_t now_us);
+    void     setClock(int field, uint8_t value);
+    void     startLog();
+    void     logSample(uint16_t value);
+    void     writeFlash(uint8_t value);
+    void     setDataSaveAddress(uint32_t address);
+    uint32_t getDataSaveAddress();
+
+  }; // end class GMCDeviceModel
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqdevice.cc
+#endif  // gqdevice_hh_
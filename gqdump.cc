@@ -0,0 +1,170 @@
+// **************************************************************************
+// File: gqdump.cc
+//
+// Synopsis:
+//   Define the GQFlashDump class, which reads the history flash of a GQ
+//   GMC in pipelined SPIR chunks and streams it to a sink.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqdump.hh
+//
+//
+// C++ includes
+#include <string>
+using namespace std;
+
+// Linux C includes
+#include <time.h>
+#include <unistd.h>
+
+// These are GQ GMC project specific includes
+#include "gqdump.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// Chunks per batch by default. A batch of 4 chunks of 4K bytes takes
+// about 3 seconds at 57600 baud, so progress is reported that often,
+// and a failure costs at most that much to read again.
+static
+uint32_t
+const          kBatch_Chunks = 4;
+
+// Failed batches in a row, without a byte of progress, before run()
+// gives up.
+static
+uint32_t
+const          kMax_Retries = 5;
+
+// How long restoreLink() keeps trying to restore a lost link.
+static
+int64_t
+const          kReconnect_Wait_ms = 10000;
+
+// LOCAL UTILITIES
+//
+// Read the monotonic clock in milliseconds.
+static
+int64_t
+monotonic_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// GQFLASHDUMP CLASS CONSTRUCTOR
+GQFlashDump::GQFlashDump(GQGMC * gmc, GQFlashDumpSink * sink)
+  : mGMC(gmc), mSink(sink), mStart(0), mEnd(gmc->getFlashSize()),
+    mNext(0), mTuner(0)
+{
+  setChunking(kHistory_Data_Maxsize, kBatch_Chunks);
+} // end GQFlashDump constructor
+
+void
+GQFlashDump::setRange(uint32_t start, uint32_t end)
+{
+  mStart = start;
+  mEnd   = (end > start) ? end : start;
+  mNext  = mStart;
+  return;
+} // end setRange()
+
+void
+GQFlashDump::setChunking(uint32_t chunk_bytes, uint32_t batch_chunks)
+{
+  mChunk        = ((chunk_bytes > 0) && (chunk_bytes <= kHistory_Data_Maxsize))
+                ? chunk_bytes : kHistory_Data_Maxsize;
+  mBatch_chunks = (batch_chunks > 0) ? batch_chunks : 1;
+  mBuffer.resize(mChunk * mBatch_chunks);
+  return;
+} // end setChunking()
+
+void
+GQFlashDump::setTuner(GQChunkTuner * tuner)
+{
+  mTuner = tuner;
+  return;
+} // end setTuner()
+
+// run reads batch after batch. Whatever part of a batch arrived in full
+// is delivered and moves the last good offset, so a failed batch is
+// retried from its first missing chunk. Only failures without any
+// progress count towards kMax_Retries.
+bool
+GQFlashDump::run()
+{
+  dump_progress_t  progress = dump_progress_t();
+  uint32_t         failures = 0;
+  int64_t          started  = monotonic_ms();
+
+  progress.next_address  = mNext;
+  progress.end_address   = mEnd;
+  progress.bytes_done    = 0;
+  progress.bytes_total   = mEnd - mStart;
+  progress.retries       = 0;
+  progress.tail_retries  = 0;
+  progress.bytes_per_sec = 0.0f;
+
+  while (mNext < mEnd)
+  {
+    if (mGMC->isLinkLost() && (restoreLink() == false))
+      return false;
+
+    uint32_t length = mEnd - mNext;
+    if (length > mBuffer.size())
+      length = mBuffer.size();
+
+    uint32_t good = (mTuner != 0)
+                  ? mTuner->read(mNext, length, &mBuffer[0])
+                  : mGMC->readHistory(mNext, length, &mBuffer[0], mChunk);
+
+    const vector<uint32_t> & tails = mGMC->getChunkRetries();
+    for(uint32_t i=0; i<tails.size(); i++)
+      progress.tail_retries += tails[i];
+
+    if (good > 0)
+    {
+      if (mSink->onData(mNext, &mBuffer[0], good) == false)
+        return false;
+      mNext               += good;
+      progress.bytes_done += good;
+      failures             = 0;
+    }
+
+    if (good < length)
+    {
+      progress.retries++;
+      if (++failures >= kMax_Retries)
+        return false;
+    }
+
+    int64_t elapsed = monotonic_ms() - started;
+    progress.next_address  = mNext;
+    progress.bytes_per_sec = (elapsed > 0)
+                           ? (progress.bytes_done * 1000.0f) / elapsed : 0.0f;
+    mSink->onProgress(progress);
+  }
+
+  return true;
+} // end run()
+
+// restoreLink calls reconnect() whenever its backoff allows, sleeping in
+// between.
+bool
+GQFlashDump::restoreLink()
+{
+  int64_t give_up = monotonic_ms() + kReconnect_Wait_ms;
+
+  while (mGMC->reconnect() == false)
+  {
+    int64_t delay = mGMC->getReconnectDelay();
+    if ((monotonic_ms() + delay) > give_up)
+      return false;
+    usleep(useconds_t(delay) * 1000 + 1000);
+  }
+
+  return true;
+} // end restoreLink()
+
+// end file gqdump.cc
@@ -0,0 +1,157 @@
+// **************************************************************************
+// File: gqdump.hh
+//
+// Description:
+//    Declare the GQFlashDump class, which reads the whole history flash
+//    of a GQ GMC, or a range of it, and streams it to a sink.
+//
+// FLASH DUMP OVERVIEW
+//
+// The history flash is where the GQ GMC logs while no host is listening,
+// so a dump of it is the way to back-fill a gap in the host's own
+// record. getHistoryData() reads at most kHistory_Data_Maxsize bytes
+// into one internal buffer; the dump instead walks the range in batches
+// of several chunks, each batch read by GQGMC::readHistory() with the
+// SPIR commands of its chunks pipelined, and hands every batch to a
+// GQFlashDumpSink in address order as soon as it has arrived.
+//
+// A chunk whose reply comes back short is completed by readHistory()
+// itself, which asks again for the missing tail only; the number of
+// such SPIRs is reported as tail_retries. A batch fails only when that
+// does not help.
+//
+// The dump keeps the address up to which everything has been delivered,
+// the last good offset. When a batch fails part way, the chunks which
+// did arrive are delivered and the dump carries on from the first one
+// which did not, after restoring the link if it was lost (see
+// GQGMC::reconnect()). After kMax_Retries failures in a row without any
+// progress, run() gives up and returns false; calling run() again later
+// resumes at the last good offset. So does a new GQFlashDump whose start
+// is set to it, eg, the size of a partly written dump file.
+//
+// With a GQChunkTuner (gqtune.hh) set, each batch is read at the SPIR
+// chunk size the tuner chooses, rather than a fixed one, and the tuner
+// learns from how it went.
+//
+// The sink is told the progress, the bytes delivered, the total and the
+// rate in bytes per second, after every batch.
+//
+#include <vector>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+#include "gqtune.hh"
+
+#ifndef gqdump_hh_
+#define gqdump_hh_
+
+namespace GQLLC
+{
+
+  // The progress of a dump.
+  struct dump_progress_t
+  {
+    uint32_t  next_address;    // the last good offset
+    uint32_t  end_address;     // 0 if not known, as in a history sync
+    uint32_t  bytes_done;      // delivered since run() was called
+    uint32_t  bytes_total;     // from the start to the end, or 0
+    uint32_t  retries;         // failed batches so far
+    uint32_t  tail_retries;    // SPIRs for the tails of short replies
+    float     bytes_per_sec;   // bytes_done over the time of run()
+  };
+
+
+  // FLASH DUMP SINK
+  //
+  // Abstract class of the receiver of a dump.
+  class GQFlashDumpSink
+  {
+    public:
+
+    virtual
+    ~GQFlashDumpSink()
+    {
+    };
+
+    // The next length bytes of flash, from address on, have arrived.
+    // Return false to stop the dump, eg, when they cannot be stored.
+    virtual
+    bool
+    onData(uint32_t address, const uint8_t * data, uint32_t length) = 0;
+
+    // The dump has progressed, called after every batch.
+    virtual
+    void
+    onProgress(const dump_progress_t & progress)
+    {
+    };
+
+  }; // end class GQFlashDumpSink
+
+
+  // FLASH DUMP
+  //
+  // The class declaration - see gqdump.cc for documentation
+  class GQFlashDump
+  {
+    public:
+
+    // The GQGMC and the sink are owned by the caller and must outlive
+    // the dump. The range defaults to the whole flash of the GQ GMC,
+    // see GQGMC::getFlashSize().
+    GQFlashDump(GQGMC * gmc, GQFlashDumpSink * sink);
+
+    // Method to set the range of flash to dump, from start up to but
+    // not including end. The last good offset is set to start.
+    void
+    setRange(uint32_t start, uint32_t end);
+
+    // Method to set the size of each SPIR, at most
+    // kHistory_Data_Maxsize, and the number of chunks per batch.
+    void
+    setChunking(uint32_t chunk_bytes, uint32_t batch_chunks);
+
+    // Method to have the chunk size chosen by a tuner, owned by the
+    // caller, instead, or 0 for none.
+    void
+    setTuner(GQChunkTuner * tuner);
+
+    // Method to dump from the last good offset up to the end. Returns
+    // true when the end is reached, false if the dump gave up or the
+    // sink stopped it, see getNextAddress().
+    bool
+    run();
+
+    // Method to get the last good offset, where run() resumes.
+    uint32_t
+    getNextAddress()
+    {
+      return mNext;
+    };
+
+    private:
+
+    GQGMC *               mGMC;
+    GQFlashDumpSink *     mSink;
+
+    uint32_t              mStart;
+    uint32_t              mEnd;
+    uint32_t              mNext;
+
+    uint32_t              mChunk;
+    uint32_t              mBatch_chunks;
+    GQChunkTuner *        mTuner;
+    std::vector<uint8_t>  mBuffer;
+
+    // Wait for a lost link to come back, at most until the backoff of
+    // reconnect() passes kReconnect_Wait_ms. Returns true if it is up.
+    bool
+    restoreLink();
+
+  }; // end class GQFlashDump
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqdump.cc
+#endif  // gqdump_hh_
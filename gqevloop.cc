@@ -0,0 +1,131 @@
+// **************************************************************************
+// File: gqevloop.cc
+//
+// Synopsis:
+//   Define the GQEventLoop class, which serves any number of GQ GMCs in
+//   heartbeat mode from a single thread using epoll.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqevloop.hh
+//
+//
+// C++ includes
+#include <algorithm>
+using namespace std;
+
+// Linux C includes
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+// These are GQ GMC project specific includes
+#include "gqevloop.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// Number of ready file descriptors taken from one epoll_wait(). More
+// are simply reported by the next call.
+static
+int
+const          kMax_Events = 64;
+
+// Number of samples taken from a GQ GMC per readAutoCPS() call. At one
+// frame per second a counter rarely has more than one waiting.
+static
+uint32_t
+const          kMax_Samples = 16;
+
+
+// GQEVENTLOOP CLASS CONSTRUCTOR
+GQEventLoop::GQEventLoop(GQSampleListener * listener)
+  : mListener(listener)
+{
+  mEpoll_fd = epoll_create1(EPOLL_CLOEXEC);
+} // end GQEventLoop constructor
+
+GQEventLoop::~GQEventLoop()
+{
+  if (mEpoll_fd != -1)
+    close(mEpoll_fd);
+} // end GQEventLoop destructor
+
+// addDevice registers the file descriptor of the GQ GMC for input. The
+// GQ GMC itself is the epoll user data, so that a ready event leads
+// straight to the object to read from.
+bool
+GQEventLoop::addDevice(GQGMC * gmc)
+{
+  int fd = gmc->getPollFd();
+  if ((mEpoll_fd == -1) || (fd == -1))
+    return false;
+
+  struct epoll_event event;
+  event.events   = EPOLLIN;
+  event.data.ptr = gmc;
+  if (epoll_ctl(mEpoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    return false;
+
+  mDevices.push_back(gmc);
+  return true;
+} // end addDevice()
+
+void
+GQEventLoop::removeDevice(GQGMC * gmc)
+{
+  vector<GQGMC *>::iterator it = find(mDevices.begin(), mDevices.end(), gmc);
+  if (it == mDevices.end())
+    return;
+
+  int fd = gmc->getPollFd();
+  if (fd != -1)
+    epoll_ctl(mEpoll_fd, EPOLL_CTL_DEL, fd, 0);
+  mDevices.erase(it);
+
+  return;
+} // end removeDevice()
+
+// dispatch is one turn of the loop. The registration is level
+// triggered, so a GQ GMC which is not drained completely in this turn is
+// simply reported again by the next one. Within a turn, each ready GQ
+// GMC is drained until readAutoCPS() returns fewer samples than asked
+// for, which covers the frames it parked in its receive buffer. A
+// signal interrupting the wait is not a failure, the turn just
+// dispatches nothing.
+int
+GQEventLoop::dispatch(int timeout_ms)
+{
+  struct epoll_event events[kMax_Events];
+  cps_sample_t       samples[kMax_Samples];
+  int                dispatched = 0;
+
+  int ready = epoll_wait(mEpoll_fd, events, kMax_Events, timeout_ms);
+  if (ready < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  for(int i=0; i<ready; i++)
+  {
+    GQGMC *  gmc  = static_cast<GQGMC *>(events[i].data.ptr);
+    bool     lost = false;
+    uint32_t count;
+
+    do
+    {
+      count = gmc->readAutoCPS(samples, kMax_Samples);
+      for(uint32_t s=0; s<count; s++)
+        mListener->onSample(gmc, samples[s]);
+      dispatched += count;
+
+      lost = gmc->isLinkLost();
+    } while ((count == kMax_Samples) && !lost);
+
+    if (lost)
+    {
+      removeDevice(gmc);
+      mListener->onLinkLost(gmc);
+    }
+  } // end for loop
+
+  return dispatched;
+} // end dispatch()
+
+// end file gqevloop.cc
@@ -0,0 +1,120 @@
+// **************************************************************************
+// File: gqevloop.hh
+//
+// Description:
+//    Declare the GQEventLoop class, which serves any number of GQ GMCs
+//    in heartbeat mode from a single thread.
+//
+// EVENT LOOP OVERVIEW
+//
+// With the heartbeat turned on (see turnOnCPS() in gqgmc.cc), a GQ GMC
+// sends a two byte CPS frame every second on its own accord. Reading it
+// with getAutoCPS() blocks for up to a second, which is fine for one
+// counter but means one thread per counter when there are many. The
+// event loop instead registers the file descriptor of every counter with
+// a single epoll instance and sleeps until one or more of them have
+// something to read. Each readable counter is then drained without
+// blocking by readAutoCPS(), and every complete frame is handed to a
+// listener as a timestamped sample. The cost is one epoll_wait() wake up
+// per batch of arrivals, regardless of the number of counters, so dozens
+// of counters, real or emulated by gqgmc-sim, can be served by a small
+// low power host.
+//
+// The counters must be opened and have the heartbeat turned on before
+// they are added, and must not be sent other commands while in the loop.
+// Only transports with a file descriptor (serial ports and ptys) can
+// take part, see GQTransport::pollFd() in gqtransport.hh.
+//
+#include <vector>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+
+#ifndef gqevloop_hh_
+#define gqevloop_hh_
+
+namespace GQLLC
+{
+
+  // SAMPLE LISTENER
+  //
+  // Abstract class receiving the output of the event loop. Both methods
+  // are called from within dispatch().
+  class GQSampleListener
+  {
+    public:
+
+    virtual
+    ~GQSampleListener()
+    {
+    };
+
+    // A CPS sample has arrived from the given GQ GMC.
+    virtual
+    void
+    onSample(GQGMC * gmc, const cps_sample_t & sample) = 0;
+
+    // The link to the given GQ GMC failed, eg, the adapter was
+    // unplugged. The GQ GMC has already been removed from the loop, so
+    // the listener may close or delete it.
+    virtual
+    void
+    onLinkLost(GQGMC * gmc)
+    {
+    };
+
+  }; // end class GQSampleListener
+
+
+  // EVENT LOOP
+  //
+  // The class declaration - see gqevloop.cc for documentation
+  class GQEventLoop
+  {
+    public:
+
+    // The listener is owned by the caller and must outlive the loop.
+    GQEventLoop(GQSampleListener * listener);
+
+    virtual
+    ~GQEventLoop();
+
+    // Method to add an open GQ GMC with its heartbeat on. Returns false
+    // if it has no file descriptor or cannot be registered.
+    bool
+    addDevice(GQGMC * gmc);
+
+    // Method to remove a GQ GMC from the loop. It is not closed.
+    void
+    removeDevice(GQGMC * gmc);
+
+    // Method to get the number of GQ GMCs in the loop.
+    uint32_t
+    getDeviceCount()
+    {
+      return mDevices.size();
+    };
+
+    // Method to wait up to timeout_ms for samples and dispatch them to
+    // the listener. Returns the number of samples dispatched, or -1 if
+    // waiting failed.
+    int
+    dispatch(int timeout_ms);
+
+    private:
+
+    // The epoll instance all file descriptors are registered with.
+    int                     mEpoll_fd;
+
+    GQSampleListener *      mListener;
+
+    // The GQ GMCs in the loop.
+    std::vector<GQGMC *>    mDevices;
+
+  }; // end class GQEventLoop
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqevloop.cc
+#endif  // gqevloop_hh_
@@ -0,0 +1,92 @@
+// **************************************************************************
+// File: gqframe.cc
+//
+// Synopsis:
+//   Define the GQFramer class, which finds the frame boundaries in the
+//   heartbeat byte stream of a GQ GMC.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqframe.hh
+//
+//
+// These are GQ GMC project specific includes
+#include "gqframe.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The second byte of a frame must arrive within this many milliseconds
+// of the first. The bytes themselves are 0.17 milliseconds apart at
+// 57600 baud, but a USB-serial adapter may hold a byte back for its
+// latency timer (16 milliseconds by default for FTDI) and the reader may
+// be late, while the next frame is a whole second away.
+static
+int64_t
+const          kFrame_Gap_ms = 250;
+
+// The reserved bits 14 and 15, in the first byte of a frame.
+static
+uint8_t
+const          kReserved_Bits = 0xc0;
+
+
+// GQFRAMER CLASS CONSTRUCTOR
+GQFramer::GQFramer()
+  : mHave_first(false), mFirst(0), mFirst_ms(0), mIn_sync(true),
+    mResync_count(0)
+{
+} // end GQFramer constructor
+
+void
+GQFramer::reset()
+{
+  mHave_first = false;
+  mIn_sync    = true;
+  return;
+} // end reset()
+
+// put is the framing state machine. With a first byte pending, the new
+// byte completes the frame, unless it arrived after the gap between
+// frames. Then the pending byte was left over from a damaged frame and
+// is dropped, and the new byte is taken as the first byte of the next
+// frame. A first byte must have its reserved bits clear, otherwise it is
+// really a second byte and is dropped as well. Consecutive drops count
+// as one resynchronization.
+bool
+GQFramer::put(uint8_t byte, int64_t arrival_ms, uint16_t & cps)
+{
+  if (mHave_first)
+  {
+    mHave_first = false;
+
+    if ((arrival_ms - mFirst_ms) <= kFrame_Gap_ms)
+    {
+      cps = (uint16_t(mFirst & ~kReserved_Bits) << 8) | byte;
+      mIn_sync = true;
+      return true;
+    }
+    lostSync();
+  }
+
+  if ((byte & kReserved_Bits) != 0)
+  {
+    lostSync();
+    return false;
+  }
+
+  mHave_first = true;
+  mFirst      = byte;
+  mFirst_ms   = arrival_ms;
+
+  return false;
+} // end put()
+
+void
+GQFramer::lostSync()
+{
+  if (mIn_sync)
+    mResync_count++;
+  mIn_sync = false;
+  return;
+} // end lostSync()
+
+// end file gqframe.cc
@@ -0,0 +1,85 @@
+// **************************************************************************
+// File: gqframe.hh
+//
+// Description:
+//    Declare the GQFramer class, which finds the frame boundaries in the
+//    heartbeat byte stream of a GQ GMC.
+//
+// HEARTBEAT FRAMING
+//
+// With the heartbeat on, the GQ GMC sends the CPS of every second as two
+// bytes, MSB first, for example "10 1C". Nothing marks the start of a
+// frame, so a reader which simply takes the bytes in pairs stays
+// misaligned forever after a single byte is lost, and every later sample
+// is garbage. Two properties of the stream do mark the boundaries:
+//
+//   - bits 14 and 15 of a frame are reserved and always zero (GQ-RFC1201),
+//     so a byte with either of its top two bits set cannot be the first
+//     byte of a frame;
+//   - the two bytes of a frame follow each other within a millisecond or
+//     so, while frames are a second apart. A byte which arrives long
+//     after the byte before it starts a new frame.
+//
+// GQFramer applies both rules to every byte. A byte which fails them is
+// dropped and counted as a resynchronization, and the stream is aligned
+// again with the first frame after a gap, that is, within one frame.
+// The timing rule needs the arrival time of each byte, which is known
+// only as well as the bytes are read promptly. For bytes which have
+// piled up unread, only the reserved bit rule is left.
+//
+#include <stdint.h>
+
+#ifndef gqframe_hh_
+#define gqframe_hh_
+
+namespace GQLLC
+{
+
+  // HEARTBEAT FRAMER
+  //
+  // The class declaration - see gqframe.cc for documentation
+  class GQFramer
+  {
+    public:
+
+    GQFramer();
+
+    // Method to forget a partial frame, eg, when the heartbeat is
+    // turned on. The resync count is kept.
+    void
+    reset();
+
+    // Method to take one byte which arrived at arrival_ms (monotonic
+    // clock). Returns true if it completes a frame, whose CPS value is
+    // then stored in cps.
+    bool
+    put(uint8_t byte, int64_t arrival_ms, uint16_t & cps);
+
+    // Method to get the number of resynchronizations so far.
+    uint32_t
+    getResyncCount()
+    {
+      return mResync_count;
+    };
+
+    private:
+
+    // The first byte of a frame, if one is pending, and its arrival.
+    bool       mHave_first;
+    uint8_t    mFirst;
+    int64_t    mFirst_ms;
+
+    // False from a dropped byte until the next complete frame.
+    bool       mIn_sync;
+    uint32_t   mResync_count;
+
+    // Count a resynchronization, once per loss of alignment.
+    void
+    lostSync();
+
+  }; // end class GQFramer
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqframe.cc
+#endif  // gqframe_hh_
@@ -20,13 +20,13 @@
 #include <iostream>
 #include <iomanip>
 #include <ios>
+#include <cstdio>
 using namespace std;
 
-// These are the C stdio includes needed for configuring the serial port.
-#include <unistd.h>
-#include <fcntl.h>
-#include <termios.h>
+// These are the C includes needed for the receive path.
 #include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 
 // These are GQ GMC project specific includes
 #include "gqgmc.hh"
@@ -66,24 +66,110 @@ static const string  turn_off_pwr_cmd      = "<POWEROFF>>";
 // The set time and set date commands also use a hexadecimal parameter
 // and so need to be formed dynamically.
 
-// FIRMWARE CONSTANT
-// Older firmware is any revision prior to 2.23. Not all commands will
-// work on older firmware because some commands were not supported or
-// the command was changed.
-static
-float
-const          kNew_Firmware = 2.23f;
-
 // Size of the NVM configuration data on the GQ GMC
 static
 uint32_t
 const          kNVMSize = 256;
 
-// C STYLE SERIAL PORT CONFIGURATION
-// The termios structure is needed to configure the USB/serial port
-// for baudrate and raw line discipline.
-static struct
-termios        settings;
+// RECEIVE BUFFER AND TIMEOUT CONSTANTS
+// Size of the reusable receive buffer. A single read drains up to
+// this much beyond the bytes the current reply still needs.
+static
+uint32_t
+const          kRx_Bufsize = 0x1000;
+
+// Every reply must arrive within one deadline which is computed when
+// the read starts (see replyTimeout()): a fixed allowance for the GQ GMC
+// to react to the command plus the time the expected number of bytes
+// takes on the wire at the link baud rate, stretched by a safety margin
+// of kTransfer_Margin_pct percent. Each byte is framed by a start and a
+// stop bit, so it costs 10 bit times.
+static
+uint32_t
+const          kReply_Latency_ms = 100;
+
+static
+uint32_t
+const          kTransfer_Margin_pct = 150;
+
+static
+uint32_t
+const          kBits_Per_Byte = 10;
+
+// The configuration commands, ECFG, WCFG and CFGUPDATE, write the flash
+// of the GQ GMC before they acknowledge, which takes far longer than
+// kReply_Latency_ms, so their one byte ack is allowed at least this
+// long, as much as the 0.5 s per byte read timeout of old. See
+// configTimeout().
+static
+uint32_t
+const          kConfig_Reply_Timeout_ms = 500;
+
+// When the link is suspected to be out of step, clearUSB() flushes the
+// input and then requires the port to stay quiet for this long before
+// the link is considered clean again. That catches the tail of a reply
+// or a CPS frame which was still on the wire during the flush.
+static
+int
+const          kDrain_Quiet_ms = 20;
+
+// Default for the number of queued commands runQueue() keeps in flight.
+static
+uint32_t
+const          kPipeline_Depth = 8;
+
+// readHistory() completes a short SPIR reply by asking again for what is
+// missing, at most this many times per chunk, starting kTail_Overlap
+// bytes before the end of what arrived, or further back, see
+// overlap_start(). The overlap must match the data kept, so that bytes
+// lost in the middle of a reply, which shift the rest of it, are not
+// taken for a clean early end.
+static
+uint32_t
+const          kMax_Tail_Retries = 3;
+
+static
+uint32_t
+const          kTail_Overlap = 16;
+
+// The only baud rate documented by GQ-RFC1201, and the one tried first
+// on a port whose rate is not cached.
+static
+uint32_t
+const          kDefault_Baud = 57600;
+
+// The baud rates tried by negotiateBaud() after the factory rates of the
+// models (see gqmodel.cc), in order. Every model may be set to another
+// rate from its menu, and some units run slower. Every rate tried which
+// is wrong costs a GETVER timeout of a little over 100 milliseconds.
+static
+uint32_t
+const          kBaud_Fallbacks[] = { 38400, 19200, 9600 };
+static
+uint32_t
+const          kBaud_Fallback_Count = sizeof(kBaud_Fallbacks) / sizeof(uint32_t);
+
+// Room for the factory rates and the fallbacks.
+static
+uint32_t
+const          kMax_Baud_Candidates = 16;
+
+// The heartbeat delivers one CPS frame every second, so getAutoCPS()
+// waits a little longer than that before giving up.
+static
+uint32_t
+const          kHeartbeat_Timeout_ms = 1100;
+
+// After the link is lost, reconnect() tries again at once, and then
+// waits twice as long after each failed attempt, from kReconnect_Min_ms
+// up to kReconnect_Max_ms. A USB glitch costs a fraction of a second,
+// while an unplugged adapter is probed only twice a minute.
+static
+uint32_t
+const          kReconnect_Min_ms = 250;
+static
+uint32_t
+const          kReconnect_Max_ms = 30000;
 
 // debug code
 // LOCAL UTILITIES
@@ -112,6 +198,63 @@ HexCharStruct Hex(unsigned char _c)
   return HexCharStruct(_c);
 }
 
+// Read the monotonic clock in milliseconds. Deadlines are computed
+// against this clock so they are immune to wall clock adjustments.
+static
+int64_t
+monotonic_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Convert a time of the monotonic clock to milliseconds.
+static
+int64_t
+timespec_ms(const struct timespec & ts)
+{
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Find where the overlap with the end of the data kept, length bytes,
+// starts: kTail_Overlap bytes before the end, or more than lost bytes
+// before it if that is further, or further back still, at the last byte
+// which differs from the one after it. Data shifted by a lost byte
+// matches data which is the same byte value throughout, eg, the erased
+// 0xFF ahead of the write end or a run of low counts, so the overlap
+// must reach back to a change of value, and the change must lie more
+// than the bytes lost before the end, to tell. Data without any change
+// is compared in whole.
+static
+uint32_t
+overlap_start(const uint8_t * data, uint32_t length, uint32_t lost)
+{
+  uint32_t span = (lost >= kTail_Overlap) ? (lost + 1) : kTail_Overlap;
+  uint32_t from = (length > span) ? (length - span) : 0;
+  uint32_t run  = length;
+
+  while ((run > 1) && (data[run - 2] == data[length - 1]))
+    run--;
+  if (run <= 1)
+    return 0;
+
+  return ((run - 2) < from) ? (run - 2) : from;
+}
+
+// Tell whether data, length bytes, is one byte value throughout.
+static
+bool
+one_value(const uint8_t * data, uint32_t length)
+{
+  for(uint32_t i=1; i<length; i++)
+  {
+    if (data[i] != data[0])
+      return false;
+  }
+  return true;
+}
+
 
 // GQGMC CLASS CONSTRUCTOR
 //
@@ -122,8 +265,41 @@ GQGMC::GQGMC()
 {
   // CPS is false until proven true
   mCPS_is_on             = false;
+  // Nothing is known about the state of the link until it is drained
+  mLink_clean            = false;
+  // The link is not lost before it is opened
+  mLink_lost             = false;
+  mLost_at_ms            = 0;
+  mReconnect_due_ms      = 0;
+  mReconnect_delay_ms    = kReconnect_Min_ms;
+  mLast_gap_ms           = 0;
+  // No transport until openUSB() or openTransport()
+  mTransport             = 0;
+  mOwn_transport         = false;
+  // The serial port is read by the caller's thread unless asked
+  mReader                = 0;
+  mReader_thread         = false;
+  mReader_cpu            = -1;
+  mReader_priority       = 0;
   // Allocate history_data on heap
   mHistory_data          = new uint8_t[kHistory_Data_Maxsize];
+  // Baud rate is the documented default until openUSB() says otherwise,
+  // and the reply timeout is computed rather than overridden.
+  mBaud_rate             = kDefault_Baud;
+  mTimeout_override_ms   = 0;
+  // Nothing is known about the model until openUSB() asks for it
+  mFirmware_revision     = 0.0f;
+  mModel                 = &GQModelRegistry::getDefault();
+  // Pipeline commands queued by queueCmd() up to the default depth
+  mPipeline_depth        = kPipeline_Depth;
+  mRead_count            = 0;
+  // Allocate the receive buffer on heap, initially empty
+  mRx_buffer             = new uint8_t[kRx_Bufsize];
+  mRx_head               = 0;
+  mRx_tail               = 0;
+  mRx_mono.tv_sec        = 0;
+  mRx_mono.tv_nsec       = 0;
+  mRx_real               = mRx_mono;
   // Determine endianess of host CPU
   mBig_endian            = isBigEndian();
 } // end GQGMC constructor
@@ -134,7 +310,8 @@ GQGMC::GQGMC()
 
 // SUPPORTING PUBLIC METHODS
 //
-// Method to call to open USB port. We are using classic C style IO
+// Method to call to open USB port. The serial port itself is handled by
+// a TTYTransport (see gqtransport.cc) which uses classic C style IO
 // because the C++ IO streams did not have enough flexibility to
 // control serial port.  I could not set the baudrate using iostream.
 // Apparently, C++ IO is fixated on files and not hardware devices.
@@ -147,8 +324,6 @@ GQGMC::openUSB(string usb_device_name)
   mUSB_device = usb_device_name;  // for example, /dev/usb/ttyUSB0
 
   // Open the USB port using a USB to serial converter device driver.
-  // We are using the C stdio open only because it allows the low
-  // level control necessary to set line discpline and baudrate.
   // The line discpline is raw, that is, no character translation,
   // no handshaking, no nothing. The return data from the GQ GMC
   // are always raw binary (well, some of the raw binary might be
@@ -157,73 +332,412 @@ GQGMC::openUSB(string usb_device_name)
 
   cout << mUSB_device.c_str() << endl;
 
-  // Open usb serial port for reading and writing.
-  mUSB_serial = open(mUSB_device.c_str(), O_RDWR);
+  // Optionally, the bytes are recorded as they pass the port, and a
+  // reader thread takes them off the port as they arrive, see
+  // gqthread.hh.
+  GQTransport * transport = new TTYTransport(mUSB_device);
+  if (mTrace_file.empty() == false)
+    transport = new RecordTransport(transport, mTrace_file, true);
+  if (mReader_thread == true)
+  {
+    ThreadedTransport * reader = new ThreadedTransport(transport, true);
+    reader->setScheduling(mReader_cpu, mReader_priority);
+    transport = reader;
+  }
+
+  attachTransport(transport, true);
+  if (mReader_thread == true)
+    mReader = static_cast<ThreadedTransport *>(mTransport);
+
+  // It is the responsibility of the caller to test the error_code.
+  return;
+} // end openUSB()
+
+// Method to call to open any other transport, for example a loopback to
+// an in-process device model or the replay of a recorded trace (see
+// gqtransport.hh). The transport remains owned by the caller and must
+// outlive its use by this object, that is, until closeUSB() is called or
+// this object is destroyed. Otherwise this is the same as openUSB().
+void
+GQGMC::openTransport(GQTransport * transport)
+{
+  attachTransport(transport, false);
+
+  // It is the responsibility of the caller to test the error_code.
+  return;
+} // end openTransport()
+
+// Method to close USB port is pretty trivial. Implementation is
+// to just close the transport, and dispose of it if we created it.
+void
+GQGMC::closeUSB()
+{
+  if (mTransport != 0)
+  {
+    mTransport->close();
+    if (mOwn_transport)
+      delete mTransport;
+  }
+  mTransport     = 0;
+  mOwn_transport = false;
+  mReader        = 0;
+  mLink_lost     = false;
+  return;
+} // end closeUSB()
+
+// setReaderThread is the public method to choose whether openUSB() reads
+// the serial port on a thread of its own. This decouples the reception
+// from a caller which is sometimes slow, so that the tty buffer of the
+// kernel cannot overflow meanwhile.
+void
+GQGMC::setReaderThread(bool enable, int cpu, int fifo_priority)
+{
+  mReader_thread   = enable;
+  mReader_cpu      = cpu;
+  mReader_priority = fifo_priority;
+  return;
+} // end setReaderThread()
+
+int
+GQGMC::getReaderSchedError()
+{
+  return (mReader != 0) ? mReader->getSchedError() : 0;
+} // end getReaderSchedError()
+
+uint64_t
+GQGMC::getReaderOverflows()
+{
+  return (mReader != 0) ? mReader->getOverflowCount() : 0;
+} // end getReaderOverflows()
+
+// attachTransport is the private method, common to openUSB() and
+// openTransport(), which opens the transport and then silently
+// interrogates the GQ GMC. Owned is true if the transport is to be
+// deleted by closeUSB(). If the transport cannot be opened or the GQ
+// GMC does not answer, the link counts as lost from the outset, so that
+// reconnect() can be used to wait for the GQ GMC to appear.
+void
+GQGMC::attachTransport(GQTransport * transport, bool owned)
+{
+  // Let go of whatever was open before
+  closeUSB();
+
+  mTransport     = transport;
+  mOwn_transport = owned;
+  mBaud_rate     = kDefault_Baud;
+  mModel         = &GQModelRegistry::getDefault();
+
+  // Get a fresh copy of the GQ GMC's NVM configuration data, if it has
+  // it to give.
+  if ((openLink() == true) && isSupported(eCmd_Get_Config))
+    getConfigurationData();
+
+  // It is the responsibility of the caller to test the error_code.
+  return;
+} // end attachTransport()
+
+// openLink is the private method, common to attachTransport() and
+// reconnect(), which opens the transport and identifies the GQ GMC.
+// Returns true if the GQ GMC answered. Otherwise the link is marked as
+// lost and the error code tells why.
+bool
+GQGMC::openLink()
+{
+  mRx_head = 0;
+  mRx_tail = 0;
 
   // If port opened successfully, then proceed to set line discipline.
-  if (mUSB_serial != -1)
+  if (mTransport->open() == false)
+  {
+    linkFailed();
+    mError_code = eUSB_open_failed;
+    return false;
+  }
+  mError_code = eNoProblem;
+  mLink_lost  = false;
+
+  // Since USB serial is opened successfully, find its baud rate, the
+  // cached one first if there is one. Other settings to force raw
+  // binary data exchange are made by the transport. read() never waits,
+  // all waiting is done against the deadline of the whole reply, see
+  // replyTimeout().
+  uint32_t cached = lookupBaud();
+  if (cached != 0)
+    mBaud_rate = cached;
+
+  // Now that the port is successfuly opened, we secretly (unknown to
+  // the user) interrogate the GMC-300 to determine the firmware revision.
+  // For older firmware, a warning is issued to the user. Older firmware
+  // will not support all commands.
+  string vers = negotiateBaud();
+  if (mRead_status == false)
   {
+    // error_code will have been set by negotiateBaud()
+    linkFailed();
+    return false;
+  }
+
+  // Look up what the model and its firmware can do, before any command
+  // which it might not support, see gqmodel.hh.
+  mModel             = &GQModelRegistry::lookup(vers);
+  mFirmware_revision = GQModelRegistry::parseRevision(vers);
+
+  // Remember a baud rate which had to be searched for. The cache is a
+  // convenience, so failing to update it is no error.
+  if ((mBaud_cache_file.empty() == false) && (mBaud_rate != cached) &&
+      isSupported(eCmd_Serial))
+  {
+    string serial = getSerialNumber();
+    if (mLink_lost == true)
+      return false;
+    if (mRead_status == true)
+      storeBaud(serial);
     mError_code = eNoProblem;
+  }
+
+  // There may be a change to commands caused by change to
+  // firmware. We only need to know whether some are missing.
+  if (GQModelRegistry::isComplete(*mModel) == false)
+    mError_code = eOlder_firmware;
+
+  return true;
+} // end openLink()
+
+// negotiateBaud is the private method to find the baud rate of the GQ
+// GMC, which cannot be asked for it. Each candidate rate is set on the
+// transport and checked with GETVER. At a wrong rate, the GQ GMC sees
+// only garbage and stays silent, or the reply comes back as garbage,
+// so the rate is right if a reply arrives in full and starts with
+// "GMC", as the version of every model does. mBaud_rate is tried first,
+// then the factory rates of the models known to the registry, then
+// kBaud_Fallbacks. A transport which cannot be set to a rate skips it,
+// and a transport which fails ends the search.
+//
+// A previous session may have left the heartbeat running, and this
+// object believes it is off (mCPS_is_on == false). So at each rate the
+// heartbeat is switched off to make that true; the frames already sent
+// are drained before GETVER since the link is not yet known to be clean.
+string
+GQGMC::negotiateBaud()
+{
+  uint32_t  first = mBaud_rate;
+  uint32_t  candidates[kMax_Baud_Candidates];
+  uint32_t  count = 0;
+
+  candidates[count++] = first;
+  count += GQModelRegistry::getFactoryBauds(&candidates[count],
+                                            kMax_Baud_Candidates - count
+                                            - kBaud_Fallback_Count);
+  for(uint32_t i=0; i<kBaud_Fallback_Count; i++)
+    candidates[count++] = kBaud_Fallbacks[i];
+
+  for(uint32_t i=0; i<count; i++)
+  {
+    uint32_t baud = candidates[i];
+    if ((i > 0) && (baud == first))
+      continue;
+    if (mTransport->setBaud(baud) == false)
+      continue;
+    mBaud_rate = baud;
+
+    mCPS_is_on = false;
+    sendCmd(turn_off_cps_cmd);
+    mLink_clean = false;
 
-    // Since USB serial is opened successfully, set baud rate to 57600
-    // and other settings to force raw binary data exchange.
-    fcntl(mUSB_serial, F_SETFL, 0);
-
-    memset(&settings,0,sizeof(settings));
-    settings.c_cflag     = CS8 | CREAD | CLOCAL;
-    settings.c_iflag     = 0; // setting line discpline to raw binary
-    settings.c_oflag     = 0;
-    settings.c_lflag     = 0;
-    settings.c_cc[VMIN]  = 0; // This combo of VMIN & VTIME means to wait
-    settings.c_cc[VTIME] = 5; // a maximum of 0.5 seconds for each
-                              // requested or expected byte of data.
-    cfsetispeed(&settings, B57600);
-    cfsetospeed(&settings, B57600);
-    tcsetattr(mUSB_serial, TCSANOW, &settings);
-
-    // Now that the port is successfuly opened, we secretly (unknown to
-    // the user) interrogate the GMC-300 to determine the firmware revision.
-    // For older firmware, a warning is issued to the user. Older firmware
-    // will not support all commands.
     string vers = getVersion();
-    if (mRead_status == true)
-    {
-      // Parse version string to extract firmware revision. The revision
-      // is a f4.1 formatted string in the last four characters of string.
-      stringstream firmware_rev;
-      firmware_rev << vers[10] << vers[11] << vers[12] << vers[13];
+    if ((mRead_status == true) && (vers.compare(0, 3, "GMC") == 0))
+      return vers;
+    if (mLink_lost == true)
+      break;
+  }
+
+  // Nothing answered, so try the same rate first again next time.
+  mBaud_rate   = first;
+  mTransport->setBaud(first);
+  mRead_status = false;
+  mError_code  = eGet_version;
+  return string();
+} // end negotiateBaud()
+
+// checkSupported is the private method which every command method calls
+// before it sends its command. A command which the GQ GMC does not know
+// would go unanswered until the reply timeout, so it is refused at once,
+// with a failed read just as if it had timed out.
+bool
+GQGMC::checkSupported(enum gmc_command_t command)
+{
+  if (isSupported(command) == true)
+    return true;
+
+  mRead_status = false;
+  mError_code  = eUnsupported_command;
+  return false;
+} // end checkSupported()
+
+// The baud rate cache is a text file with one line per GQ GMC, its
+// serial number, baud rate and the USB port it was last found on, eg,
+//
+//   003000e34a351a 115200 /dev/gqgmc
+//
+// The serial number identifies the GQ GMC, but it can only be read once
+// the baud rate is known, so the rate is looked up by port. A GQ GMC
+// which moves to another port replaces its old line, as does another
+// GQ GMC on the same port. Only openUSB() ports are cached.
+void
+GQGMC::setBaudCacheFile(const string & file_name)
+{
+  mBaud_cache_file = file_name;
+  return;
+} // end setBaudCacheFile()
+
+// setTraceFile is the public method to record the sessions of the next
+// openUSB(). The recorder sits beneath the reader thread, if any, so the
+// bytes are recorded as they come off the port.
+void
+GQGMC::setTraceFile(const string & file_name)
+{
+  mTrace_file = file_name;
+  return;
+} // end setTraceFile()
 
-      // Convert revision string to float in order to compare
-      firmware_rev >> mFirmware_revision;
+uint32_t
+GQGMC::lookupBaud()
+{
+  if ((mBaud_cache_file.empty() == true) || (mOwn_transport == false))
+    return 0;
 
-      // There may be a change to commands caused by change to
-      // firmware. We only need to compare if revision is old or new.
-      if (mFirmware_revision < kNew_Firmware)
-        mError_code = eOlder_firmware;
+  ifstream  cache(mBaud_cache_file.c_str());
+  string    line;
 
-      // Get a fresh copy of the GQ GMC's NVM configuration data.
-      getConfigurationData();
+  while (getline(cache, line))
+  {
+    istringstream  fields(line);
+    string         serial;
+    uint32_t       baud(0);
+    string         port;
 
-    } // end if (error_code == eNoProblem)
-    // else error_code will have been set by getVersion()
+    if ((fields >> serial >> baud >> port) && (port == mUSB_device))
+      return baud;
   }
-  else // usb not opened successfully
+
+  return 0;
+} // end lookupBaud()
+
+// storeBaud rewrites the cache through a temporary file and a rename,
+// so that a concurrent reader sees either the old or the new cache.
+void
+GQGMC::storeBaud(const string & serial_number)
+{
+  if ((mBaud_cache_file.empty() == true) || (mOwn_transport == false))
+    return;
+
+  stringstream  kept;
   {
-    mError_code = eUSB_open_failed;
-  } // end  if (usb_serial != -1)
+    ifstream  cache(mBaud_cache_file.c_str());
+    string    line;
 
-  // It is the responsibility of the caller to test the error_code.
-  return;
-} // end openUSB()
+    while (getline(cache, line))
+    {
+      istringstream  fields(line);
+      string         serial;
+      uint32_t       baud(0);
+      string         port;
+
+      if (!(fields >> serial >> baud >> port))
+        continue;
+      if ((serial == serial_number) || (port == mUSB_device))
+        continue;
+      kept << line << endl;
+    }
+  }
 
-// Method to close USB port is pretty trivial. Implementation is
-// to just close port.
+  string    temp_name = mBaud_cache_file + ".tmp";
+  ofstream  temp(temp_name.c_str());
+
+  temp << kept.str()
+       << serial_number << " " << mBaud_rate << " " << mUSB_device << endl;
+  temp.close();
+
+  if (!temp || (rename(temp_name.c_str(), mBaud_cache_file.c_str()) != 0))
+    remove(temp_name.c_str());
+
+  return;
+} // end storeBaud()
+
+// linkFailed is the private method to record that the transport failed.
+// The transports return failure for a hang up, EIO, ENODEV or the end
+// of file, that is, whenever the serial port itself is gone rather than
+// just slow, which is what happens when the USB-serial adapter drops
+// off the bus. Only the first failure marks the beginning of the gap,
+// and the first reconnect() attempt is due at once.
 void
-GQGMC::closeUSB()
+GQGMC::linkFailed()
 {
-  close(mUSB_serial);
+  mRead_status = false;
+  if (mLink_lost == true)
+    return;
+
+  mLink_lost          = true;
+  mLost_at_ms         = monotonic_ms();
+  mReconnect_due_ms   = mLost_at_ms;
+  mReconnect_delay_ms = kReconnect_Min_ms;
+
   return;
-} // end closeUSB()
+} // end linkFailed()
+
+// reconnect is the public method to restore a lost link. The caller
+// keeps calling it, for example once per iteration of its main loop,
+// and it attempts to reopen the transport only when the backoff delay
+// has passed (see kReconnect_Min_ms above), so calling early is cheap.
+// An attempt closes the dead file descriptor, opens the same device
+// path again and re-identifies the GQ GMC through getVersion(). If the
+// heartbeat was on when the link was lost, HEARTBEAT1 is sent again.
+// On success, the duration of the gap is available from getLastGap().
+bool
+GQGMC::reconnect()
+{
+  if (mLink_lost == false)
+    return true;
+  if (mTransport == 0)
+    return false;
+
+  int64_t now = monotonic_ms();
+  if (now < mReconnect_due_ms)
+    return false;
+
+  bool     heartbeat = mCPS_is_on;
+  int64_t  lost_at   = mLost_at_ms;
+  uint32_t delay_ms  = mReconnect_delay_ms;
+
+  // openLink() clears mLink_lost as soon as the transport opens, so a
+  // GQ GMC which then does not answer counts as a new loss, which would
+  // start the backoff over from kReconnect_Min_ms. It is the same gap.
+  mTransport->close();
+  if (openLink() == false)
+  {
+    mTransport->close();
+    mLost_at_ms         = lost_at;    // the gap goes on
+    mCPS_is_on          = heartbeat;  // still to be resumed
+    mReconnect_delay_ms = delay_ms;
+    mReconnect_due_ms   = now + mReconnect_delay_ms;
+    mReconnect_delay_ms = (mReconnect_delay_ms * 2 < kReconnect_Max_ms)
+                        ? mReconnect_delay_ms * 2 : kReconnect_Max_ms;
+    return false;
+  }
+
+  if (heartbeat == true)
+    turnOnCPS();
+
+  mLast_gap_ms = uint32_t(monotonic_ms() - mLost_at_ms);
+  return (mLink_lost == false);
+} // end reconnect()
+
+uint32_t
+GQGMC::getReconnectDelay()
+{
+  int64_t remaining = mReconnect_due_ms - monotonic_ms();
+  return (remaining > 0) ? uint32_t(remaining) : 0;
+} // end getReconnectDelay()
 
 
 // clearUSB is public method to clear the read (input) buffer of
@@ -232,37 +746,80 @@ GQGMC::closeUSB()
 // data (ie, no start, no stop, no ack, no nak), the synchronization
 // of the getAutoCPS() method with the GQ GMC is flakey. Consequently,
 // when the turn_off_cps_cmd happens, there may be left over
-// data in the USB input buffer. So this method simply reads the
-// USB input buffer until it is empty.
+// data in the USB input buffer. The same is true when a reply was
+// shorter or longer than expected. So this method discards the input
+// buffer (with tcflush() on a serial port) and then waits until the port stays quiet for
+// kDrain_Quiet_ms, flushing again whatever trickles in meanwhile.
+//
+// communicate() does not call this before every command. It is only
+// needed when the link is suspected to be out of step, which is tracked
+// by mLink_clean, see communicate().
 void
 GQGMC::clearUSB()
 {
-  uint32_t  rcvd(0);
-  char      inp;
+  bool      quiet(false);
+
+  // Anything parked in the receive buffer is left over by definition.
+  mRx_head = 0;
+  mRx_tail = 0;
 
   // Assume that there isn't that much left over from any previous
-  // read. In other words, we couldn't ever get that far off.
-  // So read only 10 bytes.
+  // exchange. In other words, we couldn't ever get that far off.
+  // So try only 10 times to obtain a quiet port.
   const
   uint16_t  kMaxtries(10);
 
-  // Read returned data until input buffer is empty as indicated by
-  // rcvd = 0 or not. If rcvd = 0 then the buffer is empty and that is
-  // what we want.
-  for(uint16_t i=0; i<kMaxtries; i++)
+  for(uint16_t i=0; (i<kMaxtries) && (mTransport != 0) && !mLink_lost; i++)
   {
-    rcvd = read(mUSB_serial, &inp, 1);
-    if (rcvd == 0) break;
+    mTransport->flushInput();
+
+    int ready = mTransport->waitReadable(kDrain_Quiet_ms);
+    if (ready == 0)
+    {
+      quiet = true;
+      break;
+    }
+    if (ready < 0)
+    {
+      linkFailed();
+      break;
+    }
   } // end for
 
-  // Not good, there are still more characters in input buffer,
+  // Not good, there are still more characters arriving at the input,
   // so declare error. The calling routine could try again.
-  if (rcvd > 0)
+  if (quiet)
+    mLink_clean = true;
+  else
     mError_code = eClear_USB;
 
   return;
 }// end clearUSB()
 
+// setPipelineDepth is the public method to set the maximum number of
+// commands which runQueue() keeps in flight on the serial link. A depth
+// of one reverts to strict lockstep, one command and its reply at a time,
+// which may be necessary should some firmware drop commands arriving
+// while it is still busy transmitting a reply.
+void
+GQGMC::setPipelineDepth(uint32_t depth)
+{
+  mPipeline_depth = (depth > 0) ? depth : 1;
+  return;
+} // end setPipelineDepth()
+
+// setReplyTimeout is the public method to override the computed reply
+// deadline (see replyTimeout()) for all subsequent commands. This is
+// intended for unusual links, for example a USB-serial adapter with a
+// large latency timer or a network serial bridge. Passing zero returns
+// to the computed deadline.
+void
+GQGMC::setReplyTimeout(uint32_t timeout_ms)
+{
+  mTimeout_override_ms = timeout_ms;
+  return;
+} // end setReplyTimeout()
+
 // Public method getErrorCode() to check error code of GQGMC class.
 // Implemented inline in class declaration (see gqgmc.hh)
 
@@ -342,11 +899,11 @@ GQGMC::getErrorText(gmc_error_t err)
       break;
     case eGet_history_data_address:
       err_msg << "The address of the history command cannot exceed "
-              << dec << kHistory_Addr_Maxsize << " bytes." << endl;
+              << dec << getFlashSize() << " bytes." << endl;
       break;
     case eGet_history_data_overrun:
       err_msg << "The history data length added to the address cannot exceed "
-              << dec << kHistory_Addr_Maxsize << " bytes." << endl;
+              << dec << getFlashSize() << " bytes." << endl;
       break;
 
     case eSet_Year:
@@ -373,6 +930,10 @@ GQGMC::getErrorText(gmc_error_t err)
       err_msg << "The set second command failed." << endl;
       break;
 
+    case eUnsupported_command:
+      err_msg << "Your GQ GMC does not support this command." << endl;
+      break;
+
     default:          // this should never happen since user should have
       break;          // obtained a valid code using getErrorCode().
   } // end switch(err)
@@ -405,7 +966,9 @@ GQGMC::getVersion()
     ss >> version;
     mError_code = eGet_version;
   }
-  // else the version is returned as an ASCII string in version.
+  // else the version is returned as an ASCII string in version, which
+  // the GQ GMC does not terminate.
+  version[versize] = '\0';
 
   return string(version);
 } // end getVersion()
@@ -421,9 +984,12 @@ GQGMC::getSerialNumber()
   const
   uint32_t    sernumsize = 7;             // 7 bytes of returned data
   char        serial_number[sernumsize+1];// returned data
-  uint8_t     nibble[2*sernumsize];       // each nibble of returned data
 
-  stringstream  ss;
+  string      serial;
+
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Serial) == false)
+    return serial;
 
   // Issue the command to get serial number and read returned data.
   communicate(get_serial_cmd, serial_number, sernumsize);
@@ -431,25 +997,14 @@ GQGMC::getSerialNumber()
   // If the read of the returned data succeeded, convert raw data to string.
   if (mRead_status == true)
   {
-    // Convert each nibble to an 8-bit int because each nibble
-   	// represents a separate serial number digit.
-    for(uint32_t i=0; i<sernumsize; i++)
-    {
-      nibble[(i*2)]   = (serial_number[i] & 0xF0) >> 4;
-      nibble[(i*2)+1] = (serial_number[i] & 0x0F);
-      // Convert byte array to string of hex ASCII char. Do not use
-      // Hex utility because that forces each arg to have 2 char field.
-      ss << hex << uint16_t(nibble[i*2]) << uint16_t(nibble[(i*2)+1]);
-    }
+    serial = decodeSerialNumber(serial_number);
   }
-  else // for read failure, set byte array to null and set error code
+  else // for read failure, return empty string and set error code
   {
-    for(uint32_t i=0; i<sernumsize; i++) nibble[i] = '\0';
-    ss << nibble;
     mError_code = eGet_serial_number;
   }
 
-  return ss.str();
+  return serial;
 } // end getSerialNumber()
 
 // Public method to get the count per minute value. Command string is
@@ -465,17 +1020,17 @@ GQGMC::getCPM()
   char     cpm_char[cpmsize+1];  // returned data
   uint16_t cpm_int = 0;          // this will be the returned value
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_CPM) == false)
+    return cpm_int;
+
   // Issue command to get CPM and read returned data
   communicate(get_cpm_cmd, cpm_char, cpmsize);
 
   // if read of returned data succeeded, convert raw data to integer
   if (mRead_status == true)
   {
-  	// 1st byte is MSB, but note that upper two bits are reserved bits.
-    // Note that shifting and bitmasking performed in uP register, so
-    // endianess is irrevelant.
-    cpm_int |= ((uint16_t(cpm_char[0]) << 8) & 0x3f00);
-    cpm_int |=  (uint16_t(cpm_char[1]) & 0x00ff);
+    cpm_int = decodeCount(cpm_char);
   }
   else  // else failure will return cpm = 0 and set error code
   {
@@ -499,17 +1054,17 @@ GQGMC::getCPS()
   char     cps_char[cpssize+1];  // returned data
   uint16_t cps_int = 0;          // this will be the returned value
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_CPS) == false)
+    return cps_int;
+
   // Issue command to get CPM and read returned data
   communicate(get_cps_cmd, cps_char, cpssize);
 
   // If read of returned data succeeded, convert raw data to integer
   if (mRead_status == true)
   {
-    // 1st byte is MSB, but note that upper two bits are reserved bits.
-    // Note that shifting and bitmasking performed in uP register, so
-    // endianess is irrevelant.
-    cps_int |= ((uint16_t(cps_char[0]) << 8) & 0x3f00);
-    cps_int |=  (uint16_t(cps_char[1]) & 0x00ff);
+    cps_int = decodeCount(cps_char);
   }
   else  // else failure will return cps = 0 and set error code.
   {
@@ -534,14 +1089,17 @@ GQGMC::getBatteryVoltage()
   char         voltage_char[voltsize+1]; // returned data
   float        voltage(0.0f);            // will be the returned value
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Voltage) == false)
+    return voltage;
+
   // Issue command to get battery voltage and read returned data.
   communicate(get_voltage_cmd, voltage_char, voltsize);
 
   // If read of returned data succeeded, convert raw data to float,
   if (mRead_status == true)
   {
-    int32_t  voltage_int = int16_t(voltage_char[0]);
-    voltage = float(voltage_int) / 10.0;
+    voltage = decodeVoltage(voltage_char);
   }
   else  // else for failure, voltage is zero and set error code.
   {
@@ -551,6 +1109,104 @@ GQGMC::getBatteryVoltage()
   return  voltage;
 } // end getBatteryVoltage()
 
+// Public method to take a status sweep of the GQ GMC: version, serial
+// number, battery voltage, CPM and a fresh copy of the NVM configuration
+// data (see getConfigurationData()). Rather than five separate exchanges,
+// the five commands are queued and pipelined (see runQueue()), so the
+// whole sweep costs about one round trip plus the transfer time of the
+// replies. The result is returned in the caller's status structure. If
+// any of the replies failed, the error code of the first failed command
+// is set and the corresponding member of status is left at its default.
+void
+GQGMC::getStatus(gmc_status_t & status)
+{
+  const
+  uint32_t     versize    = 14;
+  const
+  uint32_t     sernumsize = 7;
+  const
+  uint32_t     voltsize   = 1;
+  const
+  uint32_t     cpmsize    = 2;
+
+  char         version[versize];
+  char         serial_number[sernumsize];
+  char         voltage_char[voltsize];
+  char         cpm_char[cpmsize];
+
+  status = gmc_status_t();
+
+  // Only the commands the GQ GMC supports are queued, the slot of each
+  // in the queue is kept, -1 if it was not.
+  int          slot_serial  = -1;
+  int          slot_voltage = -1;
+  int          slot_cpm     = -1;
+  int          slot_cfg     = -1;
+  int          slots        = 1;
+
+  queueCmd(get_version_cmd, version, versize);
+  if (isSupported(eCmd_Serial))
+  {
+    queueCmd(get_serial_cmd, serial_number, sernumsize);
+    slot_serial = slots++;
+  }
+  if (isSupported(eCmd_Voltage))
+  {
+    queueCmd(get_voltage_cmd, voltage_char, voltsize);
+    slot_voltage = slots++;
+  }
+  if (isSupported(eCmd_CPM))
+  {
+    queueCmd(get_cpm_cmd, cpm_char, cpmsize);
+    slot_cpm = slots++;
+  }
+  if (isSupported(eCmd_Get_Config))
+  {
+    queueCmd(get_cfg_cmd, reinterpret_cast<char *>(&mCFG_Data),
+                          sizeof(mCFG_Data));
+    slot_cfg = slots++;
+  }
+  runQueue();
+
+  // Walk the replies in reverse so that the error code left behind
+  // is the one of the first command which failed. A command which was
+  // not supported counts as failed with eUnsupported_command.
+  if (slot_cfg < 0)
+    mError_code = eUnsupported_command;
+  else if (mCmd_queue[slot_cfg].status == false)
+    mError_code = eGet_CFG;
+
+  if (slot_cpm < 0)
+    mError_code = eUnsupported_command;
+  else if (mCmd_queue[slot_cpm].status == true)
+    status.cpm = decodeCount(cpm_char);
+  else
+    mError_code = eGet_CPM;
+
+  if (slot_voltage < 0)
+    mError_code = eUnsupported_command;
+  else if (mCmd_queue[slot_voltage].status == true)
+    status.battery_voltage = decodeVoltage(voltage_char);
+  else
+    mError_code = eGet_battery_voltage;
+
+  if (slot_serial < 0)
+    mError_code = eUnsupported_command;
+  else if (mCmd_queue[slot_serial].status == true)
+    status.serial_number = decodeSerialNumber(serial_number);
+  else
+    mError_code = eGet_serial_number;
+
+  if (mCmd_queue[0].status == true)
+    status.version = string(version, versize);
+  else
+    mError_code = eGet_version;
+
+  mCmd_queue.clear();
+
+  return;
+} // end getStatus()
+
 // Public method to get history data from GQ GMC's history buffer.
 // The user requests the data given the offset into the GQ GMC's 64k
 // byte buffer and the length (amount) of data. The data logging can be
@@ -673,29 +1329,48 @@ GQGMC::getBatteryVoltage()
 // use the built-in logging capability of the GQ GMC. Instead,
 // do the logging yourself by simply calling getCPM() method,
 // letting the host computer do the storage and time/date tracking.
+//
+// This variant reads into the private history data buffer and returns a
+// pointer to it, valid until the next call. If the request was invalid
+// or the read failed, the buffer is all zeroes. The variants which take
+// the caller's buffer below avoid both the buffer and the zeroing.
 uint8_t * const
 GQGMC::getHistoryData(uint32_t address, uint32_t length)
 {
-  // Initialize history data to zeroes. The max allowed request is
-  // kHistory_Data_Maxsize = 4K bytes. Even if the user requests less
-  // than kHistory_Data_Maxsize, we zero out the whole array.
-  for(uint32_t i=0;i<kHistory_Data_Maxsize;i++)
-    mHistory_data[i] = 0;
+  if (getHistoryData(address, length, mHistory_data) == false)
+    memset(mHistory_data, 0, kHistory_Data_Maxsize);
+
+  // Note that the returned data is a byte array that has to be parsed
+  // further in order to extract the actual history data.
+  return &mHistory_data[0];
+} // end getHistoryData()
+
+// This variant reads the history data straight into the caller's
+// buffer, which must hold length bytes. Returns true if all length bytes
+// were read. Otherwise the error code tells why, and the contents of the
+// buffer are undefined; nothing is zeroed.
+bool
+GQGMC::getHistoryData(uint32_t address, uint32_t length, uint8_t * data)
+{
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_History) == false)
+    return false;
 
-  // Check the validity of the input arguments, return if invalid.
+  // Check the validity of the input arguments, return if invalid. The
+  // history buffer is as large as the model's flash.
   mError_code = eNoProblem;
   // 1st check length
-  if (length > kHistory_Data_Maxsize)
+  if ((length > kHistory_Data_Maxsize) || (length > mModel->max_chunk))
     mError_code = eGet_history_data_length;
   // check address
-  if (address > kHistory_Addr_Maxsize)
+  if (address > getFlashSize())
     mError_code = eGet_history_data_address;
   // check address plus length
-  if ((address + length) > kHistory_Addr_Maxsize)
+  if ((address + length) > getFlashSize())
     mError_code = eGet_history_data_overrun;
   // Trap error here, return immediately if there is an error
   if (mError_code != eNoProblem)
-    return &mHistory_data[address];
+    return false;
 
   // Since the request is within boundaries, formulate history command.
   string get_history_data_cmd = "<SPIR";
@@ -719,7 +1394,7 @@ GQGMC::getHistoryData(uint32_t address, uint32_t length)
   get_history_data_cmd += ">>";
 
   // Issue command to get history data and read returned data
-  communicate(get_history_data_cmd, (char *)&mHistory_data[0], length);
+  communicate(get_history_data_cmd, reinterpret_cast<char *>(data), length);
 
   // If read of returned data failed, set error code.
   if (mRead_status == false)
@@ -727,11 +1402,241 @@ GQGMC::getHistoryData(uint32_t address, uint32_t length)
     mError_code = eGet_history_data;
   }
 
-  // Note that the returned data is a byte array that has to be parsed
-  // further in order to extract the actual history data.
-  return &mHistory_data[0];
+  return (mError_code == eNoProblem);
+} // end getHistoryData()
+
+// This variant reads into the caller's vector, sized to length. Resizing
+// a reused vector within its capacity allocates nothing.
+bool
+GQGMC::getHistoryData(uint32_t address, uint32_t length,
+                      std::vector<uint8_t> & data)
+{
+  if (length > kHistory_Data_Maxsize)
+  {
+    mError_code = eGet_history_data_length;
+    return false;
+  }
+
+  data.resize(length);
+  return getHistoryData(address, length, data.data());
 } // end getHistoryData()
 
+// readHistory is the public method to read a range of history data of
+// any length into the caller's buffer, as a series of SPIR commands of
+// at most chunk bytes each (the model's largest SPIR if 0). The commands
+// go through the command queue, so the next SPIR already waits in the
+// GQ GMC while it transmits the reply to the previous one, and a long
+// range costs no round trip per chunk. Two in flight are enough for
+// that, and more would only fill the receiver of the GQ GMC, so the
+// pipeline depth is capped at two here.
+//
+// A chunk whose reply came back short keeps what did arrive, and only
+// the missing tail is asked for again, see readTail(). Once the chunk is
+// complete, the chunks after it, which the queue did not send, are
+// queued again. getChunkRetries() tells how many tail SPIRs each chunk
+// took.
+//
+// Unlike getHistoryData(), the range is bounded only by the 24 bit
+// address of SPIR, since the flash of larger models exceeds 64K bytes.
+// Returns the number of bytes, from address on, which were read in full
+// before the first chunk which failed. The data beyond that in the
+// buffer is undefined. The error code tells why the rest failed.
+uint32_t
+GQGMC::readHistory(uint32_t address, uint32_t length, uint8_t * data,
+                   uint32_t chunk)
+{
+  const
+  uint32_t  kMax_Address = 0x1000000; // 24 bits of SPIR address
+
+  mChunk_retries.clear();
+  if (checkSupported(eCmd_History) == false)
+    return 0;
+
+  mError_code = eNoProblem;
+  if ((chunk == 0) || (chunk > mModel->max_chunk))
+    chunk = mModel->max_chunk;
+  if ((address >= kMax_Address) || (length > (kMax_Address - address)))
+  {
+    mError_code = eGet_history_data_overrun;
+    return 0;
+  }
+  mChunk_retries.assign((length + chunk - 1) / chunk, 0);
+
+  uint32_t  good = 0;
+  while (good < length)
+  {
+    for(uint32_t offset=good; offset<length; offset+=chunk)
+    {
+      uint32_t  piece = ((length - offset) < chunk) ? (length - offset)
+                                                    : chunk;
+      uint32_t  at    = address + offset;
+
+      string  spir_cmd = "<SPIR";
+      spir_cmd += uint8_t((at >> 16) & 0xff);
+      spir_cmd += uint8_t((at >>  8) & 0xff);
+      spir_cmd += uint8_t((at >>  0) & 0xff);
+      spir_cmd += uint8_t((piece >> 8) & 0xff);
+      spir_cmd += uint8_t((piece >> 0) & 0xff);
+      spir_cmd += ">>";
+
+      queueCmd(spir_cmd, reinterpret_cast<char *>(&data[offset]), piece);
+    }
+
+    uint32_t  depth = mPipeline_depth;
+    if (mPipeline_depth > 2)
+      mPipeline_depth = 2;
+    runQueue();
+    mPipeline_depth = depth;
+
+    // Take the complete chunks up to the first one which failed.
+    uint32_t  queued = mCmd_queue.size();
+    uint32_t  failed = queued;
+    uint32_t  have   = 0;
+    uint32_t  lost   = 0;
+    for(uint32_t i=0; i<queued; i++)
+    {
+      if (mCmd_queue[i].status == false)
+      {
+        failed = i;
+        have   = mCmd_queue[i].received;
+        lost   = mCmd_queue[i].retbytes - have;
+        break;
+      }
+      good += mCmd_queue[i].retbytes;
+    }
+    mCmd_queue.clear();
+    if (failed == queued)
+      break;
+
+    // Pipelined, a reply which lost bytes takes as many from the start
+    // of the reply after it, so only the last of the chunks shifted so
+    // comes back short, by all the bytes lost. Walk back over the chunks
+    // before the short one until one ends as it should, and read again
+    // from the chunk after it.
+    uint32_t  back = 0;
+    while ((back < failed) &&
+           (checkEnd(address + good - chunk, &data[good - chunk], chunk,
+                     lost) == false))
+    {
+      good -= chunk;
+      back++;
+    }
+    if (back > 0)
+    {
+      if (++mChunk_retries[good / chunk] > kMax_Tail_Retries)
+      {
+        mError_code = eGet_history_data;
+        break;
+      }
+      continue;
+    }
+
+    uint32_t  piece = ((length - good) < chunk) ? (length - good) : chunk;
+    if (readTail(address + good, piece, &data[good], have,
+                 mChunk_retries[good / chunk]) == false)
+    {
+      mError_code = eGet_history_data;
+      break;
+    }
+    good += piece;
+  }
+
+  return good;
+} // end readHistory()
+
+// checkEnd is the private method to tell whether the end of data, read
+// from address on, from overlap_start() on, is what the GQ GMC returns
+// for it now, and so whether at most lost bytes lost before it shifted
+// it. If it cannot be read, it is taken not to be. Neither is data of
+// one byte value throughout, which would match however far it shifted,
+// and so cannot tell whether the data before it did.
+bool
+GQGMC::checkEnd(uint32_t address, const uint8_t * data, uint32_t length,
+                uint32_t lost)
+{
+  uint32_t  check = length - overlap_start(data, length, lost);
+  uint32_t  at    = address + length - check;
+  vector<uint8_t> end(check);
+
+  if ((mLink_lost == true) || (one_value(data, length) == true))
+    return false;
+
+  string  spir_cmd = "<SPIR";
+  spir_cmd += uint8_t((at >> 16) & 0xff);
+  spir_cmd += uint8_t((at >>  8) & 0xff);
+  spir_cmd += uint8_t((at >>  0) & 0xff);
+  spir_cmd += uint8_t((check >> 8) & 0xff);
+  spir_cmd += uint8_t((check >> 0) & 0xff);
+  spir_cmd += ">>";
+
+  communicate(spir_cmd, reinterpret_cast<char *>(&end[0]), check);
+
+  return ((mRead_status == true) &&
+          (memcmp(&end[0], &data[length - check], check) == 0));
+} // end checkEnd()
+
+// readTail is the private method to complete a short SPIR reply. Each
+// try asks for the chunk from overlap_start() of the data kept on, and
+// checks the overlap against the data kept. If they differ, bytes were
+// lost within the data kept, which is dropped, and the next try asks
+// for the whole chunk. A tail which arrives short in turn is kept as
+// well, as far as it got, once its overlap matches. communicate() drains
+// whatever is left of the short reply before the first try.
+//
+// A reply of which nothing arrived, like a try of which nothing does,
+// means a GQ GMC which is not answering rather than a marginal link, so
+// it is left to the caller, as is a lost link.
+bool
+GQGMC::readTail(uint32_t address, uint32_t length, uint8_t * data,
+                uint32_t have, uint32_t & retries)
+{
+  if (have == 0)
+    return false;
+
+  vector<uint8_t> tail(length);
+
+  while ((have < length) && (retries < kMax_Tail_Retries) &&
+         (mLink_lost == false))
+  {
+    uint32_t  from  = overlap_start(data, have, length - have);
+    uint32_t  check = have - from;
+    uint32_t  at    = address + from;
+    uint32_t  want  = length - from;
+
+    string  spir_cmd = "<SPIR";
+    spir_cmd += uint8_t((at >> 16) & 0xff);
+    spir_cmd += uint8_t((at >>  8) & 0xff);
+    spir_cmd += uint8_t((at >>  0) & 0xff);
+    spir_cmd += uint8_t((want >> 8) & 0xff);
+    spir_cmd += uint8_t((want >> 0) & 0xff);
+    spir_cmd += ">>";
+
+    communicate(spir_cmd, reinterpret_cast<char *>(&tail[0]), want);
+    retries++;
+
+    uint32_t  got = mRead_count;
+    if (got == 0)
+      break;
+    if (got < check)
+      continue;
+    if (memcmp(&tail[0], &data[from], check) != 0)
+    {
+      have = 0;
+      continue;
+    }
+
+    memcpy(&data[have], &tail[check], got - check);
+    have = from + got;
+  }
+
+  if (have < length)
+    return false;
+
+  mError_code  = eNoProblem;
+  mRead_status = true;
+  return true;
+} // end readTail()
+
 // turnOnCPS is public method to enable automatic reporting of the
 // count per second (CPS) value. First, I would say don't use this
 // command. Since the returned data has no protocol, that is, there
@@ -748,11 +1653,19 @@ GQGMC::getHistoryData(uint32_t address, uint32_t length)
 void
 GQGMC::turnOnCPS()
 {
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Heartbeat) == false)
+    return;
+
   sendCmd(turn_on_cps_cmd);
+  // The first byte to arrive starts a frame.
+  mFramer.reset();
   // There is no pass/fail return from GQ GMC
   // Set flag that auto-transmission of CPS is turned on. This is to be
-  // changed to a mutex when threading is implemented.
-  mCPS_is_on = true;
+  // changed to a mutex when threading is implemented. While it is on,
+  // the link is never considered clean.
+  mCPS_is_on  = true;
+  mLink_clean = false;
 
   return;
 } // end turnOnCPS()
@@ -773,9 +1686,10 @@ GQGMC::turnOffCPS()
   mCPS_is_on = false;
 
   // Since turning off CPS is asynchronous with the GQ GMC's transmission
-  // of the CPS, we will attempt to clear the input buffer of any left
-  // over data.
-  clearUSB();
+  // of the CPS, there may be left over data. Rather than draining it
+  // right here, mark the link as suspect so that the next command
+  // drains it. By then any frame still on the wire has arrived.
+  mLink_clean = false;
 
   return;
 } // end turnOffCPS()
@@ -787,34 +1701,161 @@ GQGMC::turnOffCPS()
 uint16_t
 GQGMC::getAutoCPS()
 {
-  const
-  uint32_t cpssize = 2;
-  char     cps_char[cpssize+1];
+  cps_sample_t sample;
+
+  getAutoCPS(sample);
+  return sample.cps;
+} // end getAutoCPS()
+
+// This variant of getAutoCPS also returns the arrival time of the frame,
+// that is, of the read which delivered its last byte (see markRxTime()).
+void
+GQGMC::getAutoCPS(cps_sample_t & sample)
+{
+  char     cps_char;
   uint16_t cps_int = 0;
 
-  // Issue command to get CPS and read returned data. Note that
-  // we are calling readCmdReturn directly, therefore bypassing
-  // the communicate method. The user should have already issued
-  // turn_on_cps_cmd.
-  readCmdReturn(cps_char, cpssize);
+  // Read the returned data byte by byte through the framer (see
+  // gqframe.hh), which drops whatever does not fit a frame, until a
+  // frame is complete. Note that we are calling readCmdReturn directly,
+  // therefore bypassing the communicate method. The user should have
+  // already issued turn_on_cps_cmd. readCmdReturn takes whatever else
+  // has arrived in the same read and parks it, so this costs no more
+  // system calls than reading the two bytes at once.
+  const
+  int64_t  deadline = monotonic_ms() + kHeartbeat_Timeout_ms;
 
-  // If read of returned data succeeded, convert raw data to integer,
-  if (mRead_status == true)
+  for(;;)
   {
-    // 1st byte is MSB, but note that upper two bits are reserved
-    // bits. Assume shift & bitmasking take place in register which
-    // is independent of big endian vs little endian architecture.
-    cps_int |= ((uint16_t(cps_char[0]) << 8) & 0x3f00);
-    cps_int |=  (uint16_t(cps_char[1]) & 0x00ff);
-  }
-  else  // else failure will return cps = 0 and set error code
+    int64_t remaining = deadline - monotonic_ms();
+    if (remaining <= 0)
+    {
+      mRead_status = false;
+      break;
+    }
+
+    readCmdReturn(&cps_char, 1, uint32_t(remaining));
+    if (mRead_status == false)
+      break;
+    if (mFramer.put(uint8_t(cps_char), timespec_ms(mRx_mono), cps_int))
+      break;
+  } // end for loop
+
+  // If the read failed, return cps = 0 and set error code
+  if (mRead_status == false)
   {
+    cps_int     = 0;
     mError_code = eGet_AutoCPS;
   }
 
-  return cps_int;
+  sample.cps          = cps_int;
+  sample.arrival      = mRx_real;
+  sample.arrival_mono = mRx_mono;
+
+  return;
 } // end getAutoCPS()
 
+// readAutoCPS is the public method to read CPS without blocking, meant
+// for an event loop serving many GQ GMCs at once (see gqevloop.cc).
+// The caller waits for getPollFd() to become readable and then calls
+// this method, which takes everything the transport has available in
+// one read and hands back the complete CPS frames found by the framer
+// (see gqframe.hh), up to max_samples of them. Bytes beyond that stay
+// in the receive buffer for the next call, so the caller should call
+// again as long as max_samples are returned. Each sample is marked with
+// the time of the read which completed it. Like a command, each call
+// resets the error code. On failure of the link, zero is returned and
+// the error code is set to eGet_AutoCPS.
+uint32_t
+GQGMC::readAutoCPS(cps_sample_t * samples, uint32_t max_samples)
+{
+  uint32_t        count = 0;
+
+  mError_code  = eNoProblem;
+  mRead_status = true;
+  if ((mTransport == 0) || (mLink_lost == true))
+  {
+    mRead_status = false;
+    mError_code  = eGet_AutoCPS;
+    return 0;
+  }
+
+  // Bytes parked by the previous call go first, with the time of the
+  // read which delivered them.
+  count = frameRxBuffer(samples, max_samples);
+  if (count == max_samples)
+    return count;
+
+  // The receive buffer is now empty, read into all of it.
+  struct iovec iov;
+  iov.iov_base = &mRx_buffer[0];
+  iov.iov_len  = kRx_Bufsize;
+
+  ssize_t got = mTransport->readv(&iov, 1);
+  if (got < 0)
+  {
+    linkFailed();
+    mError_code  = eGet_AutoCPS;
+    return count;
+  }
+  mRx_head = 0;
+  mRx_tail = uint32_t(got);
+  markRxTime();
+
+  count += frameRxBuffer(&samples[count], max_samples - count);
+  return count;
+} // end readAutoCPS()
+
+// frameRxBuffer is the private method to pass the bytes of the receive
+// buffer through the framer, up to the completion of max_samples frames.
+uint32_t
+GQGMC::frameRxBuffer(cps_sample_t * samples, uint32_t max_samples)
+{
+  uint32_t count = 0;
+  uint16_t cps;
+
+  while ((mRx_head < mRx_tail) && (count < max_samples))
+  {
+    if (mFramer.put(mRx_buffer[mRx_head++], timespec_ms(mRx_mono), cps))
+    {
+      samples[count].cps          = cps;
+      samples[count].arrival      = mRx_real;
+      samples[count].arrival_mono = mRx_mono;
+      count++;
+    }
+  }
+  if (mRx_head == mRx_tail)
+    mRx_head = mRx_tail = 0;
+
+  return count;
+} // end frameRxBuffer()
+
+// markRxTime is the private method to note the arrival time of the
+// bytes just read. It is called right after every read which returned
+// data, so the time is that of the system call, not that of whatever the
+// caller does with the bytes later. The two clocks are read back to back
+// (vDSO calls of some tens of nanoseconds), so the pair stands for one
+// instant on both time scales. A transport which read the bytes earlier,
+// on a thread of its own, knows their arrival better and says so.
+void
+GQGMC::markRxTime()
+{
+  if (mTransport->arrivalTime(mRx_mono, mRx_real) == true)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &mRx_mono);
+  clock_gettime(CLOCK_REALTIME, &mRx_real);
+  return;
+} // end markRxTime()
+
+// getPollFd is the public method to get the file descriptor of the
+// transport, for the caller to wait on with poll() or epoll.
+int
+GQGMC::getPollFd()
+{
+  return (mTransport != 0) ? mTransport->pollFd() : -1;
+} // end getPollFd()
+
 
 // turnOffPower public method turns off the GQ GMC-300. The command
 // is turn_off_pwr_cmd (see GQ GMC COMMANDS above). This will turn
@@ -823,6 +1864,10 @@ GQGMC::getAutoCPS()
 void
 GQGMC::turnOffPower()
 {
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Power_Off) == false)
+    return;
+
   sendCmd(turn_off_pwr_cmd);
   // Note that power off cannot fail because the GQ GMC returns nothing.
   return;
@@ -880,6 +1925,10 @@ GQGMC::turnOffPower()
 void
 GQGMC::getConfigurationData()
 {
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Get_Config) == false)
+    return;
+
   // Issue command to get configuration and read returned data.
   communicate(get_cfg_cmd, reinterpret_cast<char *>(&mCFG_Data),
                            sizeof(mCFG_Data));
@@ -970,6 +2019,27 @@ GQGMC::getDataSaveAddress()
   return address;
 }  // end getDataSaveAddress()
 
+// getSaveTimeStamp is a get method to retrieve the date/timestamp of the
+// logging run in the configuration data, the same as the date/timestamp
+// record in the history buffer just before the DataSaveAddress. Each of
+// the six bytes is written as two decimal digits.
+string
+GQGMC::getSaveTimeStamp()
+{
+  const uint8_t stamp[6] = { mCFG_Data.saveDateTimeStampByte5,
+                             mCFG_Data.saveDateTimeStampByte4,
+                             mCFG_Data.saveDateTimeStampByte3,
+                             mCFG_Data.saveDateTimeStampByte2,
+                             mCFG_Data.saveDateTimeStampByte1,
+                             mCFG_Data.saveDateTimeStampByte0 };
+  stringstream  ss;
+
+  for(uint32_t i=0; i<6; i++)
+    ss << dec << setw(2) << setfill('0') << uint16_t(stamp[i] % 100);
+
+  return ss.str();
+}  // end getSaveTimeStamp()
+
 // The resetDataSaveAddress sets the dataSaveAddress configuration
 // parameter to the value of 0x10.  This is provided as a
 // convenience instead of using writeConfigurationData() directly
@@ -1068,6 +2138,10 @@ GQGMC::loadConfigurationData()
   // of the NVM configuration data.
   uint8_t *    pCfg_Data = (uint8_t *)&mCFG_Data;
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Write_Config) == false)
+    return;
+
   // Begin formulating the write configuration data command.
   // "AD" is just a place holder for the address byte and data byte
   // that will be dynamically derived and inserted.
@@ -1108,7 +2182,7 @@ GQGMC::loadConfigurationData()
     // Issue command to write configuration data, one byte
     // at a time because that is the native write configuration
     // command of the GQ GMC.
-    communicate(write_cfg_cmd, ret_char, retsize);
+    communicate(write_cfg_cmd, ret_char, retsize, configTimeout());
 
     // if read of returned data succeeded, convert raw data to float
     if (mRead_status == true)
@@ -1139,8 +2213,12 @@ GQGMC::eraseConfigurationData()
   uint32_t     retsize = 1;
   char         ret_char[retsize+1];
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Erase_Config) == false)
+    return;
+
   // Issue command to erase NVM configuration.
-  communicate(erase_cfg_cmd, ret_char, retsize);
+  communicate(erase_cfg_cmd, ret_char, retsize, configTimeout());
 
   // If read of returned data succeeded, convert raw data to float,
   if (mRead_status == true)
@@ -1180,6 +2258,10 @@ GQGMC::updateConfigurationData()
   uint32_t     retsize = 1;
   char         ret_char[retsize+1];
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Update_Config) == false)
+    return;
+
     // 1st, we have to erase configuration data
   // cout << erase_cfg_cmd << endl; // debug
   eraseConfigurationData();
@@ -1190,7 +2272,7 @@ GQGMC::updateConfigurationData()
   // cout << update_cfg_cmd << endl; // debug
   // Issue command to update NVM and force GQ GMC to change
   // operation in accordance to new configuration data.
-  communicate(update_cfg_cmd, ret_char, retsize);
+  communicate(update_cfg_cmd, ret_char, retsize, configTimeout());
 
   // If read of returned data succeeded, convert raw data to float,
   if (mRead_status == true)
@@ -1240,6 +2322,10 @@ GQGMC::sendKey(enum softkey_t key)
 {
   char   inp[1]; // This will not be used, just needed as dummy arg
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Key) == false)
+    return;
+
   // Begin formulating the send key command.
   string keycmd = "<KEY";
 
@@ -1276,6 +2362,10 @@ GQGMC::setDate(string date)
   uint32_t     retsize = 1;
   char         ret_char[retsize+1];
 
+  // Refuse at once what the GQ GMC does not support.
+  if (checkSupported(eCmd_Set_Clock) == false)
+    return;
+
   // The date is broken up into three separate commands one each for
   // month, day, and year as supported by the GQ GMC.
 
@@ -1338,6 +2428,10 @@ GQGMC::setTime(string time)
     uint32_t     retsize = 1;
     char         ret_char[retsize+1];
 
+    // Refuse at once what the GQ GMC does not support.
+    if (checkSupported(eCmd_Set_Clock) == false)
+      return;
+
     // The time is broken up into three separate commands one each for
     // hour, minute, and second as supported by the GQ GMC.
 
@@ -1398,14 +2492,20 @@ GQGMC::setTime(string time)
 // cmd is the ASCII string command.
 // retdata is the repository for the returned data.
 // retbytes is the number of bytes of returned data.
+// timeout_ms overrides the computed reply deadline for this one call,
+// zero means use replyTimeout().
 void
-GQGMC::communicate(const string cmd, char * retdata, uint32_t retbytes)
+GQGMC::communicate(const string cmd, char * retdata, uint32_t retbytes,
+                   uint32_t timeout_ms)
 {
-  // Clear the USB port of any left over data from last exchange. Even
-  // though we know how many bytes the GQ GMC transmits for each
-  // command, experience has shown this is the safe thing to do since
-  // there is no protocol for the returned data.
-  clearUSB();
+  // Clear the USB port of any left over data from last exchange, but
+  // only if the link is suspected to be out of step. Since there is no
+  // protocol for the returned data, any stray byte would be taken as
+  // part of the next reply. The link is clean after an exchange whose
+  // reply arrived complete with nothing trailing it, provided that the
+  // heartbeat is off. Back-to-back commands therefore pay nothing.
+  if ((mLink_clean == false) || (mCPS_is_on == true))
+    clearUSB();
 
   //cout << cmd << endl;
   // 1st, issue the command to the GMC-300, this is always an ASCII
@@ -1415,11 +2515,202 @@ GQGMC::communicate(const string cmd, char * retdata, uint32_t retbytes)
   // 2nd, read the return data, for all commands except get version
   // this is always raw binary data.
   // For flexibility, only read if return is not 'null'.
-  if (retbytes > 0) readCmdReturn(retdata, retbytes);
+  if (retbytes > 0)
+    readCmdReturn(retdata, retbytes,
+                  (timeout_ms > 0) ? timeout_ms : replyTimeout(retbytes));
+
+  // A short reply may be completed by late bytes, and surplus bytes
+  // belong to no command. Either way, the next command must drain.
+  if ((mRead_status == false) || (mRx_tail > mRx_head))
+    mLink_clean = false;
 
   return;
 } // end communicate()
 
+// queueCmd is the private method to append a command to the command
+// queue instead of issuing it immediately. The arguments are those of
+// communicate(): the encoded command bytes, the repository for the
+// returned data and the expected number of returned bytes. Nothing is
+// transmitted until runQueue() is called.
+void
+GQGMC::queueCmd(const string cmd, char * retdata, uint32_t retbytes)
+{
+  cmd_entry_t  entry;
+
+  entry.cmd      = cmd;
+  entry.retdata  = retdata;
+  entry.retbytes = retbytes;
+  entry.status   = false;
+  entry.received = 0;
+
+  mCmd_queue.push_back(entry);
+
+  return;
+} // end queueCmd()
+
+// runQueue is the private method to issue all queued commands with up
+// to mPipeline_depth of them in flight on the serial link at once. The
+// GQ GMC processes commands strictly in order, so although it has no
+// protocol for the returned data, the replies arrive in the order of the
+// commands and are matched back to the queue entries by their expected
+// lengths. Commands are written in bursts, so the next command is
+// already waiting in the GQ GMC's receiver while it transmits the reply
+// to the previous one, and we never pay a full round trip per command.
+//
+// On return, the status member of each queue entry tells whether its
+// reply arrived complete. Once one reply fails, the replies behind it
+// cannot be told apart any more, so the remaining commands are not sent
+// and their status is false. The caller inspects the entries and then
+// clears the queue. mRead_status reflects the whole batch.
+//
+// While the heartbeat is on, CPS frames would interleave with the
+// replies. Then, as with a depth of one, each command goes through
+// communicate() in turn.
+void
+GQGMC::runQueue()
+{
+  uint32_t   count   = mCmd_queue.size();
+  uint32_t   sent    = 0;   // commands written to the link
+  uint32_t   done    = 0;   // commands whose reply has been read
+  bool       in_step = true;
+
+  if ((mCPS_is_on == true) || (mPipeline_depth <= 1) || (mTransport == 0) ||
+      (mLink_lost == true))
+  {
+    for(uint32_t i=0; i<count; i++)
+    {
+      communicate(mCmd_queue[i].cmd, mCmd_queue[i].retdata,
+                  mCmd_queue[i].retbytes);
+      mCmd_queue[i].status   = mRead_status;
+      mCmd_queue[i].received = mRead_count;
+    }
+    return;
+  }
+
+  // Same as communicate(), drain only if the link is suspect.
+  if (mLink_clean == false)
+    clearUSB();
+
+  mError_code  = eNoProblem;
+  mRead_status = true;
+
+  while ((done < count) && (in_step == true))
+  {
+    // Keep the pipeline full: write as many commands as one burst as
+    // the depth allows.
+    string burst;
+    while ((sent < count) && ((sent - done) < mPipeline_depth))
+      burst += mCmd_queue[sent++].cmd;
+    if ((burst.size() > 0) &&
+        (mTransport->write(reinterpret_cast<const uint8_t *>(burst.c_str()),
+                           burst.size()) < 0))
+    {
+      linkFailed();
+      in_step = false;
+      break;
+    }
+
+    cmd_entry_t & entry = mCmd_queue[done++];
+    if (entry.retbytes > 0)
+    {
+      readCmdReturn(entry.retdata, entry.retbytes,
+                    replyTimeout(entry.retbytes));
+      in_step        = mRead_status;
+      entry.received = mRead_count;
+    }
+    entry.status = in_step;
+  } // end while loop
+
+  // Same as communicate(), a failed or trailing reply leaves the link
+  // out of step.
+  mRead_status = in_step;
+  if ((in_step == false) || (mRx_tail > mRx_head))
+    mLink_clean = false;
+
+  return;
+} // end runQueue()
+
+// decodeCount is the private method to convert the two returned bytes
+// of a CPM or CPS reply (or an automatically reported CPS frame) to an
+// integer.
+uint16_t
+GQGMC::decodeCount(const char * count_char)
+{
+  uint16_t count_int = 0;
+
+  // 1st byte is MSB, but note that upper two bits are reserved bits.
+  // Note that shifting and bitmasking performed in uP register, so
+  // endianess is irrevelant.
+  count_int |= ((uint16_t(count_char[0]) << 8) & 0x3f00);
+  count_int |=  (uint16_t(count_char[1]) & 0x00ff);
+
+  return count_int;
+} // end decodeCount()
+
+// decodeVoltage is the private method to convert the single returned
+// byte of the battery voltage reply to volts.
+float
+GQGMC::decodeVoltage(const char * voltage_char)
+{
+  int32_t  voltage_int = int16_t(voltage_char[0]);
+  return float(voltage_int) / 10.0;
+} // end decodeVoltage()
+
+// decodeSerialNumber is the private method to convert the 7 returned
+// bytes of the serial number reply to a string of hex digits.
+string
+GQGMC::decodeSerialNumber(const char * serial_number)
+{
+  const
+  uint32_t      sernumsize = 7;
+  uint8_t       nibble[2*sernumsize];  // each nibble of returned data
+  stringstream  ss;
+
+  // Convert each nibble to an 8-bit int because each nibble
+  // represents a separate serial number digit.
+  for(uint32_t i=0; i<sernumsize; i++)
+  {
+    nibble[(i*2)]   = (serial_number[i] & 0xF0) >> 4;
+    nibble[(i*2)+1] = (serial_number[i] & 0x0F);
+    // Convert byte array to string of hex ASCII char. Do not use
+    // Hex utility because that forces each arg to have 2 char field.
+    ss << hex << uint16_t(nibble[i*2]) << uint16_t(nibble[(i*2)+1]);
+  }
+
+  return ss.str();
+} // end decodeSerialNumber()
+
+// replyTimeout is the private method which computes the deadline for
+// a reply of retbytes bytes. Unless overridden by setReplyTimeout(), the
+// deadline is the reaction time allowance plus the transfer time at the
+// current baud rate with margin. For example, a 2 byte CPM reply at
+// 57600 baud must be complete within about 101 milliseconds, and a 4K
+// history read within about 1.2 seconds. So a dead or unplugged GQ GMC
+// is noticed quickly instead of after 0.5 seconds for every byte.
+uint32_t
+GQGMC::replyTimeout(uint32_t retbytes)
+{
+  if (mTimeout_override_ms > 0)
+    return mTimeout_override_ms;
+
+  uint64_t transfer_ms = (uint64_t(retbytes) * kBits_Per_Byte * 1000
+                          * kTransfer_Margin_pct) / (uint64_t(mBaud_rate) * 100);
+
+  return kReply_Latency_ms + uint32_t(transfer_ms) + 1;
+} // end replyTimeout()
+
+// configTimeout is the private method which computes the deadline for
+// the ack of a configuration command, the longer of replyTimeout() and
+// kConfig_Reply_Timeout_ms, so that an override for a slow link still
+// stretches it.
+uint32_t
+GQGMC::configTimeout()
+{
+  uint32_t timeout_ms = replyTimeout(1);
+  return (timeout_ms > kConfig_Reply_Timeout_ms)
+       ? timeout_ms : kConfig_Reply_Timeout_ms;
+} // end configTimeout()
+
 // sendCmd is the private method (the basic method) to transmit
 // the command to the GMC-300.
 // cmd is the ASCII string to send as the command.
@@ -1434,8 +2725,14 @@ GQGMC::sendCmd(const string cmd)
   // is always preceeded by a write command (except for turn_on_cps!).
   mRead_status = true;
 
-  // Call low level C stdio routine to write to USB port.
-  write(mUSB_serial, cmd.c_str(), cmd.size());
+  // Hand the command to the transport to write to USB port. Without an
+  // open transport, or with a lost link, there is nothing to write to,
+  // and so nothing will be read either.
+  if ((mTransport == 0) || (mLink_lost == true))
+    mRead_status = false;
+  else if (mTransport->write(reinterpret_cast<const uint8_t *>(cmd.c_str()),
+                             cmd.size()) < 0)
+    linkFailed();
 
   return;
 } // end sendCmd()
@@ -1444,37 +2741,81 @@ GQGMC::sendCmd(const string cmd)
 // the return bytes from the command.
 // retdata is the repository for the returned data.
 // retbytes is the number of bytes of the returned data.
+// timeout_ms is the time allowed for the whole reply to arrive.
 void
-GQGMC::readCmdReturn(char * retdata, uint32_t retbytes)
+GQGMC::readCmdReturn(char * retdata, uint32_t retbytes, uint32_t timeout_ms)
 {
   uint32_t rcvd = 0;           // the number of received bytes
-  char * inp    = &retdata[0]; // pointer to returned data char array
-                               // start pointer off at beginning of
-                               // repository.
 
   // Assume read will succeed, replicated here only because of the
   // nature of the turn_on_cps command which automatically returns
   // data without a preceeding write.
   mRead_status = true;
 
-  // Now read the returned raw byte string. Do this by reading one byte
-  // at a time until the requested number of bytes are attained. However,
-  // the serial port has been setup to timeout each read attempt. So if
-  // after N calls to read, we haven't yet read all N bytes, declare
-  // a failure. The read is done this way to avoid an indefinite blocking
-  // situation when 0 bytes are returned by the GQ GMC. The only good thing
-  // about this methodology is that the largest possible read is only 4K
-  // for the history data. So the read never really takes that much time.
-  for(uint32_t i=0; i<retbytes; i++)
+  // First hand out whatever a previous read parked in the receive
+  // buffer. This matters in particular for the heartbeat, where one
+  // read may well have picked up several CPS frames at once.
+  if (mRx_tail > mRx_head)
   {
-    rcvd += read(mUSB_serial, inp, 1);
-    inp   = &retdata[rcvd];
-    if (rcvd >= retbytes) break;
-  } // end for loop
+    rcvd = mRx_tail - mRx_head;
+    if (rcvd > retbytes) rcvd = retbytes;
+    memcpy(retdata, &mRx_buffer[mRx_head], rcvd);
+    mRx_head += rcvd;
+  }
+  if (mRx_head == mRx_tail)
+    mRx_head = mRx_tail = 0;
+
+  // Now read the remainder of the returned raw byte string. Rather than
+  // reading one byte at a time, wait with poll() until the port has
+  // something to offer and then take everything there is in one call
+  // (see waitReadable() and readv() of the transport in gqtransport.cc).
+  // The readv() scatters the bytes still needed by this reply directly
+  // into retdata and parks any surplus in the (by now empty) receive
+  // buffer. The whole reply is bound by a single deadline, so a GQ GMC
+  // which returns fewer bytes than expected cannot block indefinitely.
+  const
+  int64_t  deadline = monotonic_ms() + timeout_ms;
+
+  while ((rcvd < retbytes) && (mTransport != 0) && (mLink_lost == false))
+  {
+    int64_t remaining = deadline - monotonic_ms();
+    if (remaining <= 0) break;
+
+    int ready = mTransport->waitReadable(int(remaining));
+    if (ready < 0)          // the link failed, eg, adapter unplugged
+    {
+      linkFailed();
+      break;
+    }
+    if (ready == 0) continue;  // deadline check above decides
+
+    struct iovec iov[2];
+    iov[0].iov_base = &retdata[rcvd];
+    iov[0].iov_len  = retbytes - rcvd;
+    iov[1].iov_base = &mRx_buffer[0];
+    iov[1].iov_len  = kRx_Bufsize;
+
+    ssize_t got = mTransport->readv(iov, 2);
+    if (got < 0)
+    {
+      linkFailed();
+      break;
+    }
+    if (got == 0) continue;
+    markRxTime();
+
+    if (uint32_t(got) > (retbytes - rcvd))
+    {
+      mRx_tail = uint32_t(got) - (retbytes - rcvd);
+      rcvd     = retbytes;
+    }
+    else
+      rcvd += uint32_t(got);
+  } // end while loop
 
   //  debugging code
   /*
-  inp = &retdata[0];
+  char * inp = &retdata[0];
   for(uint32_t i=0; i<retbytes; i++)
   {
     cout << Hex(inp[i]) << "-";
@@ -1491,6 +2832,7 @@ GQGMC::readCmdReturn(char * retdata, uint32_t retbytes)
   // number of bytes is returned by the GMC-300.
   if (rcvd < retbytes)
     mRead_status = false;
+  mRead_count = rcvd;
 
   return;
 } // readCmdReturn()
@@ -140,6 +140,24 @@
 // This include allows use of Linux predefined types
 #include <stdint.h>
 
+// This include for the arrival time of heartbeat samples
+#include <time.h>
+
+// This include for the command queue
+#include <vector>
+
+// This include for the transport carrying the bytes to and from the GMC
+#include "gqtransport.hh"
+
+// This include for reading the serial port on a thread of its own
+#include "gqthread.hh"
+
+// This include for finding the frames of the heartbeat
+#include "gqframe.hh"
+
+// This include for what the model of the GMC can do
+#include "gqmodel.hh"
+
 #ifndef gqgmc_hh_
 #define gqgmc_hh_
 
@@ -282,7 +300,7 @@ namespace GQLLC
     eGet_battery_voltage, eGet_history_data,
     eGet_history_data_length, eGet_history_data_address,
     eGet_history_data_overrun, eSet_Year, eSet_Month, eSet_Day,
-    eSet_Hour, eSet_Minute, eSet_Second,
+    eSet_Hour, eSet_Minute, eSet_Second, eUnsupported_command,
     eLast_error_code
   };
 
@@ -292,10 +310,41 @@ namespace GQLLC
   // requested length of history data and the maximum address in history
   // buffer, respectively. External users can use this to guard against
   // erroneous requests for history data. Actually, getHistoryData()
-  // method has guards also.
+  // method has guards also. The history buffer of the GMC-320 and later
+  // models is larger, see getFlashSize().
   uint32_t const kHistory_Data_Maxsize = 0x1000;  //  4k bytes
   uint32_t const kHistory_Addr_Maxsize = 0x10000; // 64k bytes
 
+  // STATUS SWEEP
+  //
+  // Declare a globally visible structure to hold the result of the
+  // getStatus() method, which gathers the commonly monitored values in
+  // one pipelined exchange. See getStatus() method in gqgmc.cc.
+  struct gmc_status_t
+  {
+    std::string  version;          // model and firmware, as getVersion()
+    std::string  serial_number;    // as getSerialNumber()
+    float        battery_voltage;  // as getBatteryVoltage()
+    uint16_t     cpm;              // as getCPM()
+
+    gmc_status_t() : battery_voltage(0.0f), cpm(0) { }
+  };
+
+  // HEARTBEAT SAMPLE
+  //
+  // Declare a globally visible structure to hold one CPS value reported
+  // by the heartbeat, together with the time it arrived. Both clocks are
+  // read back to back as soon as the read of the frame returns, before
+  // any decoding or formatting: the monotonic time for intervals and for
+  // correlating counters on the same host, the real time for the record.
+  // See getAutoCPS() and readAutoCPS() methods in gqgmc.cc.
+  struct cps_sample_t
+  {
+    uint16_t         cps;           // counts in the second
+    struct timespec  arrival;       // CLOCK_REALTIME when the frame arrived
+    struct timespec  arrival_mono;  // CLOCK_MONOTONIC at the same instant
+  };
+
   // CLASS DECLARATION
   //
   // The Class declaration - see gqgmc.cc for documentation
@@ -311,7 +360,9 @@ namespace GQLLC
     virtual
     ~GQGMC()
     {
+      closeUSB();
       delete[] mHistory_data;
+      delete[] mRx_buffer;
     };
 
     // SUPPORTING PUBLIC METHODS
@@ -321,6 +372,12 @@ namespace GQLLC
     void
     openUSB(string usb_device_name);
 
+    // Method to open any other transport, for example a loopback to an
+    // in-process device model or the replay of a recorded trace.
+    virtual
+    void
+    openTransport(GQTransport * transport);
+
     // Method to close USB port
     virtual
     void
@@ -333,6 +390,86 @@ namespace GQLLC
     void
     clearUSB();
 
+    // Method to override the computed reply deadline, zero restores it.
+    virtual
+    void
+    setReplyTimeout(uint32_t timeout_ms);
+
+    // Method to set how many queued commands may be in flight at once.
+    virtual
+    void
+    setPipelineDepth(uint32_t depth);
+
+    // Method to name a file in which the working baud rate of each
+    // GQ GMC is remembered by serial number, so that the next openUSB()
+    // of the same port tries it first. An empty name, the default,
+    // disables the cache.
+    virtual
+    void
+    setBaudCacheFile(const std::string & file_name);
+
+    // Method to name a file in which the next openUSB() records every
+    // byte to and from the GQ GMC, in the trace format of gqtransport.hh,
+    // for ReplayTransport to play back. An empty name, the default,
+    // records nothing.
+    virtual
+    void
+    setTraceFile(const std::string & file_name);
+
+    // Method to have openUSB() read the serial port on a thread of its
+    // own (see gqthread.hh), pinned to a CPU unless cpu is -1 and at a
+    // SCHED_FIFO priority unless fifo_priority is 0. Takes effect with
+    // the next openUSB().
+    virtual
+    void
+    setReaderThread(bool enable, int cpu, int fifo_priority);
+
+    // Method to get the errno with which the reader thread was refused
+    // its CPU or priority, 0 if it was not or there is no reader thread.
+    virtual
+    int
+    getReaderSchedError();
+
+    // Method to get the number of reads the reader thread had to drop
+    // because the caller did not take the data in time.
+    virtual
+    uint64_t
+    getReaderOverflows();
+
+    // Method to get the baud rate found by openUSB().
+    virtual
+    uint32_t
+    getBaudRate()
+    {
+      return mBaud_rate;
+    };
+
+    // Method to get the capabilities of the GQ GMC, as identified by
+    // openUSB(), see gqmodel.hh. Until then, and for an unknown model,
+    // it is a 64K byte model supporting every command.
+    virtual
+    const gmc_model_t &
+    getModel()
+    {
+      return *mModel;
+    };
+
+    // Method to tell whether the GQ GMC supports a command.
+    virtual
+    bool
+    isSupported(enum gmc_command_t command)
+    {
+      return GQModelRegistry::supports(*mModel, command);
+    };
+
+    // Method to get the size of the history buffer in bytes.
+    virtual
+    uint32_t
+    getFlashSize()
+    {
+      return mModel->flash_size;
+    };
+
     // Method to call to check any and all error conditions exihibited
     // by the GQGMC class, implementation is trivial so coded inline.
     virtual
@@ -342,6 +479,36 @@ namespace GQLLC
       return mError_code;
     };
 
+    // Method to tell whether the link to the GQ GMC has failed, eg, the
+    // USB-serial adapter was unplugged. See reconnect().
+    virtual
+    bool
+    isLinkLost()
+    {
+      return mLink_lost;
+    };
+
+    // Method to try to reopen a lost link. Returns true once the GQ GMC
+    // is back, false if it is not or the next attempt is not yet due.
+    virtual
+    bool
+    reconnect();
+
+    // Method to get the milliseconds until the next reconnect() attempt
+    // is due.
+    virtual
+    uint32_t
+    getReconnectDelay();
+
+    // Method to get the duration in milliseconds of the last gap, from
+    // the loss of the link to the success of reconnect().
+    virtual
+    uint32_t
+    getLastGap()
+    {
+      return mLast_gap_ms;
+    };
+
     // Method to get a text description of the error code.
     virtual
     std::string
@@ -377,12 +544,47 @@ namespace GQLLC
     float
     getBatteryVoltage();
 
+    // Method to get version, serial number, voltage, CPM and the
+    // configuration data in one pipelined exchange.
+    virtual
+    void
+    getStatus(gmc_status_t & status);
+
     // Method to get history data from internal flash. Returned
     // pointer points to private data history data buffer.
     virtual
     uint8_t * const
     getHistoryData(uint32_t address, uint32_t length);
 
+    // Methods to get history data from internal flash into the caller's
+    // buffer of at least length bytes, or vector, without the private
+    // buffer. Return true if all length bytes were read.
+    virtual
+    bool
+    getHistoryData(uint32_t address, uint32_t length, uint8_t * data);
+
+    virtual
+    bool
+    getHistoryData(uint32_t address, uint32_t length,
+                   std::vector<uint8_t> & data);
+
+    // Method to read a range of history data of any length into the
+    // caller's buffer, in pipelined SPIR commands of at most chunk
+    // bytes. Returns the number of bytes read in full from the start.
+    virtual
+    uint32_t
+    readHistory(uint32_t address, uint32_t length, uint8_t * data,
+                uint32_t chunk);
+
+    // Method to get, per chunk of the last readHistory(), the number of
+    // SPIRs issued for the missing tail of a short reply.
+    virtual
+    const std::vector<uint32_t> &
+    getChunkRetries()
+    {
+      return mChunk_retries;
+    };
+
     // Method to enable automatic reporting of count per second value.
     virtual
     void
@@ -398,6 +600,34 @@ namespace GQLLC
     uint16_t
     getAutoCPS();
 
+    // Method to read the automatically transmitted CPS value together
+    // with its arrival time.
+    virtual
+    void
+    getAutoCPS(cps_sample_t & sample);
+
+    // Method to take whatever automatically transmitted CPS values have
+    // arrived, without waiting. Returns the number of samples stored.
+    virtual
+    uint32_t
+    readAutoCPS(cps_sample_t * samples, uint32_t max_samples);
+
+    // Method to get a file descriptor which becomes readable when the
+    // GQ GMC has sent data, for use with poll() or epoll. Returns -1 if
+    // the transport has none.
+    virtual
+    int
+    getPollFd();
+
+    // Method to get the number of times the heartbeat stream was found
+    // misaligned and realigned, see gqframe.hh.
+    virtual
+    uint32_t
+    getResyncCount()
+    {
+      return mFramer.getResyncCount();
+    };
+
     // Method to turn off the GQ GMC.
     virtual
     void
@@ -424,6 +654,12 @@ namespace GQLLC
     uint32_t
     getDataSaveAddress();
 
+    // Method to retrieve the date/timestamp of the logging run which
+    // begins at the DataSaveAddress, as "YYMMDDhhmmss".
+    virtual
+    std::string
+    getSaveTimeStamp();
+
     // Method to set DataSaveAddress to zero, in other words,
     // set the address of data logging to begin in the
     // history buffer at address zero.
@@ -478,9 +714,22 @@ namespace GQLLC
     // The device name of the USB port connected to the GQ GMC.
     std::string             mUSB_device;
 
-    // Forced to use C style IO because C++ streams does not support
+    // The transport carrying the bytes to and from the GQ GMC, see
+    // gqtransport.hh. For openUSB() this is a TTYTransport, which is
+    // forced to use C style IO because C++ streams does not support
     // setting line discipline sufficiently on the serial port.
-    int                     mUSB_serial;
+    GQTransport *           mTransport;
+
+    // True if the transport was created by openUSB() and so is to be
+    // deleted by closeUSB().
+    bool                    mOwn_transport;
+
+    // The reader thread wrapper of the transport, if openUSB() created
+    // one, and its settings, see setReaderThread().
+    ThreadedTransport *     mReader;
+    bool                    mReader_thread;
+    int                     mReader_cpu;
+    int                     mReader_priority;
 
     // Error flag for indicating failure, see enumeration of error codes
     // declared above enum gmc_error_t.
@@ -491,12 +740,36 @@ namespace GQLLC
     // so it can be tested privately.
     bool                    mRead_status;
 
+    // The number of bytes of the last reply which did arrive, all of
+    // them if mRead_status is true.
+    uint32_t                mRead_count;
+
     // Special flag indicating that automatic reporting of counts per
     // second is turned off or on (off==false, on==true). This should
     // and is intended to be implemented as a mutex if and when threading
     // is implemented.
     bool                    mCPS_is_on;
 
+    // Flag indicating that the link is known to be in step, that is,
+    // nothing is left over in the input from a previous exchange. When
+    // false, communicate() drains the input before the next command.
+    bool                    mLink_clean;
+
+    // Flag indicating that the transport failed, eg, with EIO or ENODEV
+    // after the USB-serial adapter was unplugged, and when that was
+    // detected (monotonic milliseconds). See linkFailed() and
+    // reconnect() in gqgmc.cc.
+    bool                    mLink_lost;
+    int64_t                 mLost_at_ms;
+
+    // Exponential backoff of reconnect(): the time the next attempt is
+    // due and the delay to wait after it should it fail.
+    int64_t                 mReconnect_due_ms;
+    uint32_t                mReconnect_delay_ms;
+
+    // Duration of the last gap, see getLastGap().
+    uint32_t                mLast_gap_ms;
+
     // The USB port uses big endian transfer (ie, MSB transmitted 1st).
     // This flag indicates the endianess of the host CPU. This is set
     // in the constructor by calling isBigEndian() method.
@@ -508,10 +781,66 @@ namespace GQLLC
     // will work with firmware prior to 2.15.
     float                   mFirmware_revision;
 
+    // The capabilities of the model and firmware, see gqmodel.hh.
+    const gmc_model_t *     mModel;
+
+    // The baud rate of the serial link in bits per second. Reply
+    // deadlines are derived from this, see replyTimeout() in gqgmc.cc.
+    // It is the rate found by negotiateBaud(), which is tried first
+    // again by reconnect().
+    uint32_t                mBaud_rate;
+
+    // The baud rate cache file, see setBaudCacheFile().
+    std::string             mBaud_cache_file;
+
+    // The trace file of openUSB(), see setTraceFile().
+    std::string             mTrace_file;
+
+    // Reply deadline set by setReplyTimeout(), zero when the deadline is
+    // to be computed from the expected reply length.
+    uint32_t                mTimeout_override_ms;
+
+    // The command queue, see queueCmd() and runQueue() in gqgmc.cc.
+    // Each entry holds the encoded command bytes, where its reply is to
+    // be deposited, the expected length of the reply and whether the
+    // reply arrived complete, or else how much of it did.
+    struct cmd_entry_t
+    {
+      std::string  cmd;
+      char *       retdata;
+      uint32_t     retbytes;
+      bool         status;
+      uint32_t     received;
+    };
+
+    std::vector<cmd_entry_t>  mCmd_queue;
+
+    // Maximum number of queued commands in flight on the serial link.
+    uint32_t                mPipeline_depth;
+
+    // Tail retries per chunk of the last readHistory().
+    std::vector<uint32_t>   mChunk_retries;
+
     // Storage for the history data, maximum of 4K bytes to be allocated
     // in constructor. The user can only request a max of 4K at a time.
     uint8_t *               mHistory_data;
 
+    // Reusable receive buffer, allocated in constructor. readCmdReturn()
+    // drains whatever the serial port has available in one read, so any
+    // bytes beyond the current reply are parked here (between mRx_head
+    // and mRx_tail) and handed out first on the next read.
+    uint8_t *               mRx_buffer;
+    uint32_t                mRx_head;
+    uint32_t                mRx_tail;
+
+    // Arrival time of the bytes of the latest read, which are the bytes
+    // in the receive buffer if there are any, see markRxTime().
+    struct timespec         mRx_mono;
+    struct timespec         mRx_real;
+
+    // Frame boundaries of the heartbeat, see gqframe.hh.
+    GQFramer                mFramer;
+
     // Declare a structure for storage of the configuration data.
     // This is a replica of the GQ GMC's internal configuration data.
     // This is referred to as the host computer's local copy of the
@@ -617,13 +946,97 @@ namespace GQLLC
     void
     loadConfigurationData();
 
+    // Open the transport and interrogate the GQ GMC, common to openUSB()
+    // and openTransport().
+    void
+    attachTransport(GQTransport * transport, bool owned);
+
+    // Open the transport, find the baud rate and read the version,
+    // common to attachTransport() and reconnect(). Returns true if the
+    // GQ GMC answered.
+    bool
+    openLink();
+
+    // Record that the transport failed.
+    void
+    linkFailed();
+
+    // Find the baud rate at which the GQ GMC answers GETVER, trying
+    // mBaud_rate first. Returns the version, or an empty string.
+    std::string
+    negotiateBaud();
+
+    // Check that the GQ GMC supports the command before it is sent.
+    // If not, set eUnsupported_command and a failed read, and return
+    // false.
+    bool
+    checkSupported(enum gmc_command_t command);
+
+    // Look up the cached baud rate of the USB port, 0 if none.
+    uint32_t
+    lookupBaud();
+
+    // Remember the baud rate of the GQ GMC with this serial number on
+    // the USB port.
+    void
+    storeBaud(const std::string & serial_number);
+
     // Because of the returned byte stream from the GQ GMC has no protocol,
     // that is, it is just a sequence of N bytes, we need a specialized
     // read. The write is straight forward, but is combined with the read
     // for reasons of code commonality. So we will call the write followed
     // by read as the 'communicate' method.
     void
-    communicate(const std::string cmd, char * retdata, uint32_t retbytes);
+    communicate(const std::string cmd, char * retdata, uint32_t retbytes,
+                uint32_t timeout_ms = 0);
+
+    // Append a command to the command queue without transmitting it.
+    void
+    queueCmd(const std::string cmd, char * retdata, uint32_t retbytes);
+
+    // Issue all queued commands pipelined and read their replies.
+    void
+    runQueue();
+
+    // Tell whether the end of history data read before is unchanged.
+    bool
+    checkEnd(uint32_t address, const uint8_t * data, uint32_t length,
+             uint32_t lost);
+
+    // Complete a short SPIR reply of which have bytes are in data, by
+    // reading only the missing tail. Returns true if it was completed,
+    // and counts the SPIRs issued in retries.
+    bool
+    readTail(uint32_t address, uint32_t length, uint8_t * data,
+             uint32_t have, uint32_t & retries);
+
+    // Frame the heartbeat bytes in the receive buffer.
+    uint32_t
+    frameRxBuffer(cps_sample_t * samples, uint32_t max_samples);
+
+    // Note the arrival time of the bytes read into the receive buffer.
+    void
+    markRxTime();
+
+    // These convert the raw returned data of the respective commands.
+    uint16_t
+    decodeCount(const char * count_char);
+
+    float
+    decodeVoltage(const char * voltage_char);
+
+    std::string
+    decodeSerialNumber(const char * serial_number);
+
+    // This computes the deadline in milliseconds for a reply of the
+    // given number of bytes.
+    uint32_t
+    replyTimeout(uint32_t retbytes);
+
+    // This computes the deadline in milliseconds for the ack of a
+    // configuration command, which writes flash before it answers.
+    uint32_t
+    configTimeout();
 
     // This is the basic method to transmit the command to the GQ GMC.
     // communicate() calls this to transmit command.
@@ -632,9 +1045,9 @@ namespace GQLLC
 
     // This is the basic method to read the return bytes from the command.
     // communicate() calls this to read the return byte stream of the
-    // command.
+    // command. The whole reply must arrive within timeout_ms.
     void
-    readCmdReturn(char * retdata, uint32_t retbytes);
+    readCmdReturn(char * retdata, uint32_t retbytes, uint32_t timeout_ms);
 
     // This is the method to determine endianess of host CPU. This is to be
     // called by constructor once and once only.
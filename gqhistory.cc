@@ -0,0 +1,414 @@
+// **************************************************************************
+// File: gqhistory.cc
+//
+// Synopsis:
+//   Define the GQHistoryDecoder class, which decodes the history data of
+//   a GQ GMC into typed records as it streams in.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqhistory.hh
+//
+// The decoder is a state machine, advanced byte by byte only within the
+// 55AA records. Between them, it looks for the next 55 with memchr() and
+// passes everything before it on as one run of samples, so the ordinary
+// history data costs a scan and one call of the listener per chunk.
+// The samples are scanned for 0xFF with memchr() likewise, which a
+// sample is seldom, so erased runs cost next to nothing to find either.
+//
+//
+// C++ includes
+#include <string>
+using namespace std;
+
+// Linux C includes
+#include <string.h>
+
+// These are GQ GMC project specific includes
+#include "gqhistory.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The bytes of the 55AA sequences and the codes following them.
+static
+uint8_t
+const          kMarker_1 = 0x55;
+
+static
+uint8_t
+const          kMarker_2 = 0xAA;
+
+static
+uint8_t
+const          kErased = 0xFF;
+
+static
+uint8_t
+const          kCode_Timestamp = 0x00;
+
+static
+uint8_t
+const          kCode_Count = 0x01;
+
+static
+uint8_t
+const          kCode_Note = 0x02;
+
+// Length of a date/timestamp record, 55AA00YYMMDDhhmmss55AADD, and the
+// offsets of its parts.
+static
+uint32_t
+const          kTimestamp_Length = 12;
+
+static
+uint32_t
+const          kTimestamp_Date = 3;
+
+static
+uint32_t
+const          kTimestamp_Close = 9;
+
+static
+uint32_t
+const          kTimestamp_Type = 11;
+
+// Length of a two byte sample record, 55AA01DHDL.
+static
+uint32_t
+const          kCount_Length = 5;
+
+// LOCAL UTILITIES
+//
+// Make a record with all fields but the type, the address and the save
+// data type zero.
+static
+history_record_t
+blank_record(enum history_record_type_t  type,
+             uint32_t                    address,
+             enum saveDataType_t         save_type)
+{
+  history_record_t  record;
+  memset(&record, 0, sizeof(record));
+  record.type      = type;
+  record.address   = address;
+  record.save_type = save_type;
+  return record;
+}
+
+
+// GQHISTORYDECODER CLASS CONSTRUCTOR
+GQHistoryDecoder::GQHistoryDecoder(GQHistoryListener * listener)
+  : mListener(listener), mBad_records(0)
+{
+  memset(mErased_bytes, kErased, sizeof(mErased_bytes));
+  reset(0);
+} // end GQHistoryDecoder constructor
+
+void
+GQHistoryDecoder::reset(uint32_t address, enum saveDataType_t save_type)
+{
+  mState          = eState_Samples;
+  mSave_type      = save_type;
+  mAddress        = address;
+  mRecord_address = address;
+  mRecord_length  = 0;
+  mNote_length    = 0;
+  mNote_wanted    = 0;
+  mErased_address = address;
+  mErased_length  = 0;
+  return;
+} // end reset()
+
+// decode runs the state machine over the chunk. A byte which turns out
+// not to continue the record in progress is not consumed: the record is
+// dropped and the byte is looked at again as the start of what follows,
+// eg, the 55 of 55 55 AA 00 is a sample and the second 55 starts a
+// timestamp.
+void
+GQHistoryDecoder::decode(const uint8_t * data, uint32_t length)
+{
+  uint32_t i = 0;
+
+  while (i < length)
+  {
+    uint8_t byte = data[i];
+
+    switch (mState)
+    {
+      case eState_Samples:
+      {
+        const uint8_t * marker = static_cast<const uint8_t *>(
+                                   memchr(&data[i], kMarker_1, length - i));
+        uint32_t        end    = (marker != 0) ? uint32_t(marker - data)
+                                               : length;
+        decodeSamples(&data[i], end - i, (marker == 0));
+        mAddress += end - i;
+        i         = end;
+
+        if (marker != 0)
+        {
+          mRecord_address = mAddress;
+          mRecord[0]      = kMarker_1;
+          mRecord_length  = 1;
+          mState          = eState_Marker;
+          mAddress++;
+          i++;
+        }
+        continue;
+      }
+
+      case eState_Marker:
+        if (byte != kMarker_2)
+        {
+          dropRecord(false);
+          continue;
+        }
+        mState = eState_Code;
+        break;
+
+      case eState_Code:
+        if (byte == kCode_Timestamp)
+          mState = eState_Timestamp;
+        else if (byte == kCode_Count)
+          mState = eState_Count;
+        else if (byte == kCode_Note)
+          mState = eState_Note_Length;
+        else
+        {
+          dropRecord(true);
+          continue;
+        }
+        break;
+
+      case eState_Timestamp:
+        if (((mRecord_length == kTimestamp_Close) && (byte != kMarker_1)) ||
+            ((mRecord_length == (kTimestamp_Close + 1)) &&
+             (byte != kMarker_2)))
+        {
+          dropRecord(true);
+          continue;
+        }
+        break;
+
+      case eState_Count:
+        break;
+
+      case eState_Note_Length:
+        mNote_wanted = byte;
+        mNote_length = 0;
+        mState       = eState_Note;
+        break;
+
+      case eState_Note:
+      {
+        // The text is passed straight from the chunk if it is all there,
+        // otherwise gathered in mNote.
+        uint32_t n = mNote_wanted - mNote_length;
+        if (n > (length - i))
+          n = length - i;
+
+        if ((mNote_length == 0) && (n == mNote_wanted))
+          emitNote(&data[i], n);
+        else
+        {
+          memcpy(&mNote[mNote_length], &data[i], n);
+          mNote_length += n;
+          if (mNote_length == mNote_wanted)
+            emitNote(mNote, mNote_wanted);
+        }
+        mAddress += n;
+        i        += n;
+        continue;
+      }
+    }
+
+    // The byte belongs to the record in progress.
+    mRecord[mRecord_length++] = byte;
+    mAddress++;
+    i++;
+
+    if (((mState == eState_Timestamp) &&
+         (mRecord_length == kTimestamp_Length)) ||
+        ((mState == eState_Count) && (mRecord_length == kCount_Length)))
+      emitRecord();
+    else if ((mState == eState_Note) && (mNote_wanted == 0))
+      emitNote(mNote, 0);
+  }
+
+  return;
+} // end decode()
+
+// finish passes on what there is of a record in progress, including the
+// part of a note gathered so far.
+void
+GQHistoryDecoder::finish()
+{
+  flushErased();
+
+  if (mState == eState_Samples)
+    return;
+
+  if (mState == eState_Note)
+  {
+    emitSamples(mRecord_address, mRecord, mRecord_length);
+    emitSamples(mRecord_address + mRecord_length, mNote, mNote_length);
+    mState = eState_Samples;
+  }
+  else
+    dropRecord(false);
+
+  return;
+} // end finish()
+
+// decodeSamples goes on with the 0xFF bytes held, if any, and then finds
+// the runs of 0xFF among the samples. A run which reaches the end of the
+// chunk is held, however long it is already, so that an erased area is
+// passed on as one record whatever the size of the chunks.
+void
+GQHistoryDecoder::decodeSamples(const uint8_t * data, uint32_t length,
+                                bool more)
+{
+  uint32_t i = 0;
+
+  if (mErased_length > 0)
+  {
+    while ((i < length) && (data[i] == kErased))
+      i++;
+    mErased_length += i;
+    if ((i == length) && more)
+      return;
+    flushErased();
+  }
+
+  uint32_t start = i;
+  while (i < length)
+  {
+    const uint8_t * erased = static_cast<const uint8_t *>(
+                               memchr(&data[i], kErased, length - i));
+    if (erased == 0)
+      break;
+
+    uint32_t run = uint32_t(erased - data);
+    uint32_t end = run;
+    while ((end < length) && (data[end] == kErased))
+      end++;
+
+    if ((end == length) && more)
+    {
+      emitSamples(mAddress + start, &data[start], run - start);
+      mErased_address = mAddress + run;
+      mErased_length  = end - run;
+      return;
+    }
+
+    if ((end - run) >= kErased_Run)
+    {
+      emitSamples(mAddress + start, &data[start], run - start);
+      mErased_address = mAddress + run;
+      mErased_length  = end - run;
+      flushErased();
+      start = end;
+    }
+    i = end;
+  }
+
+  emitSamples(mAddress + start, &data[start], length - start);
+  return;
+} // end decodeSamples()
+
+// flushErased passes on fewer than kErased_Run bytes as samples, from
+// mErased_bytes, since the chunk they came from may be gone.
+void
+GQHistoryDecoder::flushErased()
+{
+  if (mErased_length == 0)
+    return;
+
+  if (mErased_length >= kErased_Run)
+  {
+    history_record_t record = blank_record(eRecord_Erased, mErased_address,
+                                           mSave_type);
+    record.length = mErased_length;
+    mListener->onRecord(record);
+  }
+  else
+    emitSamples(mErased_address, mErased_bytes, mErased_length);
+
+  mErased_length = 0;
+  return;
+} // end flushErased()
+
+void
+GQHistoryDecoder::emitSamples(uint32_t address, const uint8_t * data,
+                              uint32_t length)
+{
+  if (length == 0)
+    return;
+
+  history_record_t record = blank_record(eRecord_Samples, address,
+                                         mSave_type);
+  record.data   = data;
+  record.length = length;
+  mListener->onRecord(record);
+  return;
+} // end emitSamples()
+
+void
+GQHistoryDecoder::dropRecord(bool bad)
+{
+  if (bad)
+    mBad_records++;
+
+  emitSamples(mRecord_address, mRecord, mRecord_length);
+  mRecord_length = 0;
+  mState         = eState_Samples;
+  return;
+} // end dropRecord()
+
+// emitRecord passes on a complete timestamp or two byte sample. A
+// timestamp starts a logging run, so its save data type applies to the
+// timestamp itself and to everything after it.
+void
+GQHistoryDecoder::emitRecord()
+{
+  history_record_t record;
+
+  if (mState == eState_Timestamp)
+  {
+    mSave_type    = (enum saveDataType_t)(mRecord[kTimestamp_Type]);
+    record        = blank_record(eRecord_Timestamp, mRecord_address,
+                                 mSave_type);
+    record.year   = mRecord[kTimestamp_Date + 0];
+    record.month  = mRecord[kTimestamp_Date + 1];
+    record.day    = mRecord[kTimestamp_Date + 2];
+    record.hour   = mRecord[kTimestamp_Date + 3];
+    record.minute = mRecord[kTimestamp_Date + 4];
+    record.second = mRecord[kTimestamp_Date + 5];
+  }
+  else
+  {
+    record        = blank_record(eRecord_Count, mRecord_address, mSave_type);
+    record.count  = uint16_t((mRecord[3] << 8) | mRecord[4]);
+  }
+
+  mRecord_length = 0;
+  mState         = eState_Samples;
+  mListener->onRecord(record);
+  return;
+} // end emitRecord()
+
+void
+GQHistoryDecoder::emitNote(const uint8_t * text, uint32_t length)
+{
+  history_record_t record = blank_record(eRecord_Note, mRecord_address,
+                                         mSave_type);
+  record.data   = text;
+  record.length = length;
+
+  mRecord_length = 0;
+  mNote_length   = 0;
+  mState         = eState_Samples;
+  mListener->onRecord(record);
+  return;
+} // end emitNote()
+
+// end file gqhistory.cc
@@ -0,0 +1,233 @@
+// **************************************************************************
+// File: gqhistory.hh
+//
+// Description:
+//    Declare the GQHistoryDecoder class, which decodes the history data
+//    of a GQ GMC into typed records as it streams in.
+//
+// HISTORY DECODING OVERVIEW
+//
+// The history flash holds one byte per sample, interspersed with 55AA
+// sequences for date/timestamps, ASCII notes and samples above 255, see
+// getHistoryData() in gqgmc.cc for the format. getHistoryData(),
+// readHistory() and the flash dump (gqdump.hh) all return the raw bytes.
+// GQHistoryDecoder turns them into records for a GQHistoryListener:
+//
+//   - eRecord_Samples: a run of one byte samples,
+//   - eRecord_Count: one two byte sample, 55AA01DHDL,
+//   - eRecord_Timestamp: a date/timestamp, 55AA00YYMMDDhhmmss55AADD,
+//     which starts a logging run and carries its save data type,
+//   - eRecord_Note: an ASCII note, 55AA02LL followed by LL characters,
+//   - eRecord_Erased: a run of at least kErased_Run bytes of 0xFF, which
+//     is erased flash, eg, ahead of the newest data, and not samples.
+//
+// Every record carries the save data type of the logging run it belongs
+// to, ie, whether a sample is a CPS, a CPM or an hourly CPM, and the
+// flash address of its first byte.
+//
+// The decoder is fed the data in chunks of any size, eg, from the
+// onData() of a GQFlashDumpSink, so a dump is decoded while it is read.
+// A record may straddle the chunks: the decoder keeps its state between
+// calls to decode(). Nothing is copied on the way. A run of samples and
+// the text of a note are passed as pointers into the chunk given, which
+// are valid only during the call to onRecord(). Only the few bytes of a
+// record which straddles two chunks are kept by the decoder, and a note
+// split so is passed from the decoder's own copy.
+//
+// A single 0xFF is a valid sample of 255 counts, but kErased_Run of them
+// in a row are not, and are passed on as one eRecord_Erased, which has
+// an address and a length but no data. Fewer are passed on as samples.
+// Since an erased run may go on in the next chunk, the 0xFF bytes at the
+// end of a chunk are held until a later byte or finish() tells what they
+// are.
+//
+// A 55AA sequence whose code is unknown, or a date/timestamp without its
+// closing 55AA, is not a record after all. Its bytes are passed on as
+// samples, and counted as a bad record, see getBadRecordCount().
+//
+#include <stdint.h>
+
+#include "gqgmc.hh"
+
+#ifndef gqhistory_hh_
+#define gqhistory_hh_
+
+namespace GQLLC
+{
+
+  // The erased flash is recognized by this many bytes of 0xFF in a row,
+  // here and by GQHistorySync (gqsync.hh) and GQFlashMirror (gqmirror.hh).
+  uint32_t const kErased_Run = 16;
+
+  // The kinds of history record, see above.
+  enum history_record_type_t
+  {
+    eRecord_Samples,
+    eRecord_Count,
+    eRecord_Timestamp,
+    eRecord_Note,
+    eRecord_Erased
+  };
+
+  // A history record. The fields which do not belong to the type of the
+  // record are left zero.
+  struct history_record_t
+  {
+    enum history_record_type_t  type;
+    uint32_t                    address;    // flash address of the record
+    enum saveDataType_t         save_type;  // of the current logging run
+
+    const uint8_t *             data;       // samples, or note text
+    uint32_t                    length;     // of data, or erased run
+
+    uint16_t                    count;      // eRecord_Count
+
+    uint8_t                     year;       // eRecord_Timestamp, 2 digits
+    uint8_t                     month;
+    uint8_t                     day;
+    uint8_t                     hour;
+    uint8_t                     minute;
+    uint8_t                     second;
+  };
+
+
+  // HISTORY LISTENER
+  //
+  // Abstract class of the receiver of the decoded records.
+  class GQHistoryListener
+  {
+    public:
+
+    virtual
+    ~GQHistoryListener()
+    {
+    };
+
+    // A record has been decoded. The data it points to is valid only
+    // during the call.
+    virtual
+    void
+    onRecord(const history_record_t & record) = 0;
+
+  }; // end class GQHistoryListener
+
+
+  // HISTORY DECODER
+  //
+  // The class declaration - see gqhistory.cc for documentation
+  class GQHistoryDecoder
+  {
+    public:
+
+    // The listener is owned by the caller and must outlive the decoder.
+    GQHistoryDecoder(GQHistoryListener * listener);
+
+    // Method to start decoding afresh at the flash address given, with
+    // the save data type unknown (eSaveOff) until the next timestamp.
+    void
+    reset(uint32_t address, enum saveDataType_t save_type = eSaveOff);
+
+    // Method to decode the next length bytes of history data, which
+    // follow the bytes decoded before.
+    void
+    decode(const uint8_t * data, uint32_t length);
+
+    // Method to end the data. A record left incomplete is passed on as
+    // samples, as far as it went, and the 0xFF bytes held, as what they
+    // are.
+    void
+    finish();
+
+    // Method to get the flash address of the next byte to decode.
+    uint32_t
+    getAddress()
+    {
+      return mAddress;
+    };
+
+    // Method to get the number of bad records so far.
+    uint32_t
+    getBadRecordCount()
+    {
+      return mBad_records;
+    };
+
+    // Method to tell whether the decoder is between records, ie, the
+    // data decoded so far ends with no record in progress. 0xFF bytes
+    // may still be held, see finish().
+    bool
+    isBetweenRecords()
+    {
+      return (mState == eState_Samples);
+    };
+
+    private:
+
+    // Where the decoder is within a 55AA record.
+    enum state_t
+    {
+      eState_Samples,      // not in a record
+      eState_Marker,       // had 55
+      eState_Code,         // had 55AA
+      eState_Timestamp,    // in the 9 bytes after 55AA00
+      eState_Count,        // in the 2 bytes after 55AA01
+      eState_Note_Length,  // had 55AA02
+      eState_Note          // in the text
+    };
+
+    GQHistoryListener *  mListener;
+
+    enum state_t         mState;
+    enum saveDataType_t  mSave_type;
+    uint32_t             mAddress;
+    uint32_t             mBad_records;
+
+    // The record in progress: its address and the bytes so far, at most
+    // 55AA00 and the 9 bytes of a timestamp.
+    uint32_t             mRecord_address;
+    uint8_t              mRecord[12];
+    uint32_t             mRecord_length;
+
+    // The text of a note which straddles two chunks.
+    uint8_t              mNote[256];
+    uint32_t             mNote_length;
+    uint32_t             mNote_wanted;
+
+    // The 0xFF bytes held at the end of the last chunk, and as many of
+    // them to pass on as samples from, should they be too few.
+    uint32_t             mErased_address;
+    uint32_t             mErased_length;
+    uint8_t              mErased_bytes[kErased_Run];
+
+    // Pass on the samples from mAddress up to a 55 or, if more is true,
+    // the end of the chunk, and the erased runs among them.
+    void
+    decodeSamples(const uint8_t * data, uint32_t length, bool more);
+
+    // Pass on the 0xFF bytes held, as an erased run or as samples.
+    void
+    flushErased();
+
+    // Pass on a run of samples.
+    void
+    emitSamples(uint32_t address, const uint8_t * data, uint32_t length);
+
+    // Pass on the record in progress as samples, and count it as bad
+    // if it is.
+    void
+    dropRecord(bool bad);
+
+    // Pass on the completed record in progress.
+    void
+    emitRecord();
+
+    // Pass on a note.
+    void
+    emitNote(const uint8_t * text, uint32_t length);
+
+  }; // end class GQHistoryDecoder
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqhistory.cc
+#endif  // gqhistory_hh_
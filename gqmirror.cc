@@ -0,0 +1,413 @@
+// **************************************************************************
+// File: gqmirror.cc
+//
+// Synopsis:
+//   Define the GQFlashMirror class, a local copy of the history flash of
+//   a GQ GMC kept in a memory mapped file.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqmirror.hh
+//
+//
+// C++ includes
+#include <string>
+#include <vector>
+using namespace std;
+
+// Linux C includes
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// These are GQ GMC project specific includes
+#include "gqmirror.hh"
+#include "gqhistory.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The first word of the sidecar, "GQMR" in a little endian host.
+static
+uint32_t
+const          kMirror_Magic = 0x524d5147;
+
+// Words of the sidecar header.
+static
+uint32_t
+const          kHeader_Words = 5;
+
+// Length of the date/timestamp record in front of the DataSaveAddress.
+static
+uint32_t
+const          kStamp_Record = 12;
+
+// Most blocks read in one pipelined batch.
+static
+uint32_t
+const          kBatch_Blocks = 16;
+
+
+// GQFLASHMIRROR CLASS CONSTRUCTOR
+GQFlashMirror::GQFlashMirror()
+  : mFd(-1), mData(0), mSize(0), mBlock(kHistory_Data_Maxsize), mBlocks(0),
+    mWrite_end(kMirror_No_Address), mSave_address(kMirror_No_Address),
+    mFetched(0)
+{
+} // end GQFlashMirror constructor
+
+GQFlashMirror::~GQFlashMirror()
+{
+  close();
+} // end GQFlashMirror destructor
+
+// open sizes a new or resized file with ftruncate(), so that its unread
+// blocks are zero rather than anything which might pass for data.
+bool
+GQFlashMirror::open(const string & file_name, uint32_t flash_size)
+{
+  close();
+
+  if (flash_size == 0)
+  {
+    errno = EINVAL;
+    return false;
+  }
+
+  mFd = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (mFd == -1)
+    return false;
+
+  struct stat  st;
+  bool         resized = false;
+  if (fstat(mFd, &st) == -1)
+  {
+    close();
+    return false;
+  }
+  if (uint64_t(st.st_size) != flash_size)
+  {
+    if (ftruncate(mFd, flash_size) == -1)
+    {
+      close();
+      return false;
+    }
+    resized = true;
+  }
+
+  void * map = mmap(0, flash_size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+  if (map == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+
+  mFile_name    = file_name;
+  mData         = static_cast<uint8_t *>(map);
+  mSize         = flash_size;
+  mBlocks       = (flash_size + mBlock - 1) / mBlock;
+  mWrite_end    = kMirror_No_Address;
+  mSave_address = kMirror_No_Address;
+  mValid.assign((mBlocks + 7) / 8, 0);
+
+  if (resized == false)
+    loadMap();
+
+  return true;
+} // end open()
+
+void
+GQFlashMirror::close()
+{
+  if (mData != 0)
+  {
+    flush();
+    munmap(mData, mSize);
+  }
+  if (mFd != -1)
+    ::close(mFd);
+
+  mFd     = -1;
+  mData   = 0;
+  mSize   = 0;
+  mBlocks = 0;
+  mValid.clear();
+  return;
+} // end close()
+
+// update follows the steps in gqmirror.hh. Where the current logging
+// run starts is only needed if there is no write end yet or the run has
+// moved.
+bool
+GQFlashMirror::update(GQGMC * gmc)
+{
+  mFetched = 0;
+  if (mData == 0)
+    return false;
+  mFresh.assign(mBlocks, false);
+
+  gmc->getConfigurationData();
+  if (gmc->getErrorCode() != eNoProblem)
+    return false;
+  uint32_t save = gmc->getDataSaveAddress() % mSize;
+
+  bool     ok  = fetchMissing(gmc);
+  uint32_t end = mWrite_end;
+
+  if (ok && (mWrite_end != kMirror_No_Address))
+    ok = followLog(gmc, mWrite_end, end);
+
+  if (ok && ((mWrite_end == kMirror_No_Address) || (save != mSave_address)))
+    ok = followLog(gmc, (save + mSize - kStamp_Record) % mSize, end);
+
+  if (ok)
+    ok = refetch(gmc, ((end / mBlock) + 1) % mBlocks);
+
+  if (ok)
+  {
+    mWrite_end    = end;
+    mSave_address = save;
+  }
+
+  flush();
+  return ok;
+} // end update()
+
+// flush writes the sidecar through a temporary file and a rename, as
+// GQGMC::storeBaud() does, once the data it describes is on disk.
+bool
+GQFlashMirror::flush()
+{
+  if (mData == 0)
+    return false;
+
+  if (msync(mData, mSize, MS_SYNC) == -1)
+    return false;
+
+  uint32_t  header[kHeader_Words] =
+            { kMirror_Magic, mSize, mBlock, mWrite_end, mSave_address };
+  string    temp_name = mFile_name + ".map.tmp";
+  FILE *    file      = fopen(temp_name.c_str(), "wb");
+  if (file == 0)
+    return false;
+
+  bool ok = (fwrite(header, sizeof(header), 1, file) == 1) &&
+            (fwrite(&mValid[0], mValid.size(), 1, file) == 1);
+  ok = (fclose(file) == 0) && ok;
+
+  if (ok)
+    ok = (rename(temp_name.c_str(), (mFile_name + ".map").c_str()) == 0);
+  if (ok == false)
+    remove(temp_name.c_str());
+
+  return ok;
+} // end flush()
+
+void
+GQFlashMirror::invalidate(uint32_t address, uint32_t length)
+{
+  if ((length == 0) || (address >= mSize))
+    return;
+
+  uint32_t last = address + length - 1;
+  if (last >= mSize)
+    last = mSize - 1;
+  for(uint32_t block=address / mBlock; block<=last / mBlock; block++)
+    setBlock(block, false);
+
+  return;
+} // end invalidate()
+
+bool
+GQFlashMirror::isValid(uint32_t address, uint32_t length)
+{
+  if (length == 0)
+    return true;
+  if ((address >= mSize) || (length > (mSize - address)))
+    return false;
+
+  for(uint32_t block=address / mBlock;
+      block<=(address + length - 1) / mBlock; block++)
+  {
+    if (blockValid(block) == false)
+      return false;
+  }
+
+  return true;
+} // end isValid()
+
+uint32_t
+GQFlashMirror::getValidBytes()
+{
+  uint32_t bytes = 0;
+
+  for(uint32_t block=0; block<mBlocks; block++)
+  {
+    if (blockValid(block))
+    {
+      uint32_t start = block * mBlock;
+      bytes += ((mSize - start) < mBlock) ? (mSize - start) : mBlock;
+    }
+  }
+
+  return bytes;
+} // end getValidBytes()
+
+bool
+GQFlashMirror::blockValid(uint32_t block)
+{
+  return ((mValid[block / 8] & (1 << (block % 8))) != 0);
+} // end blockValid()
+
+void
+GQFlashMirror::setBlock(uint32_t block, bool valid)
+{
+  if (valid)
+    mValid[block / 8] |= uint8_t(1 << (block % 8));
+  else
+    mValid[block / 8] &= uint8_t(~(1 << (block % 8)));
+  return;
+} // end setBlock()
+
+// loadMap takes the sidecar only if it describes a mirror of the same
+// size and block, otherwise everything stays missing.
+void
+GQFlashMirror::loadMap()
+{
+  FILE * file = fopen((mFile_name + ".map").c_str(), "rb");
+  if (file == 0)
+    return;
+
+  uint32_t              header[kHeader_Words];
+  std::vector<uint8_t>  valid(mValid.size());
+
+  if ((fread(header, sizeof(header), 1, file) == 1) &&
+      (fread(&valid[0], valid.size(), 1, file) == 1) &&
+      (header[0] == kMirror_Magic) && (header[1] == mSize) &&
+      (header[2] == mBlock))
+  {
+    mWrite_end    = header[3];
+    mSave_address = header[4];
+    mValid.swap(valid);
+  }
+
+  fclose(file);
+  return;
+} // end loadMap()
+
+// fetch reads the blocks straight into the mapping, with a SPIR per
+// block, pipelined by GQGMC::readHistory().
+bool
+GQFlashMirror::fetch(GQGMC * gmc, uint32_t first, uint32_t count)
+{
+  uint32_t address = first * mBlock;
+  uint32_t length  = count * mBlock;
+  if (length > (mSize - address))
+    length = mSize - address;
+
+  uint32_t good = gmc->readHistory(address, length, &mData[address], mBlock);
+  mFetched += good;
+
+  for(uint32_t block=first; (block - first) * mBlock < good; block++)
+  {
+    uint32_t block_end = (block + 1) * mBlock;
+    if ((block_end <= (address + good)) || ((address + good) == mSize))
+    {
+      setBlock(block, true);
+      mFresh[block] = true;
+    }
+  }
+
+  return (good == length);
+} // end fetch()
+
+bool
+GQFlashMirror::refetch(GQGMC * gmc, uint32_t block)
+{
+  if (mFresh[block])
+    return true;
+
+  return fetch(gmc, block, 1);
+} // end refetch()
+
+bool
+GQFlashMirror::fetchMissing(GQGMC * gmc)
+{
+  uint32_t block = 0;
+
+  while (block < mBlocks)
+  {
+    if (blockValid(block))
+    {
+      block++;
+      continue;
+    }
+
+    uint32_t count = 1;
+    while (((block + count) < mBlocks) && (count < kBatch_Blocks) &&
+           (blockValid(block + count) == false))
+      count++;
+
+    if (fetch(gmc, block, count) == false)
+      return false;
+    block += count;
+  }
+
+  return true;
+} // end fetchMissing()
+
+// followLog re-reads the block of the address, then scans the mapping
+// from the address on. Each block the scan enters is re-read before it
+// is looked at, in batches growing from one block to kBatch_Blocks, as
+// the log usually ends within the first. A batch stops short of a block
+// this update() has read already, which is scanned as it is.
+bool
+GQFlashMirror::followLog(GQGMC * gmc, uint32_t address, uint32_t & end)
+{
+  uint32_t offset  = address;
+  uint32_t run     = 0;
+  uint32_t batch   = 1;
+  uint32_t fresh   = 0;   // bytes from address on which have been re-read
+
+  for(uint32_t scanned=0; scanned<mSize; scanned++)
+  {
+    if (scanned >= fresh)
+    {
+      uint32_t block = offset / mBlock;
+      uint32_t count = 1;
+      if (mFresh[block] == false)
+      {
+        while ((count < batch) && ((block + count) < mBlocks) &&
+               (mFresh[block + count] == false))
+          count++;
+        if (fetch(gmc, block, count) == false)
+          return false;
+      }
+
+      uint32_t to = (block + count) * mBlock;
+      fresh = scanned + (((to < mSize) ? to : mSize) - offset);
+      if (batch < kBatch_Blocks)
+        batch *= 2;
+    }
+
+    if (mData[offset] == 0xff)
+      run++;
+    else
+      run = 0;
+    offset = (offset + 1) % mSize;
+
+    if (run == kErased_Run)
+    {
+      end = (offset + mSize - kErased_Run) % mSize;
+      return true;
+    }
+  }
+
+  // No erased area at all, which the GQ GMC never leaves.
+  end = address;
+  return true;
+} // end followLog()
+
+// end file gqmirror.cc
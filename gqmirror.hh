@@ -0,0 +1,183 @@
+// **************************************************************************
+// File: gqmirror.hh
+//
+// Description:
+//    Declare the GQFlashMirror class, a local copy of the history flash
+//    of a GQ GMC kept in a memory mapped file, which is brought up to
+//    date by reading only what is missing or has changed.
+//
+// FLASH MIRROR OVERVIEW
+//
+// The mirror is a file as large as the history flash (see
+// GQGMC::getFlashSize()), mapped into memory, so that the whole flash
+// can be looked at, or decoded with GQHistoryDecoder (gqhistory.hh),
+// in place and at once, and is there again in the next session. History
+// reads by update() land in the mapping itself.
+//
+// Next to it, a sidecar file with the suffix ".map" records which blocks
+// of kHistory_Data_Maxsize bytes, the size of a flash sector, have been
+// read in full, and where the GQ GMC was writing at the last update, the
+// write end. A block which has never been read, or has been invalidated,
+// is missing.
+//
+// The GQ GMC writes its flash from the write end on and erases the
+// sector after the one it is writing, see GQHistorySync (gqsync.hh). So
+// update() needs to read
+//
+//   1. the missing blocks, in pipelined batches, which is the whole
+//      flash the first time;
+//   2. the block of the last write end and every block after it, up to
+//      the first kErased_Run bytes of 0xFF, which is the new write end.
+//      If the DataSaveAddress has moved elsewhere, eg, the log was
+//      reset, this is done from the new DataSaveAddress as well;
+//   3. the block after the new write end, which the GQ GMC has erased.
+//
+// A block is read at most once per update(), so the first update, which
+// reads the whole flash in step 1, reads nothing more in steps 2 and 3.
+// Everything else is known not to have changed. The sidecar is written
+// after the mapping is synced, so that a block is never recorded as
+// read while its data is not yet in the file.
+//
+// SIDECAR FORMAT
+//
+// The sidecar is a header of five 32 bit words in host byte order,
+// the magic kMirror_Magic, the flash size, the block size, the write
+// end and the DataSaveAddress seen then (kMirror_No_Address if unknown),
+// followed by a bitmap with one bit per block, least significant bit
+// first. It is replaced whole on every flush().
+//
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+
+#ifndef gqmirror_hh_
+#define gqmirror_hh_
+
+namespace GQLLC
+{
+
+  // The write end or DataSaveAddress of a mirror which does not know it.
+  uint32_t const kMirror_No_Address = 0xffffffff;
+
+  // FLASH MIRROR
+  //
+  // The class declaration - see gqmirror.cc for documentation
+  class GQFlashMirror
+  {
+    public:
+
+    GQFlashMirror();
+
+    ~GQFlashMirror();
+
+    // Method to open the mirror file, creating it if need be, sized to
+    // flash_size bytes, and its sidecar. A mirror of another size is
+    // resized and counts as all missing. Returns false if the file
+    // cannot be opened or mapped; errno tells why.
+    bool
+    open(const std::string & file_name, uint32_t flash_size);
+
+    // Method to flush and unmap the mirror.
+    void
+    close();
+
+    // Method to bring the mirror up to date with the GQ GMC, see above.
+    // Returns false if the GQ GMC failed part way; what was read so far
+    // is kept.
+    bool
+    update(GQGMC * gmc);
+
+    // Method to sync the mapping and write the sidecar.
+    bool
+    flush();
+
+    // Method to mark the blocks overlapping a range as missing.
+    void
+    invalidate(uint32_t address, uint32_t length);
+
+    // Method to tell whether every block overlapping a range is valid.
+    bool
+    isValid(uint32_t address, uint32_t length);
+
+    // Method to get the mapping, getSize() bytes, valid while open.
+    const uint8_t *
+    getData()
+    {
+      return mData;
+    };
+
+    uint32_t
+    getSize()
+    {
+      return mSize;
+    };
+
+    // Method to get the number of bytes in valid blocks.
+    uint32_t
+    getValidBytes();
+
+    // Method to get the number of bytes read by the last update().
+    uint32_t
+    getFetchedBytes()
+    {
+      return mFetched;
+    };
+
+    // Method to get the write end, kMirror_No_Address if unknown.
+    uint32_t
+    getWriteEnd()
+    {
+      return mWrite_end;
+    };
+
+    private:
+
+    std::string           mFile_name;
+    int                   mFd;
+    uint8_t *             mData;
+    uint32_t              mSize;
+    uint32_t              mBlock;
+    uint32_t              mBlocks;
+    std::vector<uint8_t>  mValid;        // the bitmap
+    std::vector<bool>     mFresh;        // blocks read by this update()
+    uint32_t              mWrite_end;
+    uint32_t              mSave_address;
+    uint32_t              mFetched;
+
+    bool
+    blockValid(uint32_t block);
+
+    void
+    setBlock(uint32_t block, bool valid);
+
+    // Read the sidecar, if there is one of the same geometry.
+    void
+    loadMap();
+
+    // Read count blocks from first on into the mapping, and mark those
+    // read in full valid and fresh. Returns false on failure.
+    bool
+    fetch(GQGMC * gmc, uint32_t first, uint32_t count);
+
+    // Read the block, unless this update() has read it already.
+    bool
+    refetch(GQGMC * gmc, uint32_t block);
+
+    // Read all missing blocks.
+    bool
+    fetchMissing(GQGMC * gmc);
+
+    // Read on from the address, block after block, to the erased area.
+    // Returns false on failure, otherwise the new write end in end.
+    bool
+    followLog(GQGMC * gmc, uint32_t address, uint32_t & end);
+
+  }; // end class GQFlashMirror
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqmirror.cc
+#endif  // gqmirror_hh_
@@ -0,0 +1,195 @@
+// **************************************************************************
+// File: gqmodel.cc
+//
+// Synopsis:
+//   Define the GQModelRegistry class, the table of what each model and
+//   firmware revision of GQ GMC can do.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqmodel.hh
+//
+// To support a new model, add its rows to kModels. The table is small
+// and looked up once per connection, so it is simply searched in full.
+//
+//
+// C++ includes
+#include <string>
+using namespace std;
+
+// Linux C includes
+#include <stdlib.h>
+#include <string.h>
+
+// These are GQ GMC project specific includes
+#include "gqmodel.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The command sets of GQ-RFC1201, by the firmware revision which added
+// them to the GMC-280 and GMC-300.
+static
+uint32_t
+const          kCmds_Re200 = (1u << eCmd_Version) | (1u << eCmd_CPM) |
+                             (1u << eCmd_CPS) | (1u << eCmd_Voltage) |
+                             (1u << eCmd_Key);
+
+static
+uint32_t
+const          kCmds_Re210 = kCmds_Re200 | (1u << eCmd_Heartbeat) |
+                             (1u << eCmd_Get_Config) |
+                             (1u << eCmd_Erase_Config) |
+                             (1u << eCmd_Write_Config);
+
+static
+uint32_t
+const          kCmds_Re211 = kCmds_Re210 | (1u << eCmd_Serial) |
+                             (1u << eCmd_Power_Off);
+
+static
+uint32_t
+const          kCmds_Re220 = kCmds_Re211 | (1u << eCmd_Update_Config);
+
+static
+uint32_t
+const          kCmds_All   = (1u << eMax_Command) - 1;
+
+// The SPIR of the GMC-300 reads from its history flash, the GMC-280 has
+// none.
+static
+uint32_t
+const          kCmds_Flash = 1u << eCmd_History;
+
+static
+uint32_t
+const          kFlash_64K = 0x10000;
+
+static
+uint32_t
+const          kFlash_1M  = 0x100000;
+
+// GQ-RFC1201: the length normally not exceed 4096 bytes in each request.
+static
+uint32_t
+const          kChunk_4K  = 0x1000;
+
+// The rows, see gqmodel.hh. The GMC-300E and GMC-300E Plus report
+// themselves as GMC-300 with firmware 3 and 4.
+static
+gmc_model_t
+const          kModels[] =
+{
+  { "GMC-280", 0.00f, 0,          kChunk_4K,  57600, kCmds_Re200 },
+  { "GMC-280", 2.10f, 0,          kChunk_4K,  57600, kCmds_Re210 },
+  { "GMC-280", 2.11f, 0,          kChunk_4K,  57600, kCmds_Re211 },
+  { "GMC-280", 2.20f, 0,          kChunk_4K,  57600, kCmds_Re220 },
+  { "GMC-280", 2.23f, 0,          kChunk_4K,  57600,
+    kCmds_All & ~kCmds_Flash },
+
+  { "GMC-300", 0.00f, kFlash_64K, kChunk_4K,  57600,
+    kCmds_Re200 | kCmds_Flash },
+  { "GMC-300", 2.10f, kFlash_64K, kChunk_4K,  57600,
+    kCmds_Re210 | kCmds_Flash },
+  { "GMC-300", 2.11f, kFlash_64K, kChunk_4K,  57600,
+    kCmds_Re211 | kCmds_Flash },
+  { "GMC-300", 2.20f, kFlash_64K, kChunk_4K,  57600,
+    kCmds_Re220 | kCmds_Flash },
+  { "GMC-300", 2.23f, kFlash_64K, kChunk_4K,  57600, kCmds_All },
+
+  { "GMC-320", 0.00f, kFlash_1M,  kChunk_4K, 115200, kCmds_All },
+  { "GMC-500", 0.00f, kFlash_1M,  kChunk_4K, 115200, kCmds_All },
+  { "GMC-600", 0.00f, kFlash_1M,  kChunk_4K, 115200, kCmds_All },
+};
+
+static
+uint32_t
+const          kModel_Count = sizeof(kModels) / sizeof(gmc_model_t);
+
+// The row of an unknown GQ GMC.
+static
+gmc_model_t
+const          kDefault_Model =
+  { "", 0.00f, kFlash_64K, kChunk_4K, 57600, kCmds_All };
+
+
+// lookup keeps the best row so far: the longer model prefix wins, and
+// among rows of the same model, the highest revision not above the
+// firmware.
+const gmc_model_t &
+GQModelRegistry::lookup(const string & version)
+{
+  float                revision = parseRevision(version);
+  const gmc_model_t *  best     = 0;
+
+  for(uint32_t i=0; i<kModel_Count; i++)
+  {
+    const gmc_model_t & row = kModels[i];
+    size_t              len = strlen(row.model);
+
+    if ((version.compare(0, len, row.model) != 0) ||
+        (row.min_firmware > revision))
+      continue;
+
+    if ((best == 0) || (len > strlen(best->model)) ||
+        ((len == strlen(best->model)) &&
+         (row.min_firmware > best->min_firmware)))
+      best = &row;
+  }
+
+  return (best != 0) ? *best : kDefault_Model;
+} // end lookup()
+
+const gmc_model_t &
+GQModelRegistry::getDefault()
+{
+  return kDefault_Model;
+} // end getDefault()
+
+// parseRevision reads the number after the "Re", which the GMC-300E
+// Plus writes as "RE", and which may be followed by a space, eg,
+// "GMC-300Re 4.20" or "GMC-500+Re 1.18".
+float
+GQModelRegistry::parseRevision(const string & version)
+{
+  for(size_t i=0; (i+1)<version.size(); i++)
+  {
+    if ((version[i] == 'R') && ((version[i+1] == 'e') || (version[i+1] == 'E')))
+      return float(atof(version.c_str() + i + 2));
+  }
+  return 0.0f;
+} // end parseRevision()
+
+bool
+GQModelRegistry::supports(const gmc_model_t & model,
+                          enum gmc_command_t command)
+{
+  return ((model.commands & (1u << command)) != 0);
+} // end supports()
+
+// isComplete ignores SPIR for a model without flash.
+bool
+GQModelRegistry::isComplete(const gmc_model_t & model)
+{
+  uint32_t wanted = (model.flash_size > 0) ? kCmds_All
+                                           : (kCmds_All & ~kCmds_Flash);
+  return ((model.commands & wanted) == wanted);
+} // end isComplete()
+
+uint32_t
+GQModelRegistry::getFactoryBauds(uint32_t * rates, uint32_t max)
+{
+  uint32_t count = 0;
+
+  for(uint32_t i=0; (i<kModel_Count) && (count<max); i++)
+  {
+    bool seen = false;
+    for(uint32_t j=0; j<count; j++)
+      if (rates[j] == kModels[i].baud)
+        seen = true;
+    if (seen == false)
+      rates[count++] = kModels[i].baud;
+  }
+
+  return count;
+} // end getFactoryBauds()
+
+// end file gqmodel.cc
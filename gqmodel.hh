@@ -0,0 +1,122 @@
+// **************************************************************************
+// File: gqmodel.hh
+//
+// Description:
+//    Declare the GQModelRegistry class, the table of what each model and
+//    firmware revision of GQ GMC can do.
+//
+// MODEL CAPABILITIES OVERVIEW
+//
+// The GQ GMC family has grown since the GMC-300: the GMC-320, GMC-500
+// and GMC-600 have 1M bytes of history flash rather than 64K, run at
+// 115200 baud from the factory, and support every command, while the
+// early firmware of the GMC-280 and GMC-300 supports only some of them.
+// A command which the GQ GMC does not know is not answered at all, so it
+// fails only after the full reply timeout.
+//
+// The registry holds a row per model and firmware revision from which
+// the row applies, giving the size of the history flash, the largest
+// SPIR request, the factory baud rate and the commands supported. The
+// row is looked up by the GETVER reply, eg, "GMC-300Re 4.20", which is
+// the model name followed by "Re" and the firmware revision. The row
+// whose model is the longest prefix of the name and whose revision is
+// the highest not above the firmware applies. A GQ GMC which matches no
+// row is taken to be a 64K byte model which supports every command, as
+// all GQ GMCs were taken to be before the registry.
+//
+// GQGMC looks its GQ GMC up when the link opens, and refuses at once a
+// command which the row does not list, with eUnsupported_command.
+//
+// The commands of the GMC-280 and GMC-300 rows are the "Firmware
+// supported" entries of GQ-RFC1201. GETCPS, which GQ-RFC1201 does not
+// list, is taken to be supported wherever GETCPM is.
+//
+#include <string>
+
+#include <stdint.h>
+
+#ifndef gqmodel_hh_
+#define gqmodel_hh_
+
+namespace GQLLC
+{
+
+  // The commands, or groups of commands, a model may support.
+  enum gmc_command_t
+  {
+    eCmd_Version,        // GETVER
+    eCmd_Serial,         // GETSERIAL
+    eCmd_CPM,            // GETCPM
+    eCmd_CPS,            // GETCPS
+    eCmd_Voltage,        // GETVOLT
+    eCmd_Heartbeat,      // HEARTBEAT1, HEARTBEAT0
+    eCmd_History,        // SPIR
+    eCmd_Get_Config,     // GETCFG
+    eCmd_Erase_Config,   // ECFG
+    eCmd_Write_Config,   // WCFG
+    eCmd_Update_Config,  // CFGUPDATE
+    eCmd_Key,            // KEY
+    eCmd_Power_Off,      // POWEROFF
+    eCmd_Set_Clock,      // SETDATEYY and the others
+    eMax_Command
+  };
+
+  // The capabilities of a model from a firmware revision on.
+  struct gmc_model_t
+  {
+    const char *  model;         // prefix of the GETVER reply
+    float         min_firmware;  // the row applies from this revision
+    uint32_t      flash_size;    // bytes of history flash
+    uint32_t      max_chunk;     // largest SPIR request, in bytes
+    uint32_t      baud;          // factory baud rate
+    uint32_t      commands;      // bit (1 << gmc_command_t) per command
+  };
+
+
+  // MODEL REGISTRY
+  //
+  // The class declaration - see gqmodel.cc for documentation
+  class GQModelRegistry
+  {
+    public:
+
+    // Method to find the row of the GQ GMC with this GETVER reply.
+    static
+    const gmc_model_t &
+    lookup(const std::string & version);
+
+    // Method to get the row for a GQ GMC not yet identified, or of no
+    // known model.
+    static
+    const gmc_model_t &
+    getDefault();
+
+    // Method to get the firmware revision from a GETVER reply, 0.0 if
+    // it has none.
+    static
+    float
+    parseRevision(const std::string & version);
+
+    // Method to tell whether a row supports the command.
+    static
+    bool
+    supports(const gmc_model_t & model, enum gmc_command_t command);
+
+    // Method to tell whether a row supports every command, that is,
+    // whether the firmware is not an older one.
+    static
+    bool
+    isComplete(const gmc_model_t & model);
+
+    // Method to get the distinct factory baud rates of the rows, in
+    // table order. Returns how many were stored in rates, at most max.
+    static
+    uint32_t
+    getFactoryBauds(uint32_t * rates, uint32_t max);
+
+  }; // end class GQModelRegistry
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqmodel.cc
+#endif  // gqmodel_hh_
@@ -0,0 +1,285 @@
+// **************************************************************************
+// File: gqparallel.cc
+//
+// Synopsis:
+//   Define the GQParallelDecoder class, which decodes a whole image of
+//   GQ GMC history data on all processors at once.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqparallel.hh
+//
+// The workers take the segments in order from a shared index, and the
+// calling thread waits for each in turn to be done before handing it
+// back. A segment is never looked at by two threads at once: a worker
+// has it until it is marked done, under mLock, and the calling thread
+// after that.
+//
+//
+// C++ includes
+#include <string>
+#include <vector>
+using namespace std;
+
+// Linux C includes
+#include <unistd.h>
+
+// These are GQ GMC project specific includes
+#include "gqparallel.hh"
+#include "gqscan.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The image is split into about this many segments per thread, so that
+// a thread which is given the denser segments does not hold up the rest.
+static
+uint32_t
+const          kSegments_Per_Thread = 8;
+
+// Bounds of the size of a segment. A segment smaller than a flash sector
+// costs more to hand around than it takes to decode.
+static
+uint32_t
+const          kMin_Segment = 0x4000;
+
+static
+uint32_t
+const          kMax_Segment = 0x100000;
+
+// How many segments per thread the workers may run ahead of the one
+// being handed back.
+static
+uint32_t
+const          kSegments_Ahead = 4;
+
+// Length of a date/timestamp record, and the offset of its closing 55AA.
+static
+uint32_t
+const          kTimestamp_Length = 12;
+
+static
+uint32_t
+const          kTimestamp_Close = 9;
+
+
+// GQPARALLELDECODER CLASS CONSTRUCTOR
+GQParallelDecoder::GQParallelDecoder(GQHistorySegmentSink * sink,
+                                     uint32_t threads)
+  : mSink(sink), mThreads(threads), mData(0), mAddress(0), mNext(0),
+    mNext_merge(0), mRedecoded(0), mBad_records(0)
+{
+  if (mThreads == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    mThreads = (online > 0) ? uint32_t(online) : 1;
+  }
+
+  pthread_mutex_init(&mLock, 0);
+  pthread_cond_init(&mDecoded, 0);
+  pthread_cond_init(&mMerged, 0);
+} // end GQParallelDecoder constructor
+
+GQParallelDecoder::~GQParallelDecoder()
+{
+  pthread_cond_destroy(&mMerged);
+  pthread_cond_destroy(&mDecoded);
+  pthread_mutex_destroy(&mLock);
+} // end GQParallelDecoder destructor
+
+// decode starts no more workers than there are segments. If only some
+// of them start, those do all the work.
+bool
+GQParallelDecoder::decode(const uint8_t * data, uint32_t length,
+                          uint32_t address)
+{
+  mData        = data;
+  mAddress     = address;
+  mNext        = 0;
+  mNext_merge  = 0;
+  mRedecoded   = 0;
+  mBad_records = 0;
+  split(length);
+
+  uint32_t workers = mThreads;
+  if (workers > mSegments.size())
+    workers = uint32_t(mSegments.size());
+
+  vector<pthread_t> threads;
+  for(uint32_t i=0; i<workers; i++)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, workerMain, this) == 0)
+      threads.push_back(thread);
+  }
+  if (threads.empty())
+    return false;
+
+  mergeSegments();
+
+  for(uint32_t i=0; i<threads.size(); i++)
+    pthread_join(threads[i], 0);
+
+  return true;
+} // end decode()
+
+// split cuts the image before the first well formed date/timestamp at
+// least a target size after the previous cut. An image without any is
+// one segment.
+void
+GQParallelDecoder::split(uint32_t length)
+{
+  GQMarkerScanner   scanner;
+  vector<uint32_t>  stamps;
+  scanner.scan(mData, length, stamps, kMarker_Timestamp);
+
+  uint32_t target = length / (mThreads * kSegments_Per_Thread);
+  if (target < kMin_Segment)
+    target = kMin_Segment;
+  if (target > kMax_Segment)
+    target = kMax_Segment;
+
+  segment_t segment;
+  segment.listener = 0;
+  segment.decoder  = 0;
+  segment.clean    = false;
+  segment.done     = false;
+  segment.offset   = 0;
+
+  mSegments.clear();
+  for(uint32_t i=0; i<stamps.size(); i++)
+  {
+    uint32_t offset = stamps[i];
+    if (((offset + kTimestamp_Length) > length) ||
+        (mData[offset + kTimestamp_Close] != 0x55) ||
+        (mData[offset + kTimestamp_Close + 1] != 0xAA) ||
+        ((offset - segment.offset) < target))
+      continue;
+
+    segment.length = offset - segment.offset;
+    mSegments.push_back(segment);
+    segment.offset = offset;
+  }
+  segment.length = length - segment.offset;
+  mSegments.push_back(segment);
+
+  return;
+} // end split()
+
+void *
+GQParallelDecoder::workerMain(void * self)
+{
+  static_cast<GQParallelDecoder *>(self)->workLoop();
+  return 0;
+} // end workerMain()
+
+void
+GQParallelDecoder::workLoop()
+{
+  uint32_t count = uint32_t(mSegments.size());
+  uint32_t ahead = mThreads * kSegments_Ahead;
+
+  pthread_mutex_lock(&mLock);
+  while (mNext < count)
+  {
+    if (mNext >= (mNext_merge + ahead))
+    {
+      pthread_cond_wait(&mMerged, &mLock);
+      continue;
+    }
+
+    uint32_t index = mNext++;
+    pthread_mutex_unlock(&mLock);
+    decodeSegment(index);
+    pthread_mutex_lock(&mLock);
+
+    mSegments[index].done = true;
+    pthread_cond_broadcast(&mDecoded);
+  }
+  pthread_mutex_unlock(&mLock);
+
+  return;
+} // end workLoop()
+
+// decodeSegment leaves the decoder of a segment which ended within a
+// record alive, for mergeSegments() to decode on with. The last segment
+// ends the data, so its decoder is finished, as a serial one would be.
+// So is that of a segment which ended between records, to pass on the
+// 0xFF bytes it holds: the next segment starts with the 55 of its
+// timestamp, which would end an erased run in a serial decode too.
+void
+GQParallelDecoder::decodeSegment(uint32_t index)
+{
+  segment_t & segment = mSegments[index];
+  uint32_t    address = mAddress + segment.offset;
+
+  segment.listener = mSink->openSegment(address);
+  segment.decoder  = new GQHistoryDecoder(segment.listener);
+  segment.decoder->reset(address);
+  segment.decoder->decode(&mData[segment.offset], segment.length);
+  segment.clean    = segment.decoder->isBetweenRecords();
+
+  if ((index + 1) == mSegments.size())
+    segment.clean = true;
+  if (segment.clean)
+    segment.decoder->finish();
+
+  return;
+} // end decodeSegment()
+
+// mergeSegments carries the decoder of a segment which did not end
+// cleanly on through the segments after it, whose own decoding is
+// dropped, until one ends between records.
+void
+GQParallelDecoder::mergeSegments()
+{
+  uint32_t     count = uint32_t(mSegments.size());
+  segment_t *  carry = 0;
+
+  for(uint32_t index=0; index<count; index++)
+  {
+    pthread_mutex_lock(&mLock);
+    while (mSegments[index].done == false)
+      pthread_cond_wait(&mDecoded, &mLock);
+    pthread_mutex_unlock(&mLock);
+
+    segment_t & segment = mSegments[index];
+    bool        last    = ((index + 1) == count);
+
+    if (carry != 0)
+    {
+      mSink->closeSegment(segment.listener, false);
+      delete segment.decoder;
+      segment.decoder = 0;
+
+      carry->decoder->decode(&mData[segment.offset], segment.length);
+      mRedecoded++;
+
+      if (last || carry->decoder->isBetweenRecords())
+      {
+        carry->decoder->finish();
+        mBad_records += carry->decoder->getBadRecordCount();
+        mSink->closeSegment(carry->listener, true);
+        delete carry->decoder;
+        carry->decoder = 0;
+        carry = 0;
+      }
+    }
+    else if (segment.clean)
+    {
+      mBad_records += segment.decoder->getBadRecordCount();
+      mSink->closeSegment(segment.listener, true);
+      delete segment.decoder;
+      segment.decoder = 0;
+    }
+    else
+      carry = &segment;
+
+    pthread_mutex_lock(&mLock);
+    mNext_merge = index + 1;
+    pthread_cond_broadcast(&mMerged);
+    pthread_mutex_unlock(&mLock);
+  }
+
+  return;
+} // end mergeSegments()
+
+// end file gqparallel.cc
@@ -0,0 +1,184 @@
+// **************************************************************************
+// File: gqparallel.hh
+//
+// Description:
+//    Declare the GQParallelDecoder class, which decodes a whole image of
+//    GQ GMC history data, eg, a dump or an archive of them, on all
+//    processors at once.
+//
+// PARALLEL DECODING OVERVIEW
+//
+// GQHistoryDecoder (gqhistory.hh) must see the history data in order,
+// since whether a byte is a sample or part of a 55AA record depends on
+// what came before. A date/timestamp, 55AA00YYMMDDhhmmss55AADD, is where
+// the data synchronizes again: it starts a logging run, setting the save
+// data type and the time from which the samples after it are counted,
+// and a decoder which starts afresh on it decodes from there on exactly
+// as one which has been decoding all along.
+//
+// So GQParallelDecoder splits the image into segments at date/timestamps,
+// found with GQMarkerScanner (gqscan.hh), of roughly equal size, and
+// decodes the segments on a pool of threads, each with a decoder and a
+// listener of its own. The listeners are made by a GQHistorySegmentSink,
+// and handed back to it in address order on the calling thread, eg, to
+// write out what each has gathered. Since each segment but the first
+// begins with its timestamp, the time of every sample can be counted on
+// within its segment, and comes out as if decoded in one go.
+//
+// The one exception is a segment whose last record runs on across the
+// timestamp after it, eg, a note whose text holds the bytes 55AA00, or
+// two byte sample whose data is a 55. Serial decoding would never see
+// that timestamp, so the next segment is dropped and its data decoded
+// on by the decoder of the segment before, on the calling thread, until
+// the end of a segment finds it between records.
+//
+// Workers run at most a few segments ahead of the one being handed
+// back, so the memory held by the listeners stays bounded however large
+// the image is.
+//
+#include <vector>
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "gqhistory.hh"
+
+#ifndef gqparallel_hh_
+#define gqparallel_hh_
+
+namespace GQLLC
+{
+
+  // HISTORY SEGMENT SINK
+  //
+  // Abstract class of the receiver of the segments of a parallel decode.
+  class GQHistorySegmentSink
+  {
+    public:
+
+    virtual
+    ~GQHistorySegmentSink()
+    {
+    };
+
+    // Make the listener of the segment starting at the flash address.
+    // Called on the worker threads, several at a time.
+    virtual
+    GQHistoryListener *
+    openSegment(uint32_t address) = 0;
+
+    // A listener is done with, in address order, on the calling thread.
+    // Its records are to be kept if keep is true, and discarded if not,
+    // as their segment was decoded again by the segment before.
+    virtual
+    void
+    closeSegment(GQHistoryListener * listener, bool keep) = 0;
+
+  }; // end class GQHistorySegmentSink
+
+
+  // PARALLEL DECODER
+  //
+  // The class declaration - see gqparallel.cc for documentation
+  class GQParallelDecoder
+  {
+    public:
+
+    // The sink is owned by the caller and must outlive the decoder. With
+    // threads 0, there is a thread per processor online.
+    GQParallelDecoder(GQHistorySegmentSink * sink, uint32_t threads = 0);
+
+    ~GQParallelDecoder();
+
+    // Method to decode length bytes of history data from the flash
+    // address given. Returns false if no thread could be started, in
+    // which case nothing was decoded.
+    bool
+    decode(const uint8_t * data, uint32_t length, uint32_t address = 0);
+
+    // Method to get the number of threads decoding.
+    uint32_t
+    getThreadCount()
+    {
+      return mThreads;
+    };
+
+    // Method to get the number of segments of the last decode.
+    uint32_t
+    getSegmentCount()
+    {
+      return uint32_t(mSegments.size());
+    };
+
+    // Method to get the number of segments of the last decode which were
+    // decoded again, on the calling thread.
+    uint32_t
+    getRedecodedCount()
+    {
+      return mRedecoded;
+    };
+
+    // Method to get the number of bad records of the last decode.
+    uint32_t
+    getBadRecordCount()
+    {
+      return mBad_records;
+    };
+
+    private:
+
+    // A segment of the image, and the state of its decoding.
+    struct segment_t
+    {
+      uint32_t              offset;     // in the image
+      uint32_t              length;
+      GQHistoryListener *   listener;
+      GQHistoryDecoder *    decoder;
+      bool                  clean;      // ended between records
+      bool                  done;
+    };
+
+    GQHistorySegmentSink *  mSink;
+    uint32_t                mThreads;
+
+    // The image being decoded.
+    const uint8_t *         mData;
+    uint32_t                mAddress;
+    std::vector<segment_t>  mSegments;
+
+    // The next segment to decode and the next to hand back, under mLock.
+    pthread_mutex_t         mLock;
+    pthread_cond_t          mDecoded;   // a segment is done
+    pthread_cond_t          mMerged;    // a segment was handed back
+    uint32_t                mNext;
+    uint32_t                mNext_merge;
+
+    uint32_t                mRedecoded;
+    uint32_t                mBad_records;
+
+    // Split the image into segments at its date/timestamps.
+    void
+    split(uint32_t length);
+
+    // The worker threads.
+    static
+    void *
+    workerMain(void * self);
+
+    void
+    workLoop();
+
+    // Decode a segment on a worker thread.
+    void
+    decodeSegment(uint32_t index);
+
+    // Hand the segments back in order, as they are done.
+    void
+    mergeSegments();
+
+  }; // end class GQParallelDecoder
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqparallel.cc
+#endif  // gqparallel_hh_
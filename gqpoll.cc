@@ -0,0 +1,363 @@
+// **************************************************************************
+// File: gqpoll.cc
+//
+// Synopsis:
+//   Define the GQPollScheduler class, which runs a set of periodic
+//   queries of one GQ GMC by priority and deadline over its single
+//   serial link.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqpoll.hh
+//
+//
+// C++ includes
+#include <string>
+using namespace std;
+
+// Linux C includes
+#include <errno.h>
+#include <time.h>
+
+// These are GQ GMC project specific includes
+#include "gqpoll.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The exchange time assumed for a query which has not run yet is that
+// of its command and reply bytes at 57600 baud, 10 bits per byte, plus
+// a fixed allowance for the USB-serial adapter and the GQ GMC. The first
+// run replaces it.
+static
+int64_t
+const          kByte_Time_us    = 174;
+static
+int64_t
+const          kLatency_us      = 5000;
+
+// The moving average of the exchange time takes 1/kCost_Weight of each
+// new measurement, so it follows a change of the link within a few runs
+// while a single slow exchange does not throw it.
+static
+int64_t
+const          kCost_Weight = 4;
+
+// Margin kept before the deadline of a more urgent query, for the jitter
+// of the exchange and the wakeup.
+static
+int64_t
+const          kGuard_us = 2000;
+
+// How long step() sleeps with no queries at all.
+static
+int64_t
+const          kIdle_Wait_us = 1000000;
+
+// LOCAL UTILITIES
+//
+// Estimate the exchange time of a query which has not run yet.
+static
+int64_t
+initial_cost(poll_query_t query)
+{
+  int64_t bytes = 10;  // the command, eg, "<GETCPM>>"
+
+  switch (query)
+  {
+    case eQuery_CPM:     bytes += 2;   break;
+    case eQuery_CPS:     bytes += 2;   break;
+    case eQuery_Voltage: bytes += 1;   break;
+    case eQuery_Serial:  bytes += 7;   break;
+    case eQuery_Version: bytes += 14;  break;
+    case eQuery_Config:  bytes += 256; break;
+  }
+
+  return bytes * kByte_Time_us + kLatency_us;
+}
+
+// Read a clock in microseconds.
+static
+int64_t
+clock_us(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// GQPOLLSCHEDULER CLASS CONSTRUCTOR
+GQPollScheduler::GQPollScheduler(GQGMC * gmc, GQPollListener * listener)
+  : mGMC(gmc), mListener(listener), mMetrics_start_us(0), mBusy_us(0),
+    mExchanges(0)
+{
+  start();
+} // end GQPollScheduler constructor
+
+uint32_t
+GQPollScheduler::addQuery(poll_query_t query, uint32_t period_ms,
+                          uint32_t priority)
+{
+  query_t  entry = query_t();
+
+  entry.query         = query;
+  entry.priority      = priority;
+  entry.period_us     = int64_t((period_ms > 0) ? period_ms : 1) * 1000;
+  entry.due_us        = clock_us(CLOCK_MONOTONIC);
+  entry.deferred      = false;
+  entry.measured      = false;
+  entry.stats.cost_us = initial_cost(query);
+
+  mQueries.push_back(entry);
+  return mQueries.size() - 1;
+} // end addQuery()
+
+void
+GQPollScheduler::start()
+{
+  int64_t now_us = clock_us(CLOCK_MONOTONIC);
+
+  for(uint32_t i=0; i<mQueries.size(); i++)
+  {
+    mQueries[i].due_us   = now_us;
+    mQueries[i].deferred = false;
+  }
+  resetMetrics();
+  return;
+} // end start()
+
+// step runs queries for as long as one is runnable, re-reading the clock
+// after each since every exchange takes time. A due query left over has
+// had to give way to a more urgent one and is counted as deferred, once
+// per deadline. It waits for the free time after that more urgent query
+// has run, so the next wakeup is the earliest deadline still ahead.
+int
+GQPollScheduler::step()
+{
+  int      ran    = 0;
+  int64_t  now_us = clock_us(CLOCK_MONOTONIC);
+
+  if (mGMC->isLinkLost() == false)
+  {
+    int next;
+    while ((next = nextRunnable(now_us)) >= 0)
+    {
+      run(mQueries[next], now_us);
+      ran++;
+      now_us = clock_us(CLOCK_MONOTONIC);
+      if (mGMC->isLinkLost())
+        break;
+    }
+  }
+
+  int64_t wake_us = now_us + kIdle_Wait_us;
+  for(uint32_t i=0; i<mQueries.size(); i++)
+  {
+    query_t & query = mQueries[i];
+
+    if (query.due_us <= now_us)
+    {
+      if ((query.deferred == false) && (mGMC->isLinkLost() == false))
+      {
+        query.deferred = true;
+        query.stats.deferrals++;
+      }
+    }
+    else if (query.due_us < wake_us)
+      wake_us = query.due_us;
+  }
+
+  // With the link lost every query is overdue, so poll the link again
+  // after the most urgent period.
+  if (mGMC->isLinkLost())
+  {
+    for(uint32_t i=0; i<mQueries.size(); i++)
+      if ((now_us + mQueries[i].period_us) < wake_us)
+        wake_us = now_us + mQueries[i].period_us;
+  }
+
+  struct timespec wake;
+  wake.tv_sec  = time_t(wake_us / 1000000);
+  wake.tv_nsec = long(wake_us % 1000000) * 1000;
+
+  // A signal cuts the sleep short, so that the caller can stop. The
+  // queries run are still reported as such.
+  if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, 0) == EINTR)
+    return (ran > 0) ? ran : -1;
+
+  return ran;
+} // end step()
+
+// nextRunnable applies the rule of gqpoll.hh. The horizon of a query is
+// the earliest deadline of the queries more urgent than it, and it must
+// finish, by its estimate, a guard time before that. The most urgent
+// queries have no horizon and always run when due. Among the runnable
+// queries, the most urgent goes first, and the most overdue of equally
+// urgent ones.
+int
+GQPollScheduler::nextRunnable(int64_t now_us)
+{
+  int best = -1;
+
+  for(uint32_t i=0; i<mQueries.size(); i++)
+  {
+    query_t & query = mQueries[i];
+
+    if (query.due_us > now_us)
+      continue;
+
+    if (best >= 0)
+    {
+      query_t & other = mQueries[best];
+      if (query.priority > other.priority)
+        continue;
+      if ((query.priority == other.priority) &&
+          (query.due_us >= other.due_us))
+        continue;
+    }
+
+    bool fits = true;
+    for(uint32_t j=0; j<mQueries.size(); j++)
+    {
+      if (mQueries[j].priority >= query.priority)
+        continue;
+      if ((now_us + query.stats.cost_us + kGuard_us) > mQueries[j].due_us)
+      {
+        fits = false;
+        break;
+      }
+    }
+
+    if (fits)
+      best = int(i);
+  }
+
+  return best;
+} // end nextRunnable()
+
+// run issues the command of the query and hands the result to the
+// listener. The exchange is timed from just before the command to just
+// after the reply, and the time spent in the listener is not counted.
+// The deadline moves on by one period, and on past any which have
+// already passed, like GQPeriodicTimer::wait().
+void
+GQPollScheduler::run(query_t & query, int64_t now_us)
+{
+  poll_result_t  result;
+
+  result.id      = uint32_t(&query - &mQueries[0]);
+  result.query   = query.query;
+  result.count   = 0;
+  result.voltage = 0.0f;
+  result.late_us = now_us - query.due_us;
+  clock_gettime(CLOCK_REALTIME, &result.when);
+
+  int64_t start_us = clock_us(CLOCK_MONOTONIC);
+
+  switch (query.query)
+  {
+    case eQuery_CPM:
+      result.count = mGMC->getCPM();
+      break;
+
+    case eQuery_CPS:
+      result.count = mGMC->getCPS();
+      break;
+
+    case eQuery_Voltage:
+      result.voltage = mGMC->getBatteryVoltage();
+      break;
+
+    case eQuery_Serial:
+      result.text = mGMC->getSerialNumber();
+      break;
+
+    case eQuery_Version:
+      result.text = mGMC->getVersion();
+      break;
+
+    case eQuery_Config:
+      mGMC->getConfigurationData();
+      break;
+  }
+
+  int64_t end_us  = clock_us(CLOCK_MONOTONIC);
+  int64_t cost_us = end_us - start_us;
+
+  result.ok = (mGMC->getErrorCode() == eNoProblem);
+
+  poll_stats_t & stats = query.stats;
+  stats.runs++;
+  if (result.ok == false)
+    stats.failures++;
+  stats.busy_us += cost_us;
+  if (result.late_us > stats.max_late_us)
+    stats.max_late_us = result.late_us;
+  if (query.measured == false)
+    stats.cost_us = cost_us;
+  else
+    stats.cost_us += (cost_us - stats.cost_us) / kCost_Weight;
+
+  mBusy_us += cost_us;
+  mExchanges++;
+
+  query.measured = true;
+  query.deferred = false;
+  query.due_us  += query.period_us;
+  if (query.due_us <= end_us)
+  {
+    int64_t missed = (end_us - query.due_us) / query.period_us + 1;
+    query.due_us  += missed * query.period_us;
+    stats.skipped += missed;
+  }
+
+  mListener->onResult(result);
+  return;
+} // end run()
+
+bool
+GQPollScheduler::getQueryStats(uint32_t id, poll_stats_t & stats)
+{
+  if (id >= mQueries.size())
+    return false;
+
+  stats = mQueries[id].stats;
+  return true;
+} // end getQueryStats()
+
+void
+GQPollScheduler::getLinkMetrics(poll_metrics_t & metrics)
+{
+  metrics = poll_metrics_t();
+
+  metrics.elapsed_us = clock_us(CLOCK_MONOTONIC) - mMetrics_start_us;
+  metrics.busy_us    = mBusy_us;
+  metrics.exchanges  = mExchanges;
+  for(uint32_t i=0; i<mQueries.size(); i++)
+  {
+    metrics.deferrals += mQueries[i].stats.deferrals;
+    metrics.skipped   += mQueries[i].stats.skipped;
+  }
+  if (metrics.elapsed_us > 0)
+    metrics.utilization = float(metrics.busy_us) / float(metrics.elapsed_us);
+
+  return;
+} // end getLinkMetrics()
+
+void
+GQPollScheduler::resetMetrics()
+{
+  mMetrics_start_us = clock_us(CLOCK_MONOTONIC);
+  mBusy_us          = 0;
+  mExchanges        = 0;
+
+  for(uint32_t i=0; i<mQueries.size(); i++)
+  {
+    int64_t cost = mQueries[i].stats.cost_us;
+
+    mQueries[i].stats         = poll_stats_t();
+    mQueries[i].stats.cost_us = cost;
+  }
+  return;
+} // end resetMetrics()
+
+// end file gqpoll.cc
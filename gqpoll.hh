@@ -0,0 +1,203 @@
+// **************************************************************************
+// File: gqpoll.hh
+//
+// Description:
+//    Declare the GQPollScheduler class, which runs a set of periodic
+//    queries of one GQ GMC, eg, CPM, battery voltage and configuration,
+//    by priority and deadline over its single serial link.
+//
+// POLL SCHEDULER OVERVIEW
+//
+// A monitor typically wants the CPM every second, the battery voltage
+// every minute, and the configuration and serial number every hour. Each
+// is a blocking command on the same serial link, and a command which
+// takes the link at the wrong moment holds up the next CPM poll by its
+// whole exchange, some 50 milliseconds for the configuration. The poll
+// scheduler holds all the queries, each with
+//
+//   - a period, and a grid of deadlines start + k * period on the
+//     monotonic clock, as GQPeriodicTimer (see gqtimer.hh);
+//   - a priority, 0 being the most urgent;
+//   - an estimate of the time its exchange takes, kept as an
+//     exponentially weighted moving average of the measured exchanges.
+//
+// A query whose deadline has come is run, the most urgent first, only if
+// its estimated exchange ends before the next deadline of every more
+// urgent query. Otherwise it is deferred to the next free time long
+// enough for it. A less urgent query therefore never delays a more urgent
+// one, while it still runs as soon as the link is free: with a CPM poll
+// every second, the voltage and configuration reads simply follow a CPM
+// poll a few milliseconds later. The most urgent queries are never
+// deferred. A query which falls a whole period or more behind skips the
+// deadlines missed, which are counted.
+//
+// The scheduler measures how long the link is busy, overall and for each
+// query, so that the load of the chosen periods can be seen, see
+// poll_metrics_t and poll_stats_t below.
+//
+// The queries are ordinary commands, so the heartbeat must be off (see
+// turnOnCPS() in gqgmc.cc): the scheduler polls CPS with eQuery_CPS
+// instead. While the link is lost, nothing is run, and the caller is
+// expected to restore it with GQGMC::reconnect().
+//
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "gqgmc.hh"
+
+#ifndef gqpoll_hh_
+#define gqpoll_hh_
+
+namespace GQLLC
+{
+
+  // The queries which can be scheduled.
+  enum poll_query_t
+  {
+    eQuery_CPM,       // getCPM(), result in count
+    eQuery_CPS,       // getCPS(), result in count
+    eQuery_Voltage,   // getBatteryVoltage(), result in voltage
+    eQuery_Serial,    // getSerialNumber(), result in text
+    eQuery_Version,   // getVersion(), result in text
+    eQuery_Config     // getConfigurationData(), result in the GQGMC's
+                      // local copy, eg, getDataSaveAddress()
+  };
+
+  // The result of one run of a query.
+  struct poll_result_t
+  {
+    uint32_t         id;        // as returned by addQuery()
+    poll_query_t     query;
+    bool             ok;        // false if the command failed
+    uint16_t         count;
+    float            voltage;
+    std::string      text;
+    struct timespec  when;      // CLOCK_REALTIME at the start of the run
+    int64_t          late_us;   // run start minus deadline
+  };
+
+  // Statistics of one query.
+  struct poll_stats_t
+  {
+    uint64_t  runs;
+    uint64_t  failures;
+    uint64_t  deferrals;        // deadlines on which it had to wait
+    uint64_t  skipped;          // deadlines missed altogether
+    int64_t   cost_us;          // moving average of the exchange time
+    int64_t   max_late_us;      // worst run start after deadline
+    int64_t   busy_us;          // total exchange time
+  };
+
+  // Statistics of the link, since start() or resetMetrics().
+  struct poll_metrics_t
+  {
+    int64_t   elapsed_us;
+    int64_t   busy_us;          // total exchange time of all queries
+    uint64_t  exchanges;
+    uint64_t  deferrals;
+    uint64_t  skipped;
+    float     utilization;      // busy_us / elapsed_us
+  };
+
+
+  // POLL LISTENER
+  //
+  // Abstract class of the receiver of the results of the queries.
+  class GQPollListener
+  {
+    public:
+
+    virtual
+    ~GQPollListener()
+    {
+    };
+
+    // A query has been run.
+    virtual
+    void
+    onResult(const poll_result_t & result) = 0;
+
+  }; // end class GQPollListener
+
+
+  // POLL SCHEDULER
+  //
+  // The class declaration - see gqpoll.cc for documentation
+  class GQPollScheduler
+  {
+    public:
+
+    // The GQGMC and the listener are owned by the caller and must
+    // outlive the scheduler.
+    GQPollScheduler(GQGMC * gmc, GQPollListener * listener);
+
+    // Method to add a query run every period_ms at the given priority,
+    // 0 being the most urgent. Returns its id for the results and
+    // getQueryStats(). Takes effect with the next start().
+    uint32_t
+    addQuery(poll_query_t query, uint32_t period_ms, uint32_t priority);
+
+    // Method to make every query due now and start the metrics.
+    void
+    start();
+
+    // Method to run every query which is due and fits, then sleep until
+    // the next deadline. Returns the number of queries run, or -1 if a
+    // signal interrupted the sleep. To be called in a loop.
+    int
+    step();
+
+    // Method to get the statistics of the query with the given id.
+    // Returns false if there is no such query.
+    bool
+    getQueryStats(uint32_t id, poll_stats_t & stats);
+
+    // Method to get the statistics of the link.
+    void
+    getLinkMetrics(poll_metrics_t & metrics);
+
+    // Method to restart the statistics, keeping the cost estimates.
+    void
+    resetMetrics();
+
+    private:
+
+    // A query and its schedule, times in microseconds of the monotonic
+    // clock.
+    struct query_t
+    {
+      poll_query_t  query;
+      uint32_t      priority;
+      int64_t       period_us;
+      int64_t       due_us;      // next deadline
+      bool          deferred;    // already counted for this deadline
+      bool          measured;    // cost is measured, not estimated
+      poll_stats_t  stats;
+    };
+
+    GQGMC *                mGMC;
+    GQPollListener *       mListener;
+    std::vector<query_t>   mQueries;
+
+    int64_t                mMetrics_start_us;
+    int64_t                mBusy_us;
+    uint64_t               mExchanges;
+
+    // Find the most urgent due query which fits before the deadlines of
+    // the more urgent ones. Returns its index, or -1.
+    int
+    nextRunnable(int64_t now_us);
+
+    // Run a query, measure it and move on its deadline.
+    void
+    run(query_t & query, int64_t now_us);
+
+  }; // end class GQPollScheduler
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqpoll.cc
+#endif  // gqpoll_hh_
@@ -0,0 +1,226 @@
+// **************************************************************************
+// File: gqscan.cc
+//
+// Synopsis:
+//   Define the GQMarkerScanner class, which finds the 55AA markers in
+//   history data with the vector instructions of the processor.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqscan.hh
+//
+// Each vector scan loads the bytes from i and from i + 1, compares them
+// with 55 and AA, and reduces the match of both to a bit mask, one bit
+// per offset. A history buffer holds few markers, so the mask is almost
+// always zero and the loop runs at the speed of the loads. The bytes
+// too few for a whole vector at the end are scanned one at a time.
+//
+//
+// C++ includes
+#include <vector>
+using namespace std;
+
+// Linux C includes
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GQ_SCAN_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GQ_SCAN_NEON 1
+#endif
+
+// These are GQ GMC project specific includes
+#include "gqscan.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The bytes of the marker.
+static
+uint8_t
+const          kMarker_1 = 0x55;
+
+static
+uint8_t
+const          kMarker_2 = 0xAA;
+
+// LOCAL UTILITIES
+//
+// Append the offset of the marker at i if its code is the one wanted.
+static inline
+uint32_t
+add_marker(const uint8_t * data, uint32_t length, uint32_t i, int code,
+           vector<uint32_t> & offsets)
+{
+  if ((code != kMarker_Any) &&
+      (((i + 2) >= length) || (data[i + 2] != uint8_t(code))))
+    return 0;
+
+  offsets.push_back(i);
+  return 1;
+}
+
+// Scan from start to the end one byte at a time, finding each 55 with
+// memchr().
+static
+uint32_t
+scan_bytes(const uint8_t * data, uint32_t start, uint32_t length, int code,
+           vector<uint32_t> & offsets)
+{
+  uint32_t found = 0;
+  uint32_t i     = start;
+
+  while ((i + 1) < length)
+  {
+    const uint8_t * marker = static_cast<const uint8_t *>(
+                               memchr(&data[i], kMarker_1, length - 1 - i));
+    if (marker == 0)
+      break;
+
+    i = uint32_t(marker - data);
+    if (data[i + 1] == kMarker_2)
+      found += add_marker(data, length, i, code, offsets);
+    i++;
+  }
+
+  return found;
+}
+
+static
+uint32_t
+scan_scalar(const uint8_t * data, uint32_t length, int code,
+            vector<uint32_t> & offsets)
+{
+  return scan_bytes(data, 0, length, code, offsets);
+}
+
+#if defined(GQ_SCAN_X86)
+// The AVX2 scan is compiled for AVX2 whatever the build flags, and only
+// called if the processor has it.
+__attribute__((target("avx2")))
+static
+uint32_t
+scan_avx2(const uint8_t * data, uint32_t length, int code,
+          vector<uint32_t> & offsets)
+{
+  __m256i   first  = _mm256_set1_epi8(char(kMarker_1));
+  __m256i   second = _mm256_set1_epi8(char(kMarker_2));
+  uint32_t  found  = 0;
+  uint32_t  i      = 0;
+
+  for(; (i + 33) <= length; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&data[i]));
+    __m256i b = _mm256_loadu_si256(
+                  reinterpret_cast<const __m256i *>(&data[i + 1]));
+    uint32_t mask = uint32_t(_mm256_movemask_epi8(
+                      _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                       _mm256_cmpeq_epi8(b, second))));
+    while (mask != 0)
+    {
+      found += add_marker(data, length, i + __builtin_ctz(mask), code,
+                          offsets);
+      mask &= mask - 1;
+    }
+  }
+
+  return found + scan_bytes(data, i, length, code, offsets);
+}
+#endif
+
+#if defined(GQ_SCAN_X86) && defined(__SSE2__)
+static
+uint32_t
+scan_sse2(const uint8_t * data, uint32_t length, int code,
+          vector<uint32_t> & offsets)
+{
+  __m128i   first  = _mm_set1_epi8(char(kMarker_1));
+  __m128i   second = _mm_set1_epi8(char(kMarker_2));
+  uint32_t  found  = 0;
+  uint32_t  i      = 0;
+
+  for(; (i + 17) <= length; i += 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&data[i]));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&data[i + 1]));
+    uint32_t mask = uint32_t(_mm_movemask_epi8(
+                      _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                    _mm_cmpeq_epi8(b, second))));
+    while (mask != 0)
+    {
+      found += add_marker(data, length, i + __builtin_ctz(mask), code,
+                          offsets);
+      mask &= mask - 1;
+    }
+  }
+
+  return found + scan_bytes(data, i, length, code, offsets);
+}
+#endif
+
+#if defined(GQ_SCAN_NEON)
+// NEON has no movemask. Shifting each 16 bit lane right by 4 and
+// narrowing it to 8 bits packs the 16 byte compare into 64 bits, four
+// bits per byte.
+static
+uint32_t
+scan_neon(const uint8_t * data, uint32_t length, int code,
+          vector<uint32_t> & offsets)
+{
+  uint8x16_t  first  = vdupq_n_u8(kMarker_1);
+  uint8x16_t  second = vdupq_n_u8(kMarker_2);
+  uint32_t    found  = 0;
+  uint32_t    i      = 0;
+
+  for(; (i + 17) <= length; i += 16)
+  {
+    uint8x16_t a     = vld1q_u8(&data[i]);
+    uint8x16_t b     = vld1q_u8(&data[i + 1]);
+    uint8x16_t match = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, second));
+    uint64_t   mask  = vget_lane_u64(vreinterpret_u64_u8(
+                         vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+    while (mask != 0)
+    {
+      uint32_t bit = uint32_t(__builtin_ctzll(mask)) >> 2;
+      found += add_marker(data, length, i + bit, code, offsets);
+      mask  &= ~(uint64_t(0xf) << (bit * 4));
+    }
+  }
+
+  return found + scan_bytes(data, i, length, code, offsets);
+}
+#endif
+
+
+// GQMARKERSCANNER CLASS CONSTRUCTOR
+GQMarkerScanner::GQMarkerScanner()
+  : mScan(scan_scalar), mMethod("scalar")
+{
+#if defined(GQ_SCAN_X86) && defined(__SSE2__)
+  mScan   = scan_sse2;
+  mMethod = "sse2";
+#endif
+#if defined(GQ_SCAN_NEON)
+  mScan   = scan_neon;
+  mMethod = "neon";
+#endif
+#if defined(GQ_SCAN_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    mScan   = scan_avx2;
+    mMethod = "avx2";
+  }
+#endif
+} // end GQMarkerScanner constructor
+
+uint32_t
+GQMarkerScanner::scan(const uint8_t * data, uint32_t length,
+                      vector<uint32_t> & offsets, int code)
+{
+  return mScan(data, length, code, offsets);
+} // end scan()
+
+// end file gqscan.cc
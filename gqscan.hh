@@ -0,0 +1,91 @@
+// **************************************************************************
+// File: gqscan.hh
+//
+// Description:
+//    Declare the GQMarkerScanner class, which finds the 55AA markers in
+//    history data with the vector instructions of the processor.
+//
+// MARKER SCAN OVERVIEW
+//
+// Every special record of the history data starts with the marker 55AA,
+// see getHistoryData() in gqgmc.cc, so the markers are where to look
+// for the date/timestamps when indexing a file of history data, eg, a
+// dump. GQHistoryDecoder (gqhistory.hh) decodes everything and finds
+// them on the way; for indexing years of dumps the scanner finds just
+// the markers, at about the speed the memory delivers the data.
+//
+// The scanner compares a whole vector of bytes with 55 and the same
+// vector shifted by one byte with AA, and turns the positions where
+// both match into offsets. The vector size depends on the processor:
+//
+//   - AVX2, 32 bytes at a time, on x86 processors which have it;
+//   - SSE2, 16 bytes, on all other x86-64 processors;
+//   - NEON, 16 bytes, on ARM processors with it, eg, the Raspberry Pi;
+//   - one byte at a time, with memchr(), anywhere else.
+//
+// AVX2 is chosen at run time, so one binary built for x86-64 uses it
+// where it is available. The others are chosen when building.
+//
+// A sample of 85 followed by one of 170 looks just like a marker, so
+// scan() can be asked for the markers followed by a given code only, eg,
+// kMarker_Timestamp; checking that the record is well formed is left to
+// the caller, or to GQHistoryDecoder.
+//
+#include <vector>
+
+#include <stdint.h>
+
+#ifndef gqscan_hh_
+#define gqscan_hh_
+
+namespace GQLLC
+{
+
+  // The codes following 55AA, see getHistoryData() in gqgmc.cc, and the
+  // value for any code.
+  int const kMarker_Timestamp = 0x00;
+  int const kMarker_Count     = 0x01;
+  int const kMarker_Note      = 0x02;
+  int const kMarker_Any       = -1;
+
+  // MARKER SCANNER
+  //
+  // The class declaration - see gqscan.cc for documentation
+  class GQMarkerScanner
+  {
+    public:
+
+    // The constructor chooses the fastest scan the processor has.
+    GQMarkerScanner();
+
+    // Method to append to offsets the offset of every 55AA in the data
+    // which is followed by code, or by anything for kMarker_Any. A
+    // marker at the very end, without its code, counts for kMarker_Any
+    // only. Returns the number of offsets appended.
+    uint32_t
+    scan(const uint8_t * data, uint32_t length,
+         std::vector<uint32_t> & offsets, int code = kMarker_Any);
+
+    // Method to get the name of the scan chosen, "avx2", "sse2", "neon"
+    // or "scalar".
+    const char *
+    getMethod()
+    {
+      return mMethod;
+    };
+
+    private:
+
+    typedef uint32_t (*scan_function_t)(const uint8_t * data,
+                                        uint32_t length, int code,
+                                        std::vector<uint32_t> & offsets);
+
+    scan_function_t  mScan;
+    const char *     mMethod;
+
+  }; // end class GQMarkerScanner
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqscan.cc
+#endif  // gqscan_hh_
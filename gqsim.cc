@@ -0,0 +1,195 @@
+// @file gqsim.cc
+// @author Alexander Gailey-White
+
+// Emulator of a GQ GMC (geiger-muller counter) on a pseudo-terminal,
+// implementing every command of GQ-RFC1201 (see gqdevice.hh). Point
+// gqgmc, or any other GQ GMC software, at the printed device name or
+// at the symlink given with -l, and it behaves like a real counter on a
+// USB to serial converter.
+
+// Usage: gqgmc-sim [options]
+//   -l <link>     also publish the pty under this symlink, eg, /tmp/gqgmc
+//   -m <version>  GETVER reply (14 characters), default "GMC-300Re 4.20"
+//   -s <serial>   serial number as 14 hex digits
+//   -c <cpm>      mean counts per minute, default 20
+//   -S <seed>     seed of the count generator, for repeatable runs
+//   -b <baud>     emulated baud rate, default 57600. Commands sent by a
+//                 host whose port is set to another rate are lost as
+//                 line noise, as with a real counter.
+//   -F <bytes>    history flash size, default 65536
+//   -f <file>     load the history flash from a file
+//   -o <file>     save the history flash to a file on exit
+//   -L <type>     history logging: off, cps, cpm or cph, default off
+// Example: gqgmc-sim -l /tmp/gqgmc -c 30 -L cps & gqgmc /tmp/gqgmc status
+
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+using namespace std;
+
+#include <unistd.h>
+#include <time.h>
+#include <termios.h>
+
+#include "gqtransport.hh"
+#include "gqdevice.hh"
+using namespace GQLLC;
+
+static volatile sig_atomic_t sigExit = 0;
+
+// Basic signal handler to break out of main loop, and cleanup
+void signalHandler(int signum) {
+  sigExit = 1;
+}
+
+// Microseconds of the monotonic clock, the time base of the model.
+static int64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The baud rate the host has set on its side of the pty, 0 if unknown.
+// The pty shares one set of terminal attributes between its two sides.
+static uint32_t hostBaud(int pty_fd) {
+  struct termios settings;
+  if (tcgetattr(pty_fd, &settings) != 0)
+    return 0;
+  switch (cfgetospeed(&settings)) {
+    case   B9600: return   9600;
+    case  B19200: return  19200;
+    case  B38400: return  38400;
+    case  B57600: return  57600;
+    case B115200: return 115200;
+    case B230400: return 230400;
+    default:      return 0;
+  }
+}
+
+static void usage() {
+  cerr << "Usage: gqgmc-sim [-l link] [-m version] [-s serial] [-c cpm]"
+          " [-S seed] [-b baud] [-F bytes] [-f file] [-o file]"
+          " [-L off|cps|cpm|cph]" << endl;
+}
+
+int
+main(int argc, char **argv) {
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+
+  GMCDeviceModel device;
+  uint32_t baud = 57600;
+  string link_name;
+  string save_file;
+  uint8_t save_data_type = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:m:s:c:S:b:F:f:o:L:")) != -1) {
+    switch (opt) {
+      case 'l': link_name = optarg; break;
+      case 'm': device.setVersion(optarg); break;
+      case 's': {
+        string hex = optarg;
+        if (hex.size() != 14) {
+          usage();
+          return 1;
+        }
+        uint8_t serial[7];
+        for (int i = 0; i < 7; i++)
+          serial[i] = uint8_t(strtoul(hex.substr(2 * i, 2).c_str(), 0, 16));
+        device.setSerialNumber(serial);
+        break;
+      }
+      case 'c': device.setMeanCPM(atof(optarg)); break;
+      case 'S': device.setSeed(uint32_t(strtoul(optarg, 0, 0))); break;
+      case 'b':
+        baud = uint32_t(strtoul(optarg, 0, 0));
+        device.setBaud(baud);
+        break;
+      case 'F': device.setFlashSize(uint32_t(strtoul(optarg, 0, 0))); break;
+      case 'f':
+        if (!device.loadFlash(optarg)) {
+          cerr << "gqgmc-sim: cannot read " << optarg << endl;
+          return 1;
+        }
+        break;
+      case 'o': save_file = optarg; break;
+      case 'L': {
+        string type = optarg;
+        if (type == "off")      save_data_type = 0;
+        else if (type == "cps") save_data_type = 1;
+        else if (type == "cpm") save_data_type = 2;
+        else if (type == "cph") save_data_type = 3;
+        else {
+          usage();
+          return 1;
+        }
+        break;
+      }
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  if (save_data_type != 0)
+    device.setSaveDataType(save_data_type);
+
+  // The host attaches to the slave side of the pty.
+  PTYTransport pty;
+  if (!pty.open()) {
+    cerr << "gqgmc-sim: cannot open a pseudo-terminal" << endl;
+    return 1;
+  }
+
+  if (!link_name.empty()) {
+    unlink(link_name.c_str());
+    if (symlink(pty.slaveName().c_str(), link_name.c_str()) != 0) {
+      cerr << "gqgmc-sim: cannot create " << link_name << endl;
+      return 1;
+    }
+  }
+  cout << pty.slaveName() << endl;
+
+  // Main loop: sleep until the host sends something or the model has
+  // a byte due, hand received bytes to the model and due bytes to the
+  // host. The model paces its own output at the emulated baud rate.
+  uint8_t buffer[4096];
+
+  while (!sigExit) {
+    int64_t now = monotonic_us();
+    int64_t next = device.nextTransmit(now);
+    int timeout_ms = -1;
+    if (next >= 0)
+      timeout_ms = (next > now) ? int((next - now + 999) / 1000) : 0;
+
+    int ready = pty.waitReadable(timeout_ms);
+    if (ready < 0)
+      break;
+
+    if (ready > 0) {
+      struct iovec iov = { buffer, sizeof(buffer) };
+      ssize_t n = pty.readv(&iov, 1);
+      if (n < 0)
+        break;
+      // At the wrong baud rate, the counter would only see garbage.
+      uint32_t host_baud = hostBaud(pty.pollFd());
+      if ((host_baud == 0) || (host_baud == baud))
+        device.receive(buffer, size_t(n), monotonic_us());
+    }
+
+    size_t n = device.transmit(buffer, sizeof(buffer), monotonic_us());
+    if (n > 0)
+      pty.write(buffer, n);
+  }
+
+  if (!save_file.empty() && !device.saveFlash(save_file))
+    cerr << "gqgmc-sim: cannot write " << save_file << endl;
+
+  if (!link_name.empty())
+    unlink(link_name.c_str());
+  pty.close();
+
+  return 0;
+}
@@ -0,0 +1,301 @@
+// **************************************************************************
+// File: gqsync.cc
+//
+// Synopsis:
+//   Define the GQHistorySync class, which copies only the history data a
+//   GQ GMC has logged since the last sync.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqsync.hh
+//
+//
+// C++ includes
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+using namespace std;
+
+// Linux C includes
+#include <stdio.h>
+#include <time.h>
+
+// These are GQ GMC project specific includes
+#include "gqsync.hh"
+#include "gqhistory.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The first chunk read, enough for an hour of CPM logging. Each further
+// chunk is twice as large, up to kHistory_Data_Maxsize.
+static
+uint32_t
+const          kFirst_Chunk = 256;
+
+// Length of the date/timestamp record in front of the DataSaveAddress,
+// 55 AA 00 YY MM DD hh mm ss 55 AA type.
+static
+uint32_t
+const          kStamp_Record = 12;
+
+// LOCAL UTILITIES
+//
+// Read the monotonic clock in milliseconds.
+static
+int64_t
+monotonic_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// GQHISTORYSYNC CLASS CONSTRUCTOR
+GQHistorySync::GQHistorySync(GQGMC * gmc, const string & checkpoint_file)
+  : mGMC(gmc), mCheckpoint_file(checkpoint_file),
+    mFlash_size(0), mFlash_override(0), mBuffer(kHistory_Data_Maxsize),
+    mFrom(0), mTo(0), mSynced(0), mTail_retries(0)
+{
+} // end GQHistorySync constructor
+
+void
+GQHistorySync::setFlashSize(uint32_t flash_size)
+{
+  mFlash_override = flash_size;
+  return;
+} // end setFlashSize()
+
+// sync decides where to start, see steps 1, 2 and the paragraph on new
+// runs in gqsync.hh, then reads on and stores the checkpoint.
+bool
+GQHistorySync::sync(const string & serial_number, GQFlashDumpSink * sink)
+{
+  mSynced       = 0;
+  mTail_retries = 0;
+  mFlash_size = (mFlash_override > 0) ? mFlash_override
+                                      : mGMC->getFlashSize();
+  if (mFlash_size == 0)
+    return false;
+
+  mGMC->getConfigurationData();
+  if (mGMC->getErrorCode() != eNoProblem)
+    return false;
+
+  checkpoint_t  now;
+  now.save_address = mGMC->getDataSaveAddress() % mFlash_size;
+  now.save_stamp   = mGMC->getSaveTimeStamp();
+
+  uint32_t      run_start = (now.save_address + mFlash_size - kStamp_Record)
+                          % mFlash_size;
+  checkpoint_t  last;
+  uint32_t      from = run_start;
+
+  if (loadCheckpoint(serial_number, last) == true)
+  {
+    from = last.address % mFlash_size;
+    if ((last.save_address != now.save_address) ||
+        (last.save_stamp != now.save_stamp))
+    {
+      bool erased;
+      if (isErased(from, erased) == false)
+        return false;
+      if (erased == true)
+        from = run_start;
+    }
+  }
+
+  mFrom = from;
+  bool ok = readOn(from, sink);
+
+  now.address = mTo;
+  storeCheckpoint(serial_number, now);
+
+  return ok;
+} // end sync()
+
+// isErased reads the kErased_Run bytes at the address.
+bool
+GQHistorySync::isErased(uint32_t address, bool & erased)
+{
+  uint32_t length = (mFlash_size < kErased_Run) ? mFlash_size : kErased_Run;
+
+  if (readWrapped(address, length) == false)
+    return false;
+
+  erased = true;
+  for(uint32_t i=0; i<length; i++)
+    if (mBuffer[i] != 0xff)
+      erased = false;
+
+  return true;
+} // end isErased()
+
+// readOn reads chunk after chunk from the address. In each chunk, the
+// data ends where kErased_Run bytes of 0xFF begin. 0xFF bytes at the end
+// of a chunk which are too few to tell are left for the next chunk to
+// decide, so the next chunk starts at them. A chunk which crosses the
+// end of the flash goes on at address zero, see readWrapped().
+bool
+GQHistorySync::readOn(uint32_t address, GQFlashDumpSink * sink)
+{
+  dump_progress_t  progress = dump_progress_t();
+  uint32_t         chunk    = kFirst_Chunk;
+  int64_t          started  = monotonic_ms();
+
+  // Where the history ends is not known until its erased area is found,
+  // so there is no end and no total to report.
+  progress.end_address   = 0;
+  progress.bytes_done    = 0;
+  progress.bytes_total   = 0;
+  progress.retries       = 0;
+  progress.bytes_per_sec = 0.0f;
+
+  mTo = address;
+
+  while (mSynced < mFlash_size)
+  {
+    uint32_t length = chunk;
+    if (length > (mFlash_size - mSynced))
+      length = mFlash_size - mSynced;
+
+    if (readWrapped(mTo, length) == false)
+      return false;
+
+    // Find the start of the erased area, or of the 0xFF bytes left
+    // undecided at the end of the chunk.
+    uint32_t data = 0;
+    uint32_t run  = 0;
+    bool     end  = false;
+    for(uint32_t i=0; i<length; i++)
+    {
+      if (mBuffer[i] != 0xff)
+      {
+        run  = 0;
+        data = i + 1;
+        continue;
+      }
+      if (++run == kErased_Run)
+      {
+        end = true;
+        break;
+      }
+    }
+
+    // Pass the data on, in two parts if it crosses the end of the flash.
+    uint32_t first = mFlash_size - mTo;
+    if (first > data)
+      first = data;
+    if ((first > 0) && (sink->onData(mTo, &mBuffer[0], first) == false))
+      return false;
+    if ((data > first) &&
+        (sink->onData(0, &mBuffer[first], data - first) == false))
+      return false;
+
+    mSynced += data;
+    mTo      = (mTo + data) % mFlash_size;
+
+    int64_t elapsed = monotonic_ms() - started;
+    progress.next_address  = mTo;
+    progress.bytes_done    = mSynced;
+    progress.tail_retries  = mTail_retries;
+    progress.bytes_per_sec = (elapsed > 0)
+                           ? (mSynced * 1000.0f) / elapsed : 0.0f;
+    sink->onProgress(progress);
+
+    // Without data in a whole chunk, the rest of the flash is too short
+    // to tell and there is nothing more to read.
+    if ((end == true) || (data == 0))
+      break;
+
+    if (chunk < kHistory_Data_Maxsize)
+      chunk *= 2;
+  }
+
+  return true;
+} // end readOn()
+
+bool
+GQHistorySync::readWrapped(uint32_t address, uint32_t length)
+{
+  uint32_t first = mFlash_size - address;
+  if (first > length)
+    first = length;
+
+  bool ok = (mGMC->readHistory(address, first, &mBuffer[0], first) == first);
+  addTailRetries();
+
+  if (ok && (length > first))
+  {
+    ok = (mGMC->readHistory(0, length - first, &mBuffer[first],
+                            length - first) == (length - first));
+    addTailRetries();
+  }
+
+  return ok;
+} // end readWrapped()
+
+void
+GQHistorySync::addTailRetries()
+{
+  const vector<uint32_t> & tails = mGMC->getChunkRetries();
+  for(uint32_t i=0; i<tails.size(); i++)
+    mTail_retries += tails[i];
+  return;
+} // end addTailRetries()
+
+bool
+GQHistorySync::loadCheckpoint(const string & serial_number,
+                              checkpoint_t & point)
+{
+  ifstream  file(mCheckpoint_file.c_str());
+  string    line;
+
+  while (getline(file, line))
+  {
+    istringstream  fields(line);
+    string         serial;
+
+    if ((fields >> serial >> point.address >> point.save_address
+                >> point.save_stamp) && (serial == serial_number))
+      return true;
+  }
+
+  return false;
+} // end loadCheckpoint()
+
+// storeCheckpoint rewrites the file through a temporary file and a
+// rename, as GQGMC::storeBaud() does.
+void
+GQHistorySync::storeCheckpoint(const string & serial_number,
+                               const checkpoint_t & point)
+{
+  stringstream  kept;
+  {
+    ifstream  file(mCheckpoint_file.c_str());
+    string    line;
+
+    while (getline(file, line))
+    {
+      istringstream  fields(line);
+      string         serial;
+
+      if ((fields >> serial) && (serial != serial_number))
+        kept << line << endl;
+    }
+  }
+
+  string    temp_name = mCheckpoint_file + ".tmp";
+  ofstream  temp(temp_name.c_str());
+
+  temp << kept.str() << serial_number << " " << point.address << " "
+       << point.save_address << " " << point.save_stamp << endl;
+  temp.close();
+
+  if (!temp || (rename(temp_name.c_str(), mCheckpoint_file.c_str()) != 0))
+    remove(temp_name.c_str());
+
+  return;
+} // end storeCheckpoint()
+
+// end file gqsync.cc
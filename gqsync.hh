@@ -0,0 +1,163 @@
+// **************************************************************************
+// File: gqsync.hh
+//
+// Description:
+//    Declare the GQHistorySync class, which copies only the history data
+//    a GQ GMC has logged since the last sync, remembering per serial
+//    number where that was.
+//
+// INCREMENTAL SYNC OVERVIEW
+//
+// A GQ GMC logging CPM writes 60 bytes of history an hour, yet a dump
+// (see gqdump.hh) reads the whole flash every time. The history buffer
+// is a circular log written byte after byte, in which the GQ GMC always
+// keeps the sector ahead of the newest byte erased (0xFF). So the new
+// data since a sync is the data from where the last sync stopped up to
+// the erased area, and that is all GQHistorySync reads:
+//
+//   1. Read the configuration for the DataSaveAddress, where the current
+//      logging run starts behind its date/timestamp record, and the
+//      timestamp of that run (getSaveTimeStamp()).
+//   2. Look up the checkpoint of the serial number: the address the last
+//      sync stopped at and the DataSaveAddress and timestamp seen then.
+//   3. Read on from the checkpoint address in small chunks, doubling
+//      up to kHistory_Data_Maxsize while the data goes on, until the
+//      erased area, that is, kErased_Run bytes of 0xFF in a row, and
+//      pass the data to the sink. Reading wraps around at the end of
+//      the flash.
+//   4. Store the new checkpoint.
+//
+// Without a checkpoint, the sync starts at the date/timestamp record of
+// the current logging run; older runs are left to a full dump. When a
+// new run has started since the last sync, the DataSaveAddress or its
+// timestamp differ from the checkpoint. If the log went on from the
+// checkpoint address, the new run follows in the data and the sync
+// simply reads on. If the log restarted elsewhere instead, eg, after
+// the log was reset, the checkpoint address is found erased and the
+// sync starts at the new run.
+//
+// A GQ GMC which wrapped around the whole flash since the last sync has
+// overwritten data which cannot be recovered; sync often enough for the
+// logging rate, eg, at once a second a 64K byte flash lasts some 18
+// hours.
+//
+// CHECKPOINT FILE FORMAT
+//
+// The checkpoints are kept in a text file with one line per GQ GMC:
+// serial number, checkpoint address, DataSaveAddress and timestamp, eg,
+//
+//   003000e34a351a 1234 1000 231104120000
+//
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+#include "gqdump.hh"
+
+#ifndef gqsync_hh_
+#define gqsync_hh_
+
+namespace GQLLC
+{
+
+  // HISTORY SYNC
+  //
+  // The class declaration - see gqsync.cc for documentation
+  class GQHistorySync
+  {
+    public:
+
+    // The GQGMC is owned by the caller and must outlive the sync. The
+    // checkpoints are kept in the file given.
+    GQHistorySync(GQGMC * gmc, const std::string & checkpoint_file);
+
+    // Method to set the size of the history flash, by default that of
+    // the GQ GMC, see GQGMC::getFlashSize().
+    void
+    setFlashSize(uint32_t flash_size);
+
+    // Method to pass the data logged since the last sync of the GQ GMC
+    // with this serial number to the sink, in address order. Returns
+    // false if the GQ GMC failed or the sink stopped the sync; the data
+    // passed so far is checkpointed all the same.
+    bool
+    sync(const std::string & serial_number, GQFlashDumpSink * sink);
+
+    // Method to get the range read by the last sync(), from the first
+    // address up to but not including the last, modulo the flash size.
+    uint32_t
+    getFromAddress()
+    {
+      return mFrom;
+    };
+
+    uint32_t
+    getToAddress()
+    {
+      return mTo;
+    };
+
+    // Method to get the number of bytes passed by the last sync().
+    uint32_t
+    getSyncedBytes()
+    {
+      return mSynced;
+    };
+
+    private:
+
+    // A checkpoint, see the file format above.
+    struct checkpoint_t
+    {
+      uint32_t     address;
+      uint32_t     save_address;
+      std::string  save_stamp;
+    };
+
+    GQGMC *               mGMC;
+    std::string           mCheckpoint_file;
+    uint32_t              mFlash_size;
+    uint32_t              mFlash_override;
+    std::vector<uint8_t>  mBuffer;
+
+    uint32_t              mFrom;
+    uint32_t              mTo;
+    uint32_t              mSynced;
+    uint32_t              mTail_retries;
+
+    // Find the checkpoint of the serial number. Returns false if none.
+    bool
+    loadCheckpoint(const std::string & serial_number, checkpoint_t & point);
+
+    // Replace the checkpoint of the serial number.
+    void
+    storeCheckpoint(const std::string & serial_number,
+                    const checkpoint_t & point);
+
+    // Tell whether the flash at the address is erased.
+    bool
+    isErased(uint32_t address, bool & erased);
+
+    // Read length bytes from the address into mBuffer, going on at
+    // address zero past the end of the flash. The tail SPIRs it took are
+    // added to mTail_retries.
+    bool
+    readWrapped(uint32_t address, uint32_t length);
+
+    // Add the tail SPIRs of the last readHistory() to mTail_retries.
+    void
+    addTailRetries();
+
+    // Read from the address up to the erased area, passing the data to
+    // the sink. Returns false on failure; mTo is where it got to.
+    bool
+    readOn(uint32_t address, GQFlashDumpSink * sink);
+
+  }; // end class GQHistorySync
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqsync.cc
+#endif  // gqsync_hh_
@@ -0,0 +1,333 @@
+// **************************************************************************
+// File: gqthread.cc
+//
+// Synopsis:
+//   Define the ThreadedTransport class, which reads another transport on
+//   a thread of its own into a lock-free ring of timestamped chunks.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqthread.hh
+//
+//
+// C++ includes
+#include <algorithm>
+using namespace std;
+
+// Linux C includes
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+// These are GQ GMC project specific includes
+#include "gqthread.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The reader waits for data in slices of this many milliseconds, so that
+// close() does not have to wait longer for it to notice the stop.
+static
+int
+const          kReader_Slice_ms = 50;
+
+
+// THREADEDTRANSPORT CLASS CONSTRUCTOR
+ThreadedTransport::ThreadedTransport(GQTransport * inner, bool owned)
+  : mInner(inner), mOwned(owned), mRing(new chunk_t[kRing_Chunks]),
+    mHead(0), mTail(0), mOffset(0), mHave_arrival(false), mEvent_fd(-1),
+    mRunning(false), mStop(false), mFailed(false), mOverflow_count(0),
+    mCpu(-1), mFifo_priority(0), mSched_error(0)
+{
+  mArrival_mono.tv_sec  = 0;
+  mArrival_mono.tv_nsec = 0;
+  mArrival_real         = mArrival_mono;
+} // end ThreadedTransport constructor
+
+ThreadedTransport::~ThreadedTransport()
+{
+  ThreadedTransport::close();
+  delete[] mRing;
+  if (mOwned)
+    delete mInner;
+} // end ThreadedTransport destructor
+
+void
+ThreadedTransport::setScheduling(int cpu, int fifo_priority)
+{
+  mCpu           = cpu;
+  mFifo_priority = fifo_priority;
+  return;
+} // end setScheduling()
+
+// open opens the inner transport, then starts the reader with an empty
+// ring. Pinning and real time scheduling are applied from here, so that
+// a refusal is known by the time open() returns.
+bool
+ThreadedTransport::open()
+{
+  if (mInner->open() == false)
+    return false;
+
+  mEvent_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mEvent_fd == -1)
+  {
+    mInner->close();
+    return false;
+  }
+
+  mHead.store(0);
+  mTail.store(0);
+  mOffset       = 0;
+  mHave_arrival = false;
+  mStop.store(false);
+  mFailed.store(false);
+  mSched_error  = 0;
+
+  if (pthread_create(&mThread, 0, readerMain, this) != 0)
+  {
+    ::close(mEvent_fd);
+    mEvent_fd = -1;
+    mInner->close();
+    return false;
+  }
+  mRunning = true;
+
+  if (mCpu >= 0)
+  {
+    cpu_set_t  cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(mCpu, &cpus);
+    int rc = pthread_setaffinity_np(mThread, sizeof(cpus), &cpus);
+    if (rc != 0)
+      mSched_error = rc;
+  }
+
+  if (mFifo_priority > 0)
+  {
+    struct sched_param  param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = mFifo_priority;
+    int rc = pthread_setschedparam(mThread, SCHED_FIFO, &param);
+    if (rc != 0)
+      mSched_error = rc;
+  }
+
+  return true;
+} // end open()
+
+void
+ThreadedTransport::close()
+{
+  if (mRunning)
+  {
+    mStop.store(true);
+    pthread_join(mThread, 0);
+    mRunning = false;
+  }
+  if (mEvent_fd != -1)
+    ::close(mEvent_fd);
+  mEvent_fd = -1;
+
+  mInner->close();
+  return;
+} // end close()
+
+ssize_t
+ThreadedTransport::write(const uint8_t * data, size_t length)
+{
+  return mInner->write(data, length);
+} // end write()
+
+// waitReadable returns at once if the ring holds a chunk, otherwise it
+// waits for the reader's signal. A failure of the inner transport is
+// only returned once the chunks read before it have been taken.
+int
+ThreadedTransport::waitReadable(int timeout_ms)
+{
+  if (mTail.load(memory_order_relaxed) != mHead.load(memory_order_acquire))
+    return 1;
+  if (mFailed.load(memory_order_acquire))
+    return -1;
+
+  struct pollfd pfd;
+  pfd.fd      = mEvent_fd;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+
+  int ready = poll(&pfd, 1, timeout_ms);
+  if (ready < 0)
+    return (errno == EINTR) ? 0 : -1;
+  if (ready == 0)
+    return 0;
+
+  if ((mTail.load(memory_order_relaxed) == mHead.load(memory_order_acquire))
+      && mFailed.load(memory_order_acquire))
+    return -1;
+  return 1;
+} // end waitReadable()
+
+// readv takes chunks from the tail of the ring, splitting a chunk over
+// calls if the buffers are too small. The eventfd is cleared before the
+// ring is looked at, so a chunk pushed meanwhile signals it again and no
+// wakeup is lost. If chunks are left over, the eventfd is signalled
+// again so that an epoll caller comes back for them.
+ssize_t
+ThreadedTransport::readv(const struct iovec * iov, int iovcnt)
+{
+  uint64_t  events;
+  if (::read(mEvent_fd, &events, sizeof(events)) < 0)
+    events = 0;
+
+  uint32_t  tail = mTail.load(memory_order_relaxed);
+  uint32_t  head = mHead.load(memory_order_acquire);
+  ssize_t   done = 0;
+  int       vec  = 0;
+  size_t    used = 0;
+
+  while ((tail != head) && (vec < iovcnt))
+  {
+    chunk_t & chunk = mRing[tail % kRing_Chunks];
+
+    size_t n = min(size_t(chunk.length - mOffset), iov[vec].iov_len - used);
+    memcpy(static_cast<uint8_t *>(iov[vec].iov_base) + used,
+           &chunk.data[mOffset], n);
+    mOffset += n;
+    used    += n;
+    done    += n;
+
+    mArrival_mono = chunk.mono;
+    mArrival_real = chunk.real;
+    mHave_arrival = true;
+
+    if (mOffset == chunk.length)
+    {
+      mOffset = 0;
+      tail++;
+      mTail.store(tail, memory_order_release);
+    }
+    if (used == iov[vec].iov_len)
+    {
+      vec++;
+      used = 0;
+    }
+  }
+
+  if (tail != head)
+    signal();
+  else if ((done == 0) && mFailed.load(memory_order_acquire))
+    return -1;
+
+  return done;
+} // end readv()
+
+// flushInput discards the chunks in the ring as well as whatever the
+// inner transport still holds. Moving the tail up to the head is the
+// consumer's own business, so no lock is needed.
+void
+ThreadedTransport::flushInput()
+{
+  mInner->flushInput();
+  mTail.store(mHead.load(memory_order_acquire), memory_order_release);
+  mOffset = 0;
+  return;
+} // end flushInput()
+
+bool
+ThreadedTransport::setBaud(uint32_t baud)
+{
+  return mInner->setBaud(baud);
+} // end setBaud()
+
+int
+ThreadedTransport::pollFd()
+{
+  return mEvent_fd;
+} // end pollFd()
+
+bool
+ThreadedTransport::arrivalTime(struct timespec & mono, struct timespec & real)
+{
+  if (mHave_arrival == false)
+    return false;
+
+  mono = mArrival_mono;
+  real = mArrival_real;
+  return true;
+} // end arrivalTime()
+
+void *
+ThreadedTransport::readerMain(void * self)
+{
+  static_cast<ThreadedTransport *>(self)->readLoop();
+  return 0;
+} // end readerMain()
+
+// readLoop is the reader thread. It reads straight into the chunk at the
+// head of the ring, which the consumer cannot see until the head moves,
+// and stamps the chunk as soon as the read returns. With the ring full,
+// it reads into a spare chunk and drops it.
+void
+ThreadedTransport::readLoop()
+{
+  chunk_t  spare;
+
+  while (mStop.load(memory_order_relaxed) == false)
+  {
+    int ready = mInner->waitReadable(kReader_Slice_ms);
+    if (ready == 0)
+      continue;
+
+    uint32_t  head = mHead.load(memory_order_relaxed);
+    bool      full = ((head - mTail.load(memory_order_acquire))
+                      >= kRing_Chunks);
+    chunk_t & chunk = full ? spare : mRing[head % kRing_Chunks];
+
+    ssize_t n = -1;
+    if (ready > 0)
+    {
+      struct iovec iov = { chunk.data, kChunk_Bytes };
+      n = mInner->readv(&iov, 1);
+    }
+    if (n < 0)
+    {
+      mFailed.store(true, memory_order_release);
+      signal();
+      break;
+    }
+    if (n == 0)
+      continue;
+
+    clock_gettime(CLOCK_MONOTONIC, &chunk.mono);
+    clock_gettime(CLOCK_REALTIME, &chunk.real);
+    chunk.length = uint32_t(n);
+
+    if (full)
+    {
+      mOverflow_count.fetch_add(1, memory_order_relaxed);
+      continue;
+    }
+
+    mHead.store(head + 1, memory_order_release);
+    signal();
+  }
+
+  return;
+} // end readLoop()
+
+void
+ThreadedTransport::signal()
+{
+  uint64_t  one = 1;
+  if (::write(mEvent_fd, &one, sizeof(one)) < 0)
+  {
+    // The counter is saturated, the consumer is woken anyway.
+  }
+  return;
+} // end signal()
+
+// end file gqthread.cc
@@ -0,0 +1,168 @@
+// **************************************************************************
+// File: gqthread.hh
+//
+// Description:
+//    Declare the ThreadedTransport class, a wrapper around another
+//    transport which reads it on a thread of its own into a lock-free
+//    ring of timestamped chunks.
+//
+// READER THREAD OVERVIEW
+//
+// The GQGMC class reads the serial port only when its caller asks for
+// data. If the caller is slow, eg, blocked writing to a full stdout pipe,
+// a disk or a network sink, nothing reads the port meanwhile, the tty
+// buffer of the kernel fills up and heartbeat frames are lost. With a
+// ThreadedTransport, a reader thread owns the reading side of the inner
+// transport. It waits for data, reads whatever has arrived into a chunk,
+// stamps the chunk with its arrival time on both clocks and pushes it
+// into a single-producer, single-consumer ring. The caller's side, the
+// consumer, takes the chunks out of the ring through readv(), and GQGMC
+// parses replies and heartbeat frames from them exactly as if they came
+// from the port, with the arrival times of the chunks (see
+// GQTransport::arrivalTime()).
+//
+// The ring holds kRing_Chunks chunks, which at one chunk per heartbeat
+// frame is a quarter of an hour of a stalled consumer. Should it be full
+// all the same, the reader drops the chunk and counts it as an overflow,
+// rather than stop reading and let the kernel drop bytes silently.
+//
+// The ring is lock-free: the reader alone moves its head and the
+// consumer alone moves its tail, both atomically with release and
+// acquire ordering. The consumer is woken through an eventfd, which is
+// also the file descriptor of pollFd(), so the transport works with
+// poll() and epoll as any other, eg, in GQEventLoop.
+//
+// Optionally, the reader thread is pinned to one CPU and scheduled with
+// SCHED_FIFO at a given priority, so that it gets to run promptly even
+// on a loaded host. Real time scheduling needs CAP_SYS_NICE; when it is
+// refused, the reader runs at normal priority and getSchedError() tells
+// why.
+//
+// The consumer still writes commands, flushes input and sets the baud
+// rate through the inner transport directly, so the inner transport must
+// allow these concurrently with a read, as a TTYTransport does.
+//
+#include <atomic>
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "gqtransport.hh"
+
+#ifndef gqthread_hh_
+#define gqthread_hh_
+
+namespace GQLLC
+{
+
+  // THREADED TRANSPORT WRAPPER
+  //
+  // The class declaration - see gqthread.cc for documentation
+  class ThreadedTransport : public GQTransport
+  {
+    public:
+
+    // Owned is true if the inner transport is to be deleted together
+    // with this one.
+    ThreadedTransport(GQTransport * inner, bool owned);
+
+    virtual
+    ~ThreadedTransport();
+
+    // Method to pin the reader thread to a CPU, -1 for none, and to give
+    // it SCHED_FIFO priority, 0 for none. Takes effect with open().
+    void
+    setScheduling(int cpu, int fifo_priority);
+
+    // Method to get the errno with which pinning or real time scheduling
+    // of the reader was refused, 0 if it was not.
+    int
+    getSchedError()
+    {
+      return mSched_error;
+    };
+
+    // Method to get the number of chunks dropped because the ring was
+    // full.
+    uint64_t
+    getOverflowCount()
+    {
+      return mOverflow_count.load(std::memory_order_relaxed);
+    };
+
+    virtual bool     open();
+    virtual void     close();
+    virtual ssize_t  write(const uint8_t * data, size_t length);
+    virtual int      waitReadable(int timeout_ms);
+    virtual ssize_t  readv(const struct iovec * iov, int iovcnt);
+    virtual void     flushInput();
+    virtual bool     setBaud(uint32_t baud);
+    virtual int      pollFd();
+    virtual bool     arrivalTime(struct timespec & mono,
+                                 struct timespec & real);
+
+    private:
+
+    // Size of a chunk and number of chunks in the ring, the latter a
+    // power of two.
+    static const uint32_t  kChunk_Bytes = 256;
+    static const uint32_t  kRing_Chunks = 1024;
+
+    // One read of the reader thread.
+    struct chunk_t
+    {
+      uint32_t         length;
+      struct timespec  mono;
+      struct timespec  real;
+      uint8_t          data[kChunk_Bytes];
+    };
+
+    GQTransport *             mInner;
+    bool                      mOwned;
+
+    // The ring. The reader fills mRing[mHead % kRing_Chunks] and then
+    // moves mHead on, the consumer empties mRing[mTail % kRing_Chunks]
+    // and then moves mTail on. mOffset is how much of the chunk at the
+    // tail the consumer has taken already.
+    chunk_t *                 mRing;
+    std::atomic<uint32_t>     mHead;
+    std::atomic<uint32_t>     mTail;
+    uint32_t                  mOffset;
+
+    // Arrival time of the last chunk taken by readv().
+    struct timespec           mArrival_mono;
+    struct timespec           mArrival_real;
+    bool                      mHave_arrival;
+
+    // The eventfd signalled by the reader for every chunk and failure.
+    int                       mEvent_fd;
+
+    pthread_t                 mThread;
+    bool                      mRunning;
+    std::atomic<bool>         mStop;
+    std::atomic<bool>         mFailed;
+    std::atomic<uint64_t>     mOverflow_count;
+
+    int                       mCpu;
+    int                       mFifo_priority;
+    int                       mSched_error;
+
+    // The reader thread.
+    static
+    void *
+    readerMain(void * self);
+
+    void
+    readLoop();
+
+    // Wake the consumer.
+    void
+    signal();
+
+  }; // end class ThreadedTransport
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqthread.cc
+#endif  // gqthread_hh_
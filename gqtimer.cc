@@ -0,0 +1,110 @@
+// **************************************************************************
+// File: gqtimer.cc
+//
+// Synopsis:
+//   Define the GQPeriodicTimer class, which paces a polling loop on
+//   absolute deadlines of the monotonic clock.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqtimer.hh
+//
+//
+// Linux C includes
+#include <errno.h>
+
+// These are GQ GMC project specific includes
+#include "gqtimer.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+static
+uint64_t
+const          kNs_Per_Ms  = 1000000;
+static
+uint64_t
+const          kNs_Per_Sec = 1000000000;
+
+// LOCAL UTILITIES
+//
+// Convert between a timespec and nanoseconds. 64 bits of nanoseconds
+// cover centuries of monotonic clock.
+static
+uint64_t
+to_ns(const struct timespec & ts)
+{
+  return uint64_t(ts.tv_sec) * kNs_Per_Sec + uint64_t(ts.tv_nsec);
+}
+
+static
+struct timespec
+to_timespec(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec  = time_t(ns / kNs_Per_Sec);
+  ts.tv_nsec = long(ns % kNs_Per_Sec);
+  return ts;
+}
+
+
+// GQPERIODICTIMER CLASS CONSTRUCTOR
+GQPeriodicTimer::GQPeriodicTimer(uint32_t period_ms)
+  : mWaiting(false), mSkipped(0), mOverrun_count(0)
+{
+  setPeriod(period_ms);
+  start();
+} // end GQPeriodicTimer constructor
+
+void
+GQPeriodicTimer::setPeriod(uint32_t period_ms)
+{
+  // A zero period would make every deadline the same.
+  mPeriod_ns = uint64_t((period_ms > 0) ? period_ms : 1) * kNs_Per_Ms;
+  return;
+} // end setPeriod()
+
+void
+GQPeriodicTimer::start()
+{
+  clock_gettime(CLOCK_MONOTONIC, &mDeadline);
+  mWaiting = false;
+  return;
+} // end start()
+
+// wait moves the deadline on by one period, and on beyond every deadline
+// which has passed meanwhile, counting those as skipped. Then it sleeps
+// until that absolute time. Since the deadline is absolute, it does not
+// matter how long the caller took since the previous one, nor when the
+// sleep starts, nor whether it is restarted after a signal.
+int
+GQPeriodicTimer::wait()
+{
+  if (mWaiting == false)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t deadline = to_ns(mDeadline) + mPeriod_ns;
+    uint64_t now_ns   = to_ns(now);
+
+    mSkipped = 0;
+    if (deadline <= now_ns)
+    {
+      uint64_t missed = (now_ns - deadline) / mPeriod_ns + 1;
+      deadline += missed * mPeriod_ns;
+      mSkipped  = int(missed);
+      mOverrun_count += missed;
+    }
+
+    mDeadline = to_timespec(deadline);
+    mWaiting  = true;
+  }
+
+  int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &mDeadline, 0);
+  if (rc == EINTR)
+    return -1;
+
+  mWaiting = false;
+  return mSkipped;
+} // end wait()
+
+// end file gqtimer.cc
@@ -0,0 +1,83 @@
+// **************************************************************************
+// File: gqtimer.hh
+//
+// Description:
+//    Declare the GQPeriodicTimer class, which paces a polling loop on
+//    absolute deadlines so that its period does not drift.
+//
+// PERIODIC TIMER OVERVIEW
+//
+// A loop which polls the GQ GMC and then sleeps for the period takes the
+// period plus the time of the exchange for every iteration, so it falls
+// behind a little every time and slowly loses samples. GQPeriodicTimer
+// instead keeps a grid of deadlines, start + k * period, on the
+// monotonic clock, and sleeps until the next one with clock_nanosleep()
+// and TIMER_ABSTIME. The time spent in the loop body is thereby absorbed
+// rather than added, whatever the period, which may well be shorter than
+// a second.
+//
+// If the loop body takes longer than the period, deadlines pass before
+// the loop gets to wait for them. They are not made up for by running
+// the body several times in a row, nor is the grid shifted. The missed
+// deadlines are skipped, wait() sleeps until the next one still ahead,
+// and it returns the number skipped so that the caller can report the
+// overrun.
+//
+#include <stdint.h>
+#include <time.h>
+
+#ifndef gqtimer_hh_
+#define gqtimer_hh_
+
+namespace GQLLC
+{
+
+  // PERIODIC TIMER
+  //
+  // The class declaration - see gqtimer.cc for documentation
+  class GQPeriodicTimer
+  {
+    public:
+
+    GQPeriodicTimer(uint32_t period_ms);
+
+    // Method to change the period. Takes effect with the next deadline.
+    void
+    setPeriod(uint32_t period_ms);
+
+    // Method to start the grid of deadlines at the present time.
+    void
+    start();
+
+    // Method to sleep until the next deadline. Returns the number of
+    // deadlines which had already passed and were skipped (an overrun),
+    // 0 if on time, or -1 if a signal interrupted the sleep, in which
+    // case wait() may simply be called again.
+    int
+    wait();
+
+    // Method to get the total number of skipped deadlines.
+    uint64_t
+    getOverrunCount()
+    {
+      return mOverrun_count;
+    };
+
+    private:
+
+    uint64_t         mPeriod_ns;
+
+    // The deadline being waited for, and whether it has been set up
+    // already by a wait() which was interrupted.
+    struct timespec  mDeadline;
+    bool             mWaiting;
+    int              mSkipped;
+
+    uint64_t         mOverrun_count;
+
+  }; // end class GQPeriodicTimer
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqtimer.cc
+#endif  // gqtimer_hh_
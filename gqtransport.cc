@@ -0,0 +1,854 @@
+// **************************************************************************
+// File: gqtransport.cc
+//
+// Synopsis:
+//   Define the transport classes which carry the byte streams between
+//   the GQGMC class and a GQ GMC, or something pretending to be one.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqtransport.hh
+//
+//
+// C++ includes
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+using namespace std;
+
+// These are the C includes needed for the serial port and pseudo-terminal.
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+// These are GQ GMC project specific includes
+#include "gqtransport.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// GQ-RFC1201 fixes the serial link at 57600 baud, so a port is opened at
+// that rate until setBaud() says otherwise.
+static
+uint32_t
+const          kOpen_Baud = 57600;
+
+// A write which cannot make progress for this long has failed. Commands
+// are a few bytes, so a healthy port never comes close.
+static
+int
+const          kWrite_Stall_ms = 1000;
+
+// LOCAL UTILITIES
+//
+// Read the monotonic clock in microseconds. The loopback and replay
+// transports pace their returned data against this clock.
+static
+int64_t
+monotonic_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleep until the given time of the monotonic clock.
+static
+void
+sleep_until_us(int64_t until_us)
+{
+  struct timespec ts;
+  ts.tv_sec  = until_us / 1000000;
+  ts.tv_nsec = (until_us % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+    ;
+}
+
+// Scatter length bytes of data over the given buffers, used by the
+// in-process transports to implement readv().
+static
+size_t
+scatter(const struct iovec * iov, int iovcnt, const uint8_t * data,
+        size_t length)
+{
+  size_t done = 0;
+  for(int i=0; (i<iovcnt) && (done<length); i++)
+  {
+    size_t n = iov[i].iov_len;
+    if (n > (length - done)) n = length - done;
+    memcpy(iov[i].iov_base, &data[done], n);
+    done += n;
+  }
+  return done;
+}
+
+// Total capacity of the given buffers.
+static
+size_t
+capacity(const struct iovec * iov, int iovcnt)
+{
+  size_t total = 0;
+  for(int i=0; i<iovcnt; i++)
+    total += iov[i].iov_len;
+  return total;
+}
+
+
+// TTYTRANSPORT
+//
+// The serial port transport uses classic C style IO because the C++ IO
+// streams do not have enough flexibility to control a serial port. The
+// line discipline is raw, that is, no character translation, no
+// handshaking, no nothing. read() never waits (VMIN = 0, VTIME = 0), all
+// waiting is done by poll() in waitReadable() so the caller is in full
+// control of its deadlines.
+TTYTransport::TTYTransport(const string & device)
+  : mDevice(device), mFd(-1)
+{
+} // end TTYTransport constructor
+
+TTYTransport::~TTYTransport()
+{
+  TTYTransport::close();
+} // end TTYTransport destructor
+
+bool
+TTYTransport::open()
+{
+  // Open usb serial port for reading and writing.
+  mFd = ::open(mDevice.c_str(), O_RDWR);
+  if (mFd == -1)
+    return false;
+
+  fcntl(mFd, F_SETFL, 0);
+
+  return configure(kOpen_Baud);
+} // end open()
+
+void
+TTYTransport::close()
+{
+  if (mFd != -1)
+    ::close(mFd);
+  mFd = -1;
+  return;
+} // end close()
+
+// configure is the protected method to set the line discipline to raw
+// binary and the baud rate. Only the standard rates a GQ GMC might use
+// are accepted.
+bool
+TTYTransport::configure(uint32_t baud)
+{
+  struct termios  settings;
+  speed_t         speed;
+
+  switch(baud)
+  {
+    case   9600: speed =   B9600; break;
+    case  19200: speed =  B19200; break;
+    case  38400: speed =  B38400; break;
+    case  57600: speed =  B57600; break;
+    case 115200: speed = B115200; break;
+    case 230400: speed = B230400; break;
+    default:     return false;
+  }
+
+  memset(&settings,0,sizeof(settings));
+  settings.c_cflag     = CS8 | CREAD | CLOCAL;
+  settings.c_iflag     = 0; // setting line discpline to raw binary
+  settings.c_oflag     = 0;
+  settings.c_lflag     = 0;
+  settings.c_cc[VMIN]  = 0; // This combo of VMIN & VTIME means read()
+  settings.c_cc[VTIME] = 0; // never waits, see waitReadable().
+  cfsetispeed(&settings, speed);
+  cfsetospeed(&settings, speed);
+
+  return (tcsetattr(mFd, TCSANOW, &settings) == 0);
+} // end configure()
+
+ssize_t
+TTYTransport::write(const uint8_t * data, size_t length)
+{
+  size_t done = 0;
+
+  while (done < length)
+  {
+    ssize_t n = ::write(mFd, &data[done], length - done);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+
+      // The output queue is full, wait for it to drain a little. Only
+      // a port which cannot take anything for a while has failed.
+      if (errno == EAGAIN)
+      {
+        struct pollfd pfd;
+        pfd.fd      = mFd;
+        pfd.events  = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, kWrite_Stall_ms) == 1) continue;
+      }
+      return -1;
+    }
+    done += n;
+  }
+
+  return done;
+} // end write()
+
+// waitReadable waits with poll(). A port whose USB-serial adapter has
+// been unplugged reports a hang up or an error without data, which is
+// returned as a link failure rather than as a timeout.
+int
+TTYTransport::waitReadable(int timeout_ms)
+{
+  struct pollfd pfd;
+  pfd.fd      = mFd;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+
+  int ready = poll(&pfd, 1, timeout_ms);
+  if (ready < 0)
+    return (errno == EINTR) ? 0 : -1;
+  if (ready == 0)
+    return 0;
+  if (pfd.revents & POLLIN)
+    return 1;
+
+  return -1; // POLLHUP, POLLERR or POLLNVAL without data
+} // end waitReadable()
+
+// readv returns -1 for EIO or ENODEV, as a port reports once its
+// USB-serial adapter is gone. A read of nothing is normal for a port
+// without data (VMIN is 0), but together with a hang up it is the end of
+// file, as a pty slave reports when its master closes. This is returned
+// as -1 as well.
+ssize_t
+TTYTransport::readv(const struct iovec * iov, int iovcnt)
+{
+  ssize_t n = ::readv(mFd, iov, iovcnt);
+  if (n < 0)
+    return ((errno == EINTR) || (errno == EAGAIN)) ? 0 : -1;
+
+  if (n == 0)
+  {
+    struct pollfd pfd;
+    pfd.fd      = mFd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    if ((poll(&pfd, 1, 0) == 1) && ((pfd.revents & (POLLHUP | POLLERR)) != 0))
+      return -1;
+  }
+
+  return n;
+} // end readv()
+
+void
+TTYTransport::flushInput()
+{
+  tcflush(mFd, TCIFLUSH);
+  return;
+} // end flushInput()
+
+bool
+TTYTransport::setBaud(uint32_t baud)
+{
+  return configure(baud);
+} // end setBaud()
+
+int
+TTYTransport::pollFd()
+{
+  return mFd;
+} // end pollFd()
+
+
+// PTYTRANSPORT
+//
+// The pseudo-terminal transport creates a new pseudo-terminal and sits
+// on its master side. Whatever plays the part of the GQ GMC attaches to
+// the slave side, whose name is available from slaveName() once open.
+// A pseudo-terminal has no baud rate, so setBaud() accepts any rate.
+PTYTransport::PTYTransport()
+  : TTYTransport(""), mSlave_fd(-1)
+{
+} // end PTYTransport constructor
+
+PTYTransport::~PTYTransport()
+{
+  PTYTransport::close();
+} // end PTYTransport destructor
+
+bool
+PTYTransport::open()
+{
+  mFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (mFd == -1)
+    return false;
+
+  if ((grantpt(mFd) != 0) || (unlockpt(mFd) != 0) || (ptsname(mFd) == 0))
+  {
+    close();
+    return false;
+  }
+  mDevice = ptsname(mFd);
+
+  // Hold the slave open and put it in raw mode, so that neither side
+  // translates any of the binary data.
+  mSlave_fd = ::open(mDevice.c_str(), O_RDWR | O_NOCTTY);
+  if (mSlave_fd == -1)
+  {
+    close();
+    return false;
+  }
+
+  struct termios settings;
+  tcgetattr(mSlave_fd, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(mSlave_fd, TCSANOW, &settings);
+
+  return configure(kOpen_Baud);
+} // end open()
+
+void
+PTYTransport::close()
+{
+  if (mSlave_fd != -1)
+    ::close(mSlave_fd);
+  mSlave_fd = -1;
+  TTYTransport::close();
+  return;
+} // end close()
+
+bool
+PTYTransport::setBaud(uint32_t baud)
+{
+  configure(baud);
+  return true;
+} // end setBaud()
+
+
+// SCRIPTEDDEVICE
+//
+// The scripted device model answers each command which has been scripted
+// with setReply() and ignores everything else, just as a GQ GMC ignores
+// a command it does not recognize. Returned bytes are paced at the
+// configured byte time.
+ScriptedDevice::ScriptedDevice()
+  : mOutput_ready_us(0), mByte_us(0), mCommand_count(0)
+{
+} // end ScriptedDevice constructor
+
+void
+ScriptedDevice::setReply(const string & cmd, const string & reply)
+{
+  for(size_t i=0; i<mScript.size(); i++)
+  {
+    if (mScript[i].cmd == cmd)
+    {
+      mScript[i].reply = reply;
+      return;
+    }
+  }
+
+  script_t entry;
+  entry.cmd   = cmd;
+  entry.reply = reply;
+  mScript.push_back(entry);
+
+  return;
+} // end setReply()
+
+void
+ScriptedDevice::setByteTime(uint32_t byte_us)
+{
+  mByte_us = byte_us;
+  return;
+} // end setByteTime()
+
+void
+ScriptedDevice::receive(const uint8_t * data, size_t length, int64_t now_us)
+{
+  mInput.append(reinterpret_cast<const char *>(data), length);
+
+  while (mInput.size() > 0)
+  {
+    // Every command starts with '<', anything before is line noise.
+    size_t start = mInput.find('<');
+    if (start == string::npos)
+    {
+      mInput.clear();
+      break;
+    }
+    mInput.erase(0, start);
+
+    // Look for a scripted command at the front of the input, and note
+    // whether the input could still grow into one.
+    bool  matched = false;
+    bool  partial = false;
+    for(size_t i=0; i<mScript.size(); i++)
+    {
+      const string & cmd = mScript[i].cmd;
+      if (mInput.compare(0, cmd.size(), cmd) == 0)
+      {
+        if (mOutput.empty())
+          mOutput_ready_us = now_us + mByte_us;
+        mOutput.insert(mOutput.end(), mScript[i].reply.begin(),
+                                      mScript[i].reply.end());
+        mInput.erase(0, cmd.size());
+        mCommand_count++;
+        matched = true;
+        break;
+      }
+      if (cmd.compare(0, mInput.size(), mInput) == 0)
+        partial = true;
+    }
+    if (matched)
+      continue;
+
+    // An unknown command is dropped once its ">>" has arrived.
+    size_t end = mInput.find(">>");
+    if ((partial == false) && (end != string::npos))
+    {
+      mInput.erase(0, end + 2);
+      mCommand_count++;
+      continue;
+    }
+    break;
+  } // end while loop
+
+  return;
+} // end receive()
+
+size_t
+ScriptedDevice::transmit(uint8_t * data, size_t length, int64_t now_us)
+{
+  size_t ready = mOutput.size();
+
+  if (mByte_us > 0)
+  {
+    if (now_us < mOutput_ready_us)
+      return 0;
+    uint64_t paced = uint64_t(now_us - mOutput_ready_us) / mByte_us + 1;
+    if (paced < ready) ready = paced;
+  }
+  if (ready > length) ready = length;
+
+  for(size_t i=0; i<ready; i++)
+  {
+    data[i] = mOutput.front();
+    mOutput.pop_front();
+  }
+  mOutput_ready_us += int64_t(ready) * mByte_us;
+
+  return ready;
+} // end transmit()
+
+int64_t
+ScriptedDevice::nextTransmit(int64_t now_us)
+{
+  if (mOutput.empty())
+    return -1;
+  return (mByte_us > 0) ? mOutput_ready_us : now_us;
+} // end nextTransmit()
+
+
+// LOOPBACKTRANSPORT
+//
+// The loopback transport connects GQGMC to a device model in the same
+// process. Waiting for returned data means sleeping until the model says
+// its next byte is ready, or until the timeout, whichever is first.
+LoopbackTransport::LoopbackTransport(GQDeviceModel * model)
+  : mModel(model), mOpen(false)
+{
+} // end LoopbackTransport constructor
+
+bool
+LoopbackTransport::open()
+{
+  mOpen = (mModel != 0);
+  return mOpen;
+} // end open()
+
+void
+LoopbackTransport::close()
+{
+  mOpen = false;
+  return;
+} // end close()
+
+ssize_t
+LoopbackTransport::write(const uint8_t * data, size_t length)
+{
+  if (mOpen == false)
+    return -1;
+  mModel->receive(data, length, monotonic_us());
+  return length;
+} // end write()
+
+int
+LoopbackTransport::waitReadable(int timeout_ms)
+{
+  if (mOpen == false)
+    return -1;
+
+  int64_t deadline = monotonic_us() + int64_t(timeout_ms) * 1000;
+
+  for(;;)
+  {
+    int64_t now  = monotonic_us();
+    int64_t next = mModel->nextTransmit(now);
+    if ((next >= 0) && (next <= now))
+      return 1;
+    if (now >= deadline)
+      return 0;
+    sleep_until_us(((next >= 0) && (next < deadline)) ? next : deadline);
+  }
+} // end waitReadable()
+
+ssize_t
+LoopbackTransport::readv(const struct iovec * iov, int iovcnt)
+{
+  if (mOpen == false)
+    return -1;
+
+  int64_t now  = monotonic_us();
+  ssize_t done = 0;
+  for(int i=0; i<iovcnt; i++)
+  {
+    size_t n = mModel->transmit(static_cast<uint8_t *>(iov[i].iov_base),
+                                iov[i].iov_len, now);
+    done += n;
+    if (n < iov[i].iov_len) break;
+  }
+
+  return done;
+} // end readv()
+
+void
+LoopbackTransport::flushInput()
+{
+  uint8_t  discard[256];
+  int64_t  now = monotonic_us();
+  while (mModel->transmit(discard, sizeof(discard), now) > 0)
+    ;
+  return;
+} // end flushInput()
+
+bool
+LoopbackTransport::setBaud(uint32_t baud)
+{
+  return true;
+} // end setBaud()
+
+
+// REPLAYTRANSPORT
+//
+// The replay transport reads the whole trace when opened. Leading '<'
+// records, for example heartbeat frames which were already flowing when
+// the trace was recorded, are released at once. Thereafter, every byte
+// the host writes must match the next '>' record of the trace. Once a
+// '>' record has been matched completely, the '<' records following it
+// are released, each becoming readable after its recorded delay. Since
+// the host's bytes are compared as a stream, it does not matter whether
+// a pipelined burst is written in one piece or in several.
+ReplayTransport::ReplayTransport(const string & trace_file)
+  : mTrace_file(trace_file), mRecord(0), mMatched(0),
+    mOpen(false), mLoaded(false), mDiverged(false)
+{
+} // end ReplayTransport constructor
+
+// open reads the trace the first time only. A reopen, eg, by
+// GQGMC::reconnect(), goes on where the playback was, as the recording
+// did, and fails once the host has left the trace.
+bool
+ReplayTransport::open()
+{
+  if (mLoaded == true)
+  {
+    mOpen = (mDiverged == false);
+    return mOpen;
+  }
+
+  ifstream  trace(mTrace_file.c_str());
+  string    line;
+
+  if (!trace)
+    return false;
+
+  mRecords.clear();
+  while (getline(trace, line))
+  {
+    if ((line.size() == 0) || (line[0] == '#'))
+      continue;
+
+    istringstream  fields(line);
+    char           direction;
+    int64_t        delay_us;
+    string         hex;
+    fields >> direction >> delay_us >> hex;
+    if ((!fields && !fields.eof()) || ((direction != '>') && (direction != '<')))
+      return false;
+
+    record_t record;
+    record.to_device = (direction == '>');
+    record.delay_us  = delay_us;
+    for(size_t i=0; (i+1)<hex.size(); i+=2)
+      record.bytes.push_back(uint8_t(strtoul(hex.substr(i, 2).c_str(), 0, 16)));
+    mRecords.push_back(record);
+  }
+
+  mRecord   = 0;
+  mMatched  = 0;
+  mDiverged = false;
+  mOutput.clear();
+  mOpen     = true;
+  mLoaded   = true;
+
+  release(monotonic_us());
+
+  return true;
+} // end open()
+
+void
+ReplayTransport::close()
+{
+  mOpen = false;
+  return;
+} // end close()
+
+void
+ReplayTransport::release(int64_t now_us)
+{
+  int64_t ready_us = now_us;
+
+  while ((mRecord < mRecords.size()) && (mRecords[mRecord].to_device == false))
+  {
+    ready_us += mRecords[mRecord].delay_us;
+    for(size_t i=0; i<mRecords[mRecord].bytes.size(); i++)
+    {
+      pending_t pending;
+      pending.byte     = mRecords[mRecord].bytes[i];
+      pending.ready_us = ready_us;
+      mOutput.push_back(pending);
+    }
+    mRecord++;
+  }
+
+  return;
+} // end release()
+
+ssize_t
+ReplayTransport::write(const uint8_t * data, size_t length)
+{
+  if (mOpen == false)
+    return -1;
+
+  for(size_t i=0; (i<length) && (mDiverged == false); i++)
+  {
+    if ((mRecord >= mRecords.size()) || (mRecords[mRecord].to_device == false)
+        || (mRecords[mRecord].bytes[mMatched] != data[i]))
+    {
+      mDiverged = true;
+      break;
+    }
+
+    if (++mMatched == mRecords[mRecord].bytes.size())
+    {
+      mRecord++;
+      mMatched = 0;
+      release(monotonic_us());
+    }
+  }
+
+  return length;
+} // end write()
+
+// Once diverged, the trace has nothing sensible left to say, so the
+// link is reported as failed rather than leaving the host to time out.
+int
+ReplayTransport::waitReadable(int timeout_ms)
+{
+  if ((mOpen == false) || (mDiverged == true))
+    return -1;
+
+  int64_t deadline = monotonic_us() + int64_t(timeout_ms) * 1000;
+
+  for(;;)
+  {
+    int64_t now = monotonic_us();
+    if (!mOutput.empty() && (mOutput.front().ready_us <= now))
+      return 1;
+    if (now >= deadline)
+      return 0;
+    int64_t next = mOutput.empty() ? deadline : mOutput.front().ready_us;
+    sleep_until_us((next < deadline) ? next : deadline);
+  }
+} // end waitReadable()
+
+ssize_t
+ReplayTransport::readv(const struct iovec * iov, int iovcnt)
+{
+  if ((mOpen == false) || (mDiverged == true))
+    return -1;
+
+  int64_t               now  = monotonic_us();
+  size_t                room = capacity(iov, iovcnt);
+  vector<uint8_t>       ready;
+
+  while (!mOutput.empty() && (mOutput.front().ready_us <= now)
+         && (ready.size() < room))
+  {
+    ready.push_back(mOutput.front().byte);
+    mOutput.pop_front();
+  }
+
+  return scatter(iov, iovcnt, ready.data(), ready.size());
+} // end readv()
+
+void
+ReplayTransport::flushInput()
+{
+  int64_t now = monotonic_us();
+  while (!mOutput.empty() && (mOutput.front().ready_us <= now))
+    mOutput.pop_front();
+  return;
+} // end flushInput()
+
+bool
+ReplayTransport::setBaud(uint32_t baud)
+{
+  return true;
+} // end setBaud()
+
+
+// RECORDTRANSPORT
+//
+// The recording wrapper passes every call through to the inner transport
+// and writes each chunk of transmitted and returned bytes to the trace
+// file in the format read by ReplayTransport.
+RecordTransport::RecordTransport(GQTransport * inner, const string & trace_file,
+                                 bool owned)
+  : mInner(inner), mOwned(owned), mTrace_file(trace_file), mLast_us(0),
+    mStarted(false)
+{
+} // end RecordTransport constructor
+
+RecordTransport::~RecordTransport()
+{
+  if (mOwned)
+    delete mInner;
+} // end RecordTransport destructor
+
+// open begins the trace file the first time only. A reopen, eg, by
+// GQGMC::reconnect(), goes on appending to it, with a comment line to
+// mark the gap.
+bool
+RecordTransport::open()
+{
+  if (mInner->open() == false)
+    return false;
+
+  if (mStarted == false)
+  {
+    mTrace.open(mTrace_file.c_str(), ios::out | ios::trunc);
+    mTrace << "# GQ GMC trace, see gqtransport.hh for the format" << endl;
+    mStarted = true;
+  }
+  else if (mTrace.is_open() == false)
+  {
+    mTrace.open(mTrace_file.c_str(), ios::out | ios::app);
+    mTrace << "# reopened" << endl;
+  }
+  mLast_us = monotonic_us();
+
+  return true;
+} // end open()
+
+void
+RecordTransport::close()
+{
+  mInner->close();
+  mTrace.close();
+  return;
+} // end close()
+
+void
+RecordTransport::record(char direction, const uint8_t * data, size_t length)
+{
+  int64_t now = monotonic_us();
+
+  mTrace << direction << ' ' << dec << (now - mLast_us) << ' ';
+  for(size_t i=0; i<length; i++)
+    mTrace << hex << setw(2) << setfill('0') << int(data[i]);
+  mTrace << dec << endl;
+
+  mLast_us = now;
+  return;
+} // end record()
+
+ssize_t
+RecordTransport::write(const uint8_t * data, size_t length)
+{
+  ssize_t n = mInner->write(data, length);
+  if (n > 0)
+    record('>', data, n);
+  return n;
+} // end write()
+
+int
+RecordTransport::waitReadable(int timeout_ms)
+{
+  return mInner->waitReadable(timeout_ms);
+} // end waitReadable()
+
+ssize_t
+RecordTransport::readv(const struct iovec * iov, int iovcnt)
+{
+  ssize_t n = mInner->readv(iov, iovcnt);
+  if (n > 0)
+  {
+    vector<uint8_t> chunk;
+    for(int i=0; (i<iovcnt) && (chunk.size() < size_t(n)); i++)
+    {
+      const uint8_t * base = static_cast<const uint8_t *>(iov[i].iov_base);
+      size_t          take = iov[i].iov_len;
+      if (take > (n - chunk.size())) take = n - chunk.size();
+      chunk.insert(chunk.end(), base, base + take);
+    }
+    record('<', chunk.data(), chunk.size());
+  }
+  return n;
+} // end readv()
+
+void
+RecordTransport::flushInput()
+{
+  mInner->flushInput();
+  return;
+} // end flushInput()
+
+bool
+RecordTransport::setBaud(uint32_t baud)
+{
+  return mInner->setBaud(baud);
+} // end setBaud()
+
+int
+RecordTransport::pollFd()
+{
+  return mInner->pollFd();
+} // end pollFd()
+
+bool
+RecordTransport::arrivalTime(struct timespec & mono, struct timespec & real)
+{
+  return mInner->arrivalTime(mono, real);
+} // end arrivalTime()
+
+// end file gqtransport.cc
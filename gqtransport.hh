@@ -0,0 +1,433 @@
+// **************************************************************************
+// File: gqtransport.hh
+//
+// Description:
+//    Declare the transport classes which carry the byte streams between
+//    the GQGMC class and a GQ GMC, or something pretending to be one.
+//
+// TRANSPORT OVERVIEW
+//
+// The GQGMC class does not touch the serial port itself. Every byte to
+// and from the GQ GMC passes through an object derived from the abstract
+// GQTransport class declared here. The interface is deliberately the
+// minimum that GQGMC needs: write a command, wait with a timeout for
+// returned data, take whatever returned data is available, discard
+// stale input, and set the baud rate. Four transports are provided:
+//
+//   TTYTransport       a real serial port, eg, /dev/gqgmc or /dev/ttyUSB0,
+//                      and equally the slave side of a pseudo-terminal
+//                      created by an emulator such as gqgmc-sim.
+//   PTYTransport       the master side of a new pseudo-terminal. The GQ
+//                      GMC side is the slave, whose name is published
+//                      so that another process can attach to it.
+//   LoopbackTransport  an in-process link to a device model object
+//                      (GQDeviceModel), for example ScriptedDevice. No
+//                      file descriptor or second process is involved.
+//   ReplayTransport    plays back a trace recorded by RecordTransport.
+//                      Commands are checked against the trace and the
+//                      recorded replies are returned with their original
+//                      timing.
+//
+// RecordTransport is a wrapper around any other transport which passes
+// everything through while writing the trace that ReplayTransport reads.
+// ThreadedTransport (see gqthread.hh) is another, which reads the inner
+// transport on a thread of its own.
+// Together, the loopback and replay transports allow the driver logic to
+// be exercised, timed and benchmarked on a build machine with no GQ GMC
+// attached: gqgmc-bench (gqbench.cc, "make bench") runs GQGMC against
+// a ScriptedDevice and a GMCDeviceModel (gqdevice.hh), and records and
+// replays its own trace. GQGMC::setTraceFile() records a session with a
+// real GQ GMC, see GQGMC_TRACE and GQGMC_REPLAY in main.cc.
+//
+// TRACE FILE FORMAT
+//
+// A trace is a text file with one record per line. Blank lines and lines
+// starting with '#' are ignored. Each record is
+//
+//   <direction> <delay_us> <hex bytes>
+//
+// where direction is '>' for bytes from host to GQ GMC and '<' for bytes
+// from GQ GMC to host, delay_us is the time in microseconds since the
+// previous record, and the bytes are written as pairs of hex digits.
+// For example, a CPM exchange returning 28 counts per minute is
+//
+//   > 0 3c47455443504d3e3e
+//   < 2150 001c
+//
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifndef gqtransport_hh_
+#define gqtransport_hh_
+
+namespace GQLLC
+{
+
+  // ABSTRACT TRANSPORT
+  //
+  // The abstract transport class, see gqtransport.cc for documentation
+  class GQTransport
+  {
+    public:
+
+    virtual
+    ~GQTransport()
+    {
+    };
+
+    // Method to open the transport, returns false on failure.
+    virtual
+    bool
+    open() = 0;
+
+    // Method to close the transport.
+    virtual
+    void
+    close() = 0;
+
+    // Method to transmit bytes to the GQ GMC. Returns the number of
+    // bytes transmitted or -1 on failure.
+    virtual
+    ssize_t
+    write(const uint8_t * data, size_t length) = 0;
+
+    // Method to wait for returned data. Returns 1 if data can be read,
+    // 0 if timeout_ms passed without data, -1 if the link failed.
+    virtual
+    int
+    waitReadable(int timeout_ms) = 0;
+
+    // Method to take whatever returned data is available, scattered
+    // over the given buffers. Returns the number of bytes read, 0 if
+    // nothing was available, -1 if the link failed. Never blocks.
+    virtual
+    ssize_t
+    readv(const struct iovec * iov, int iovcnt) = 0;
+
+    // Method to discard returned data not yet read.
+    virtual
+    void
+    flushInput() = 0;
+
+    // Method to set the baud rate in bits per second. Returns false if
+    // the rate is not supported.
+    virtual
+    bool
+    setBaud(uint32_t baud) = 0;
+
+    // Method to return a file descriptor which becomes readable together
+    // with the transport, for use with poll() or epoll. Transports
+    // without one return -1.
+    virtual
+    int
+    pollFd()
+    {
+      return -1;
+    };
+
+    // Method to get the time the bytes last returned by readv() arrived,
+    // on the monotonic and the real time clock, for transports which
+    // know it better than the time of the readv() call, eg, because
+    // another thread read them earlier. Others return false.
+    virtual
+    bool
+    arrivalTime(struct timespec & mono, struct timespec & real)
+    {
+      return false;
+    };
+
+  }; // end class GQTransport
+
+
+  // SERIAL PORT TRANSPORT
+  class TTYTransport : public GQTransport
+  {
+    public:
+
+    TTYTransport(const std::string & device);
+
+    virtual
+    ~TTYTransport();
+
+    virtual bool     open();
+    virtual void     close();
+    virtual ssize_t  write(const uint8_t * data, size_t length);
+    virtual int      waitReadable(int timeout_ms);
+    virtual ssize_t  readv(const struct iovec * iov, int iovcnt);
+    virtual void     flushInput();
+    virtual bool     setBaud(uint32_t baud);
+    virtual int      pollFd();
+
+    protected:
+
+    // The device name of the serial port, eg, /dev/gqgmc.
+    std::string  mDevice;
+
+    // The file descriptor of the open port, -1 when closed.
+    int          mFd;
+
+    // Put the open port into raw mode at the given baud rate.
+    bool
+    configure(uint32_t baud);
+
+  }; // end class TTYTransport
+
+
+  // PSEUDO-TERMINAL TRANSPORT
+  class PTYTransport : public TTYTransport
+  {
+    public:
+
+    PTYTransport();
+
+    virtual
+    ~PTYTransport();
+
+    virtual bool     open();
+    virtual void     close();
+    virtual bool     setBaud(uint32_t baud);
+
+    // Method to get the name of the slave side, eg, /dev/pts/3, valid
+    // after open().
+    std::string
+    slaveName()
+    {
+      return mDevice;
+    };
+
+    private:
+
+    // The slave side is held open so that the master does not report
+    // a hang up while no other process has attached.
+    int          mSlave_fd;
+
+  }; // end class PTYTransport
+
+
+  // DEVICE MODEL
+  //
+  // Abstract class of an in-process stand-in for a GQ GMC, the far end
+  // of the LoopbackTransport. Time is passed in microseconds of the
+  // monotonic clock so that a model can pace its output like a real
+  // serial link.
+  class GQDeviceModel
+  {
+    public:
+
+    virtual
+    ~GQDeviceModel()
+    {
+    };
+
+    // Accept bytes transmitted by the host.
+    virtual
+    void
+    receive(const uint8_t * data, size_t length, int64_t now_us) = 0;
+
+    // Hand over up to length bytes which are ready for the host by
+    // now_us. Returns the number of bytes handed over.
+    virtual
+    size_t
+    transmit(uint8_t * data, size_t length, int64_t now_us) = 0;
+
+    // Return the time at which the next byte for the host will be
+    // ready, or -1 if the device has nothing to send.
+    virtual
+    int64_t
+    nextTransmit(int64_t now_us) = 0;
+
+  }; // end class GQDeviceModel
+
+
+  // SCRIPTED DEVICE MODEL
+  class ScriptedDevice : public GQDeviceModel
+  {
+    public:
+
+    ScriptedDevice();
+
+    // Method to script the reply to a command. The command is matched
+    // exactly, including '<' and ">>".
+    void
+    setReply(const std::string & cmd, const std::string & reply);
+
+    // Method to set the time each returned byte takes on the wire, for
+    // example 174 microseconds for 57600 baud. Zero means immediate.
+    void
+    setByteTime(uint32_t byte_us);
+
+    // Method to get the number of commands received so far.
+    uint32_t
+    getCommandCount()
+    {
+      return mCommand_count;
+    };
+
+    virtual void     receive(const uint8_t * data, size_t length,
+                             int64_t now_us);
+    virtual size_t   transmit(uint8_t * data, size_t length, int64_t now_us);
+    virtual int64_t  nextTransmit(int64_t now_us);
+
+    private:
+
+    struct script_t
+    {
+      std::string  cmd;
+      std::string  reply;
+    };
+
+    std::vector<script_t>  mScript;
+
+    // Bytes received which do not yet form a complete command.
+    std::string            mInput;
+
+    // Bytes to be returned and the time the first of them is ready.
+    std::deque<uint8_t>    mOutput;
+    int64_t                mOutput_ready_us;
+
+    uint32_t               mByte_us;
+    uint32_t               mCommand_count;
+
+  }; // end class ScriptedDevice
+
+
+  // LOOPBACK TRANSPORT
+  class LoopbackTransport : public GQTransport
+  {
+    public:
+
+    // The model is owned by the caller and must outlive the transport.
+    LoopbackTransport(GQDeviceModel * model);
+
+    virtual bool     open();
+    virtual void     close();
+    virtual ssize_t  write(const uint8_t * data, size_t length);
+    virtual int      waitReadable(int timeout_ms);
+    virtual ssize_t  readv(const struct iovec * iov, int iovcnt);
+    virtual void     flushInput();
+    virtual bool     setBaud(uint32_t baud);
+
+    private:
+
+    GQDeviceModel *  mModel;
+    bool             mOpen;
+
+  }; // end class LoopbackTransport
+
+
+  // REPLAY TRANSPORT
+  class ReplayTransport : public GQTransport
+  {
+    public:
+
+    ReplayTransport(const std::string & trace_file);
+
+    virtual bool     open();
+    virtual void     close();
+    virtual ssize_t  write(const uint8_t * data, size_t length);
+    virtual int      waitReadable(int timeout_ms);
+    virtual ssize_t  readv(const struct iovec * iov, int iovcnt);
+    virtual void     flushInput();
+    virtual bool     setBaud(uint32_t baud);
+
+    // Method to tell whether the host transmitted something other than
+    // what the trace recorded. From then on, nothing more is returned.
+    bool
+    hasDiverged()
+    {
+      return mDiverged;
+    };
+
+    // Method to tell whether the whole trace has been played back.
+    bool
+    isFinished()
+    {
+      return (mRecord >= mRecords.size()) && mOutput.empty();
+    };
+
+    private:
+
+    struct record_t
+    {
+      bool                  to_device;  // '>' record
+      int64_t               delay_us;
+      std::vector<uint8_t>  bytes;
+    };
+
+    struct pending_t
+    {
+      uint8_t               byte;
+      int64_t               ready_us;
+    };
+
+    std::string             mTrace_file;
+    std::vector<record_t>   mRecords;
+
+    // Position of playback: the current record and, for a '>' record,
+    // how many of its bytes the host has matched so far.
+    size_t                  mRecord;
+    size_t                  mMatched;
+
+    // Returned bytes released by the playback and when they are ready.
+    std::deque<pending_t>   mOutput;
+
+    bool                    mOpen;
+    bool                    mLoaded;    // the trace was read
+    bool                    mDiverged;
+
+    // Release the '<' records following the current position.
+    void
+    release(int64_t now_us);
+
+  }; // end class ReplayTransport
+
+
+  // RECORDING TRANSPORT WRAPPER
+  class RecordTransport : public GQTransport
+  {
+    public:
+
+    // Owned is true if the inner transport is to be deleted together
+    // with this one.
+    RecordTransport(GQTransport * inner, const std::string & trace_file,
+                    bool owned = false);
+
+    virtual
+    ~RecordTransport();
+
+    virtual bool     open();
+    virtual void     close();
+    virtual ssize_t  write(const uint8_t * data, size_t length);
+    virtual int      waitReadable(int timeout_ms);
+    virtual ssize_t  readv(const struct iovec * iov, int iovcnt);
+    virtual void     flushInput();
+    virtual bool     setBaud(uint32_t baud);
+    virtual int      pollFd();
+    virtual bool     arrivalTime(struct timespec & mono,
+                                 struct timespec & real);
+
+    private:
+
+    GQTransport *    mInner;
+    bool             mOwned;
+    std::string      mTrace_file;
+    std::ofstream    mTrace;
+    int64_t          mLast_us;
+    bool             mStarted;      // the trace file was begun
+
+    void
+    record(char direction, const uint8_t * data, size_t length);
+
+  }; // end class RecordTransport
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqtransport.cc
+#endif  // gqtransport_hh_
@@ -0,0 +1,303 @@
+// **************************************************************************
+// File: gqtune.cc
+//
+// Synopsis:
+//   Define the GQChunkTuner class, which finds the SPIR chunk size at
+//   which a GQ GMC delivers its history flash the fastest.
+//
+// CONTINUATION OF DOCUMENTATION FROM gqtune.hh
+//
+// Without a stored size, the tuner starts at max_chunk, the size every
+// read used before it, and so is never slower than that for long.
+//
+//
+// C++ includes
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+using namespace std;
+
+// Linux C includes
+#include <stdio.h>
+#include <time.h>
+
+// These are GQ GMC project specific includes
+#include "gqtune.hh"
+using namespace GQLLC;
+
+// LOCAL CONSTANTS
+//
+// The smallest size tried. Below it, the command and reply overhead
+// outweighs anything a short reply could gain.
+static
+uint32_t
+const          kMin_Chunk = 256;
+
+// Every this many batches, one is read at a neighboring size.
+static
+uint32_t
+const          kProbe_Interval = 8;
+
+// A size whose error rate is above kMax_Error_Rate is probed only on
+// every this many probes.
+static
+uint32_t
+const          kRetry_Probes = 4;
+
+// Largest error rate of a size which is used, about one short batch in
+// ten.
+static
+float
+const          kMax_Error_Rate = 0.1f;
+
+// Weight of the newest batch in the moving averages.
+static
+float
+const          kAverage_Weight = 0.25f;
+
+// LOCAL UTILITIES
+//
+// Read the monotonic clock in microseconds.
+static
+int64_t
+monotonic_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// GQCHUNKTUNER CLASS CONSTRUCTOR
+GQChunkTuner::GQChunkTuner(GQGMC * gmc)
+  : mGMC(gmc), mCurrent(0), mBatches(0)
+{
+  uint32_t max_chunk = gmc->getModel().max_chunk;
+  if (max_chunk > kHistory_Data_Maxsize)
+    max_chunk = kHistory_Data_Maxsize;
+
+  chunk_stats_t stats;
+  stats.batches    = 0;
+  stats.rate       = 0.0f;
+  stats.error_rate = 0.0f;
+
+  for(uint32_t chunk=kMin_Chunk; chunk<max_chunk; chunk*=2)
+  {
+    stats.chunk = chunk;
+    mStats.push_back(stats);
+  }
+  stats.chunk = max_chunk;
+  mStats.push_back(stats);
+
+  mCurrent = uint32_t(mStats.size()) - 1;
+} // end GQChunkTuner constructor
+
+void
+GQChunkTuner::setStateFile(const string & file_name)
+{
+  mState_file = file_name;
+  return;
+} // end setStateFile()
+
+// load keys the state by the GETVER reply, which may hold a space, eg,
+// "GMC-300Re 4.20", and by the baud rate, which bounds the rate any
+// size can reach. The stored size counts as measured once, at its rate.
+bool
+GQChunkTuner::load()
+{
+  string version = mGMC->getVersion();
+  if (mGMC->getErrorCode() != eNoProblem)
+    return false;
+
+  for(uint32_t i=0; i<version.size(); i++)
+  {
+    if ((version[i] == ' ') || (version[i] == '\0'))
+      version[i] = '_';
+  }
+  stringstream key;
+  key << version << "@" << mGMC->getBaudRate();
+  mKey = key.str();
+
+  if (mState_file.empty() == true)
+    return false;
+
+  ifstream  state(mState_file.c_str());
+  string    line;
+
+  while (getline(state, line))
+  {
+    istringstream  fields(line);
+    string         name;
+    uint32_t       chunk(0);
+    float          rate(0.0f);
+
+    if (!(fields >> name >> chunk >> rate) || (name != mKey))
+      continue;
+
+    mCurrent = indexOf(chunk);
+    mStats[mCurrent].batches = 1;
+    mStats[mCurrent].rate    = rate;
+    return true;
+  }
+
+  return false;
+} // end load()
+
+// store rewrites the state file through a temporary file and a rename,
+// as GQGMC::storeBaud() does.
+bool
+GQChunkTuner::store()
+{
+  if ((mState_file.empty() == true) || (mKey.empty() == true))
+    return false;
+
+  stringstream  kept;
+  {
+    ifstream  state(mState_file.c_str());
+    string    line;
+
+    while (getline(state, line))
+    {
+      istringstream  fields(line);
+      string         name;
+
+      if (!(fields >> name) || (name == mKey))
+        continue;
+      kept << line << endl;
+    }
+  }
+
+  string    temp_name = mState_file + ".tmp";
+  ofstream  temp(temp_name.c_str());
+
+  temp << kept.str() << mKey << " " << mStats[mCurrent].chunk << " "
+       << mStats[mCurrent].rate << endl;
+  temp.close();
+
+  if (!temp || (rename(temp_name.c_str(), mState_file.c_str()) != 0))
+  {
+    remove(temp_name.c_str());
+    return false;
+  }
+
+  return true;
+} // end store()
+
+// getChunk probes up and down in turn. A neighbor which has been failing
+// is skipped, except on every kRetry_Probes-th probe in its direction,
+// so that a size which failed once, eg, on a glitch, is not given up for
+// good.
+uint32_t
+GQChunkTuner::getChunk()
+{
+  mBatches++;
+  if ((mBatches % kProbe_Interval) != 0)
+    return mStats[mCurrent].chunk;
+
+  uint32_t probes = mBatches / kProbe_Interval;
+  bool     up     = ((probes % 2) == 1);
+  bool     retry  = (((probes / 2) % kRetry_Probes) == 0);
+
+  uint32_t probe = mCurrent;
+  if (up && ((mCurrent + 1) < mStats.size()))
+    probe = mCurrent + 1;
+  else if ((up == false) && (mCurrent > 0))
+    probe = mCurrent - 1;
+
+  if ((mStats[probe].error_rate > kMax_Error_Rate) && (retry == false))
+    probe = mCurrent;
+
+  return mStats[probe].chunk;
+} // end getChunk()
+
+// record takes the first batch of a size as its averages. A short batch
+// makes the size below the one which failed current, unless the current
+// size is smaller already, eg, when a probe above it failed.
+void
+GQChunkTuner::record(uint32_t chunk, uint32_t requested, uint32_t good,
+                     int64_t elapsed_us)
+{
+  if (requested == 0)
+    return;
+
+  uint32_t          index  = indexOf(chunk);
+  chunk_stats_t &   stats  = mStats[index];
+  bool              failed = (good < requested);
+  float             rate   = (elapsed_us > 0)
+                           ? (good * 1000000.0f) / elapsed_us : 0.0f;
+
+  if (stats.batches == 0)
+  {
+    stats.rate       = rate;
+    stats.error_rate = failed ? 1.0f : 0.0f;
+  }
+  else
+  {
+    stats.rate       += kAverage_Weight * (rate - stats.rate);
+    stats.error_rate += kAverage_Weight *
+                        ((failed ? 1.0f : 0.0f) - stats.error_rate);
+  }
+  stats.batches++;
+
+  if (failed)
+  {
+    uint32_t below = (index > 0) ? (index - 1) : 0;
+    if (below < mCurrent)
+      mCurrent = below;
+  }
+  else
+    chooseBest();
+
+  return;
+} // end record()
+
+uint32_t
+GQChunkTuner::read(uint32_t address, uint32_t length, uint8_t * data)
+{
+  uint32_t chunk   = getChunk();
+  int64_t  started = monotonic_us();
+  uint32_t good    = mGMC->readHistory(address, length, data, chunk);
+
+  record(chunk, length, good, monotonic_us() - started);
+  return good;
+} // end read()
+
+uint32_t
+GQChunkTuner::indexOf(uint32_t chunk)
+{
+  uint32_t index = 0;
+
+  for(uint32_t i=0; i<mStats.size(); i++)
+  {
+    if (mStats[i].chunk <= chunk)
+      index = i;
+  }
+
+  return index;
+} // end indexOf()
+
+// chooseBest keeps the current size if nothing measured is both reliable
+// and faster.
+void
+GQChunkTuner::chooseBest()
+{
+  uint32_t best = mCurrent;
+  float    rate = (mStats[mCurrent].error_rate <= kMax_Error_Rate)
+                ? mStats[mCurrent].rate : 0.0f;
+
+  for(uint32_t i=0; i<mStats.size(); i++)
+  {
+    if ((mStats[i].batches > 0) &&
+        (mStats[i].error_rate <= kMax_Error_Rate) && (mStats[i].rate > rate))
+    {
+      best = i;
+      rate = mStats[i].rate;
+    }
+  }
+
+  mCurrent = best;
+  return;
+} // end chooseBest()
+
+// end file gqtune.cc
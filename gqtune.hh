@@ -0,0 +1,137 @@
+// **************************************************************************
+// File: gqtune.hh
+//
+// Description:
+//    Declare the GQChunkTuner class, which finds the SPIR chunk size at
+//    which a GQ GMC delivers its history flash the fastest.
+//
+// CHUNK TUNING OVERVIEW
+//
+// GQ-RFC1201 says that the length of a SPIR should normally not exceed
+// 4096 bytes, and the registry (gqmodel.hh) caps each model at its
+// max_chunk. Within that, the best size depends on the firmware: every
+// SPIR costs a command and the time the GQ GMC takes to start its reply,
+// which favors large chunks, but some firmware drops bytes of long
+// replies, or stalls on them, and a chunk which fails is read again,
+// which favors small ones.
+//
+// The tuner tries the sizes from kMin_Chunk doubling up to max_chunk.
+// For each, it keeps a moving average of the effective rate, the bytes
+// which arrived over the time the whole batch took, failures included,
+// and of the error rate, the share of batches which came back short.
+// Batches are read at the current size, and every kProbe_Interval-th
+// batch at the size above or below it, in turn. After each batch the
+// current size becomes the fastest size whose error rate is at most
+// kMax_Error_Rate. A short read shrinks the current size at once to
+// below the size which failed; a size which has failed is probed again
+// only now and then, and trusted again once its error rate has decayed.
+//
+// The size found is kept per model, firmware and baud rate, by the
+// GETVER reply, in a state file with one line each, eg,
+//
+//   GMC-300Re_4.20@57600 4096 5683.2
+//
+// giving the size and its rate, so that the next session starts from
+// it. See setStateFile(), load() and store().
+//
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "gqgmc.hh"
+
+#ifndef gqtune_hh_
+#define gqtune_hh_
+
+namespace GQLLC
+{
+
+  // The measurements of one chunk size.
+  struct chunk_stats_t
+  {
+    uint32_t  chunk;         // bytes per SPIR
+    uint32_t  batches;       // measured so far
+    float     rate;          // effective bytes per second, averaged
+    float     error_rate;    // share of short batches, averaged
+  };
+
+
+  // CHUNK TUNER
+  //
+  // The class declaration - see gqtune.cc for documentation
+  class GQChunkTuner
+  {
+    public:
+
+    // The GQGMC is owned by the caller and must outlive the tuner. The
+    // sizes are those of the model identified when the link was opened.
+    GQChunkTuner(GQGMC * gmc);
+
+    // Method to set the state file, empty for none.
+    void
+    setStateFile(const std::string & file_name);
+
+    // Method to identify the GQ GMC with GETVER and start from the size
+    // stored for it, if any. Returns true if one was found.
+    bool
+    load();
+
+    // Method to store the current size for the GQ GMC identified by
+    // load(). Returns false if it could not be written.
+    bool
+    store();
+
+    // Method to get the size of the next batch, which may be a probe.
+    uint32_t
+    getChunk();
+
+    // Method to record a batch of requested bytes read at the chunk
+    // size, of which good arrived in full, in elapsed_us microseconds.
+    void
+    record(uint32_t chunk, uint32_t requested, uint32_t good,
+           int64_t elapsed_us);
+
+    // Method to read a range as GQGMC::readHistory() does, at the size
+    // getChunk() chooses, and record how it went.
+    uint32_t
+    read(uint32_t address, uint32_t length, uint8_t * data);
+
+    // Method to get the current size, the fastest reliable one so far.
+    uint32_t
+    getCurrentChunk()
+    {
+      return mStats[mCurrent].chunk;
+    };
+
+    // Method to get the measurements of every size, smallest first.
+    const std::vector<chunk_stats_t> &
+    getStats()
+    {
+      return mStats;
+    };
+
+    private:
+
+    GQGMC *                     mGMC;
+    std::string                 mState_file;
+    std::string                 mKey;         // set by load()
+
+    std::vector<chunk_stats_t>  mStats;
+    uint32_t                    mCurrent;     // index into mStats
+    uint32_t                    mBatches;
+
+    // Index of the largest size not above chunk.
+    uint32_t
+    indexOf(uint32_t chunk);
+
+    // Make the fastest reliable size current.
+    void
+    chooseBest();
+
+  }; // end class GQChunkTuner
+
+} // end namespace GQLLC
+
+// DOCUMENTATION CONTINUES IN gqtune.cc
+#endif  // gqtune_hh_
@@ -4,22 +4,113 @@
 
 // Demonstration program for GQ GMC (geiger-muller counter).
 
-// Usage: gqgmc <usb-port-device-name> <command>
+// Usage: gqgmc <usb-port-device-name> <command> [period-seconds | file]
 // Example: gqgmc /dev/gqgmc cpm
 
-// Available commands: cpm, cps
+// The cpm command polls once per period, by default 1 second, on a
+// fixed grid of deadlines (see gqtimer.hh). Periods below a second are
+// allowed. Polls which do not fit in the period are reported as overrun.
+// Example: gqgmc /dev/gqgmc cpm 0.25
+
+// Several counters are served at once, in heartbeat mode by a single
+// event loop, when given as a comma separated list with the cps command.
+// Example: gqgmc /dev/ttyUSB0,/dev/ttyUSB1,/dev/ttyUSB2 cps
+
+// The daemon command instead takes a device list file (see gqcollect.hh)
+// and keeps collecting from every device, reopening any that fail.
+// Example: gqgmc /etc/gqgmc.devices daemon
+
+// The poll command polls CPM once per period, the battery voltage every
+// minute, and the serial number and configuration every hour, fitting
+// the slower reads between the CPM polls (see gqpoll.hh). The load of
+// the serial link is shown with each configuration read.
+// Example: gqgmc /dev/gqgmc poll
+
+// The baud rate of each counter is found by trying the rates in turn,
+// and remembered in ~/.gqgmc_baud, so that the next start is quick.
+
+// The dump command copies the whole history flash to a file, in
+// pipelined chunks (see gqdump.hh), reporting its progress and rate. If
+// the file exists already, the dump resumes at its end, so a dump which
+// failed part way is completed by running the same command again. The
+// SPIR chunk size is tuned as the dump goes (see gqtune.hh), and the
+// fastest reliable size is remembered per model in ~/.gqgmc_chunk.
+// Example: gqgmc /dev/gqgmc dump flash.bin
+
+// The sync command appends only the history logged since its last run
+// to <serial>.hist in the directory given, by default the current one,
+// and keeps where it got to per counter in gqgmc.sync there (see
+// gqsync.hh).
+// Example: gqgmc /dev/gqgmc sync /var/lib/gqgmc
+
+// The mirror command keeps a copy of the whole history flash in
+// <serial>.flash in the directory given, by default the current one,
+// reading only the blocks it is missing and those the counter has
+// written since the last mirror (see gqmirror.hh). The copy can be
+// given to decode and index like a dump.
+// Example: gqgmc /dev/gqgmc mirror /var/lib/gqgmc
+
+// The decode command prints the samples, timestamps and notes in a
+// history file written by dump or sync (see gqhistory.hh), split at its
+// timestamps into segments decoded on every processor at once (see
+// gqparallel.hh). Each sample is stamped with the time on the counter's
+// clock, counted on from the timestamp before it. The device is not
+// opened.
+// Example: gqgmc /dev/gqgmc decode flash.bin
+
+// The index command lists just the date/timestamps of a history file,
+// found with the vector scan of the processor (see gqscan.hh), with
+// their offsets, so that large archives of dumps can be re-indexed
+// quickly. The device is not opened.
+// Example: gqgmc /dev/gqgmc index flash.bin
+
+// With GQGMC_READER=<cpu>[,<fifo-priority>] in the environment, the
+// serial port is read by a thread of its own (see gqthread.hh), pinned
+// to the CPU unless it is -1 and at the SCHED_FIFO priority if given,
+// so that a slow stdout cannot make the counter's data overflow.
+// Example: GQGMC_READER=1,50 gqgmc /dev/gqgmc cps | slow-consumer
+
+// With GQGMC_TRACE=<file>, every byte to and from the counter is recorded
+// in the file (see gqtransport.hh). With GQGMC_REPLAY=<file>, the device
+// is not opened, and the counter's side of such a trace is played back
+// with its original timing instead, so that a session can be repeated,
+// eg, to time or debug the driver, without the counter. The same command
+// must be given as when the trace was recorded.
+// Example: GQGMC_TRACE=status.trace gqgmc /dev/gqgmc status
+//          GQGMC_REPLAY=status.trace gqgmc /dev/gqgmc status
+
+// Available commands: cpm, cps, poll, dump, sync, mirror, decode, index,
+// status, daemon
 
 #include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 using namespace std;
 
+#include <errno.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "gqgmc.hh"
+#include "gqtransport.hh"
+#include "gqevloop.hh"
+#include "gqcollect.hh"
+#include "gqtimer.hh"
+#include "gqpoll.hh"
+#include "gqdump.hh"
+#include "gqsync.hh"
+#include "gqmirror.hh"
+#include "gqhistory.hh"
+#include "gqparallel.hh"
+#include "gqscan.hh"
 using namespace GQLLC;
 
 static volatile sig_atomic_t sigExit = 0;
@@ -37,6 +128,64 @@ void outMessage(string msg) {
   std::cout << std::put_time( std::localtime( &t ), "%FT%T%z" ) << "," << msg << endl;
 }
 
+// Utility to show a sample, stamped with its arrival time rather than
+// the time it is shown. The microseconds go between the seconds and the
+// time zone, eg, 2023-03-04T12:00:01.000412+0000.
+void outSample(string msg, const cps_sample_t & sample) {
+  char stamp[40];
+  char zone[8];
+  struct tm local;
+  localtime_r(&sample.arrival.tv_sec, &local);
+  strftime(stamp, sizeof(stamp), "%FT%T", &local);
+  strftime(zone, sizeof(zone), "%z", &local);
+  std::cout << stamp << "." << setw(6) << setfill('0')
+            << sample.arrival.tv_nsec / 1000 << zone << "," << msg << endl;
+}
+
+// Utility to name the baud rate cache, see setBaudCacheFile() in
+// gqgmc.cc. Without a home directory there is no cache.
+string baudCacheFile() {
+  const char * home = getenv("HOME");
+  if (home == NULL)
+    return "";
+  return string(home) + "/.gqgmc_baud";
+}
+
+// Utility to name the chunk size state, see gqtune.hh.
+string chunkStateFile() {
+  const char * home = getenv("HOME");
+  if (home == NULL)
+    return "";
+  return string(home) + "/.gqgmc_chunk";
+}
+
+// Utility to set up the reader thread as asked for by GQGMC_READER.
+void readerThread(GQGMC & gmc) {
+  const char * spec = getenv("GQGMC_READER");
+  if (spec == NULL)
+    return;
+
+  int cpu = -1;
+  int priority = 0;
+  sscanf(spec, "%d,%d", &cpu, &priority);
+  gmc.setReaderThread(true, cpu, priority);
+}
+
+// Utility to record the session as asked for by GQGMC_TRACE.
+void traceFile(GQGMC & gmc) {
+  const char * name = getenv("GQGMC_TRACE");
+  if (name != NULL)
+    gmc.setTraceFile(name);
+}
+
+// Utility to report that the reader thread did not get its CPU or
+// priority. It runs all the same.
+void readerCheck(GQGMC & gmc, string name) {
+  int err = gmc.getReaderSchedError();
+  if (err != 0)
+    outMessage(name + "Reader scheduling refused: " + strerror(err));
+}
+
 // Utility to encapsulate the code to display an error message. This is
 // separated from outMessage() because this is specialized to
 // accessing and formulating the GQGMC error status, but not displaying.
@@ -49,6 +198,473 @@ void outError(const GQGMC & gmc) {
   return;
 }
 
+// Utility to wait for a lost link to come back, see reconnect() in
+// gqgmc.cc. The loss and the gap are reported once each, rather than
+// an error every second. Returns true if the link is up.
+bool linkUp(GQGMC & gmc, bool & reported) {
+  if (!gmc.isLinkLost()) {
+    reported = false;
+    return true;
+  }
+
+  if (!reported) {
+    outMessage("Link lost");
+    reported = true;
+  }
+  if (!gmc.reconnect())
+    return false;
+
+  stringstream msg;
+  msg << "Link restored,GAP:" << fixed << setprecision(3)
+      << gmc.getLastGap() / 1000.0;
+  outMessage(msg.str());
+  reported = false;
+  return true;
+}
+
+// Listener of the event loop, printing each sample with the name of the
+// device it came from.
+class SampleOutput : public GQSampleListener {
+  public:
+  std::map<GQGMC *, string> names;
+
+  virtual void onSample(GQGMC * gmc, const cps_sample_t & sample) {
+    stringstream msg;
+    msg << names[gmc] << ",CPS:" << sample.cps;
+    outSample(msg.str(), sample);
+  }
+
+  virtual void onLinkLost(GQGMC * gmc) {
+    outMessage(names[gmc] + ",Link lost");
+  }
+};
+
+// Serve a comma separated list of devices from one event loop, see
+// gqevloop.hh. Devices which fail to open are reported and skipped.
+int serveDevices(string device_list) {
+  SampleOutput output;
+  GQEventLoop loop(&output);
+  std::vector<GQGMC *> devices;
+
+  stringstream list(device_list);
+  string name;
+  while (getline(list, name, ',')) {
+    if (name.empty())
+      continue;
+
+    GQGMC * gqgmc = new GQGMC;
+    gqgmc->setBaudCacheFile(baudCacheFile());
+    readerThread(*gqgmc);
+    gqgmc->openUSB(name);
+    readerCheck(*gqgmc, name + ",");
+    if (gqgmc->getErrorCode() == eNoProblem)
+      gqgmc->turnOnCPS();
+    if ((gqgmc->getErrorCode() != eNoProblem) || !loop.addDevice(gqgmc)) {
+      outMessage(name + "," + gqgmc->getErrorText(gqgmc->getErrorCode()));
+      delete gqgmc;
+      continue;
+    }
+
+    output.names[gqgmc] = name;
+    devices.push_back(gqgmc);
+  }
+
+  cout << "GQ GMC data feed" << endl;
+  cout << "CPS On" << endl;
+
+  while (!sigExit && (loop.getDeviceCount() > 0)) {
+    if (loop.dispatch(1000) < 0)
+      break;
+  }
+
+  cout << "CPS Off" << endl;
+  for (size_t i = 0; i < devices.size(); i++) {
+    devices[i]->turnOffCPS();
+    devices[i]->closeUSB();
+    delete devices[i];
+  }
+
+  std::cout << "Exiting..." << endl;
+  return 0;
+}
+
+// Shared output of the collector, printing samples and events with the
+// label of the device they came from.
+class CollectorOutput : public GQCollectorOutput {
+  public:
+  virtual void onSample(const string & label, const cps_sample_t & sample) {
+    stringstream msg;
+    msg << label << ",CPS:" << sample.cps;
+    outSample(msg.str(), sample);
+  }
+
+  virtual void onEvent(const string & label, const string & event) {
+    outMessage(label + "," + event);
+  }
+};
+
+// Collect from every device in the list file until signalled.
+int collectDevices(string list_file) {
+  CollectorOutput output;
+  GQCollector collector(&output);
+
+  if (!collector.loadDeviceList(list_file) || (collector.getDeviceCount() == 0)) {
+    cout << "Cannot read devices from " << list_file << endl;
+    return 1;
+  }
+
+  cout << "GQ GMC data feed" << endl;
+  while (!sigExit)
+    collector.step(1000);
+  collector.shutdown();
+
+  std::cout << "Exiting..." << endl;
+  return 0;
+}
+
+// Listener of the poll scheduler, printing each result as it comes and
+// the link load after each configuration read.
+class PollOutput : public GQPollListener {
+  public:
+  GQPollScheduler * scheduler;
+
+  virtual void onResult(const poll_result_t & result) {
+    stringstream msg;
+    if (!result.ok) {
+      msg << "Query " << result.id << " failed";
+      outMessage(msg.str());
+      return;
+    }
+
+    switch (result.query) {
+      case eQuery_CPM:     msg << "CPM:" << result.count; break;
+      case eQuery_CPS:     msg << "CPS:" << result.count; break;
+      case eQuery_Voltage: msg << "VOLT:" << fixed << setprecision(1)
+                               << result.voltage; break;
+      case eQuery_Serial:  msg << "SERIAL:" << result.text; break;
+      case eQuery_Version: msg << "VER:" << result.text; break;
+      case eQuery_Config: {
+        poll_metrics_t metrics;
+        scheduler->getLinkMetrics(metrics);
+        msg << "LINK:" << fixed << setprecision(2)
+            << metrics.utilization * 100.0 << "%"
+            << ",DEFERRED:" << metrics.deferrals
+            << ",SKIPPED:" << metrics.skipped;
+        break;
+      }
+    }
+    outMessage(msg.str());
+  }
+};
+
+// Sink of the flash dump, appending to the dump file and showing the
+// progress.
+class DumpOutput : public GQFlashDumpSink {
+  public:
+  ofstream file;
+
+  virtual bool onData(uint32_t address, const uint8_t * data, uint32_t length) {
+    file.write(reinterpret_cast<const char *>(data), length);
+    file.flush();
+    return file.good() && !sigExit;
+  }
+
+  virtual void onProgress(const dump_progress_t & progress) {
+    stringstream msg;
+    msg << "DUMP:" << progress.next_address << "/" << progress.end_address
+        << ",RATE:" << fixed << setprecision(0) << progress.bytes_per_sec
+        << ",RETRIES:" << progress.retries
+        << ",TAILS:" << progress.tail_retries;
+    outMessage(msg.str());
+  }
+};
+
+// Dump the whole flash to a file, resuming at the end of the file.
+int dumpFlash(GQGMC & gmc, string file_name) {
+  DumpOutput output;
+  GQFlashDump dump(&gmc, &output);
+  GQChunkTuner tuner(&gmc);
+  tuner.setStateFile(chunkStateFile());
+  tuner.load();
+  dump.setTuner(&tuner);
+
+  uint32_t start = 0;
+  ifstream existing(file_name.c_str(), ios::binary | ios::ate);
+  if (existing)
+    start = uint32_t(existing.tellg());
+  existing.close();
+
+  output.file.open(file_name.c_str(), ios::binary | ios::app);
+  if (!output.file) {
+    cout << "Cannot write " << file_name << endl;
+    return 1;
+  }
+
+  dump.setRange(start, gmc.getFlashSize());
+  bool ok = dump.run();
+  tuner.store();
+  if (!ok) {
+    stringstream msg;
+    msg << "Dump stopped at " << dump.getNextAddress() << ",";
+    outMessage(msg.str() + gmc.getErrorText(gmc.getErrorCode()));
+    return 1;
+  }
+
+  stringstream msg;
+  msg << "Dump complete,CHUNK:" << tuner.getCurrentChunk();
+  outMessage(msg.str());
+  return 0;
+}
+
+// Sink of the history sync, which knows no end ahead, showing the bytes
+// synced so far and where they reach.
+class SyncOutput : public DumpOutput {
+  public:
+  virtual void onProgress(const dump_progress_t & progress) {
+    stringstream msg;
+    msg << "SYNCED:" << progress.bytes_done
+        << ",TO:" << progress.next_address
+        << ",RATE:" << fixed << setprecision(0) << progress.bytes_per_sec
+        << ",TAILS:" << progress.tail_retries;
+    outMessage(msg.str());
+  }
+};
+
+// Append the history logged since the last sync to the file of the
+// counter's serial number in the directory.
+int syncHistory(GQGMC & gmc, string directory) {
+  string serial_number = gmc.getSerialNumber();
+  if (gmc.getErrorCode() != eNoProblem) {
+    outError(gmc);
+    return 1;
+  }
+
+  SyncOutput output;
+  string file_name = directory + "/" + serial_number + ".hist";
+  output.file.open(file_name.c_str(), ios::binary | ios::app);
+  if (!output.file) {
+    cout << "Cannot write " << file_name << endl;
+    return 1;
+  }
+
+  GQHistorySync sync(&gmc, directory + "/gqgmc.sync");
+  bool ok = sync.sync(serial_number, &output);
+
+  stringstream msg;
+  msg << "SYNC:" << sync.getSyncedBytes()
+      << ",FROM:" << sync.getFromAddress()
+      << ",TO:" << sync.getToAddress();
+  outMessage(msg.str());
+  if (!ok) {
+    outError(gmc);
+    return 1;
+  }
+  return 0;
+}
+
+// Bring the mirror of the counter's flash in the directory up to date.
+int mirrorFlash(GQGMC & gmc, string directory) {
+  string serial_number = gmc.getSerialNumber();
+  if (gmc.getErrorCode() != eNoProblem) {
+    outError(gmc);
+    return 1;
+  }
+
+  GQFlashMirror mirror;
+  string file_name = directory + "/" + serial_number + ".flash";
+  if (!mirror.open(file_name, gmc.getFlashSize())) {
+    cout << "Cannot map " << file_name << ": " << strerror(errno) << endl;
+    return 1;
+  }
+
+  bool ok = mirror.update(&gmc);
+
+  stringstream msg;
+  msg << "MIRROR:" << mirror.getFetchedBytes()
+      << ",VALID:" << mirror.getValidBytes() << "/" << mirror.getSize()
+      << ",END:" << mirror.getWriteEnd();
+  outMessage(msg.str());
+  if (!ok) {
+    outError(gmc);
+    return 1;
+  }
+  return 0;
+}
+
+// Listener of the history decoder, showing each sample with its time.
+class HistoryOutput : public GQHistoryListener {
+  public:
+  time_t when = 0;
+  bool known = false;
+  ostream * out = &std::cout;
+
+  virtual void onRecord(const history_record_t & record) {
+    switch (record.type) {
+      case eRecord_Samples:
+        for (uint32_t i = 0; i < record.length; i++)
+          showSample(record, record.address + i, record.data[i]);
+        break;
+      case eRecord_Count:
+        showSample(record, record.address, record.count);
+        break;
+      case eRecord_Timestamp: {
+        struct tm tm = {};
+        tm.tm_year = record.year + 100;
+        tm.tm_mon = record.month - 1;
+        tm.tm_mday = record.day;
+        tm.tm_hour = record.hour;
+        tm.tm_min = record.minute;
+        tm.tm_sec = record.second;
+        when = timegm(&tm);
+        known = true;
+        outHistory(record.address, "LOG:" + unitName(record.save_type));
+        break;
+      }
+      case eRecord_Note:
+        outHistory(record.address, "NOTE:" +
+          string(reinterpret_cast<const char *>(record.data), record.length));
+        break;
+      case eRecord_Erased:
+        // Erased flash holds no samples, so the clock does not advance.
+        outHistory(record.address, "ERASED:" + to_string(record.length));
+        break;
+    }
+  }
+
+  private:
+  // The time is on the counter's clock, which has no time zone.
+  void outHistory(uint32_t address, string msg) {
+    if (known) {
+      char stamp[24];
+      struct tm tm;
+      gmtime_r(&when, &tm);
+      strftime(stamp, sizeof(stamp), "%FT%T", &tm);
+      *out << stamp << "," << msg << '\n';
+    } else
+      *out << "@" << address << "," << msg << '\n';
+  }
+
+  void showSample(const history_record_t & record, uint32_t address,
+                  uint16_t count) {
+    stringstream msg;
+    msg << unitName(record.save_type) << ":" << count;
+    switch (record.save_type) {
+      case eCPS: when += 1; break;
+      case eCPM: when += 60; break;
+      case eCPH: when += 3600; break;
+      default: break;
+    }
+    outHistory(address, msg.str());
+  }
+
+  string unitName(enum saveDataType_t save_type) {
+    switch (save_type) {
+      case eSaveOff: return "OFF";
+      case eCPS: return "CPS";
+      case eCPM: return "CPM";
+      case eCPH: return "CPH";
+      default: return "TYPE" + to_string(int(save_type));
+    }
+  }
+};
+
+// Listener of a segment of a parallel decode, keeping its lines until
+// the segment is handed back.
+class SegmentOutput : public HistoryOutput {
+  public:
+  stringstream text;
+
+  SegmentOutput() {
+    out = &text;
+  }
+};
+
+// Sink of a parallel decode, writing out the segments in order.
+class HistorySegments : public GQHistorySegmentSink {
+  public:
+  virtual GQHistoryListener * openSegment(uint32_t address) {
+    return new SegmentOutput;
+  }
+
+  virtual void closeSegment(GQHistoryListener * listener, bool keep) {
+    SegmentOutput * output = static_cast<SegmentOutput *>(listener);
+    if (keep)
+      std::cout << output->text.str();
+    delete output;
+  }
+};
+
+// Decode a history file written by dump or sync, split into segments
+// decoded on every processor.
+int decodeHistory(string file_name) {
+  ifstream file(file_name.c_str(), ios::binary | ios::ate);
+  if (!file) {
+    cout << "Cannot read " << file_name << endl;
+    return 1;
+  }
+  vector<uint8_t> data(size_t(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(data.data()), data.size());
+
+  HistorySegments segments;
+  GQParallelDecoder decoder(&segments);
+  if (!decoder.decode(data.data(), uint32_t(data.size()))) {
+    cout << "Cannot start the decoding threads" << endl;
+    return 1;
+  }
+
+  stringstream msg;
+  msg << "DECODED:" << data.size()
+      << ",BAD:" << decoder.getBadRecordCount()
+      << ",SEGMENTS:" << decoder.getSegmentCount()
+      << ",THREADS:" << decoder.getThreadCount();
+  outMessage(msg.str());
+  return 0;
+}
+
+// List the date/timestamps of a history file. A 55AA00 is taken as one
+// only if its closing 55AA is in place.
+int indexHistory(string file_name) {
+  ifstream file(file_name.c_str(), ios::binary | ios::ate);
+  if (!file) {
+    cout << "Cannot read " << file_name << endl;
+    return 1;
+  }
+  vector<uint8_t> data(size_t(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(data.data()), data.size());
+
+  GQMarkerScanner scanner;
+  vector<uint32_t> offsets;
+  auto started = chrono::steady_clock::now();
+  scanner.scan(data.data(), uint32_t(data.size()), offsets, kMarker_Timestamp);
+  chrono::duration<double> took = chrono::steady_clock::now() - started;
+
+  uint32_t stamps = 0;
+  for (uint32_t offset : offsets) {
+    if (((offset + 12) > data.size()) || (data[offset + 9] != 0x55) ||
+        (data[offset + 10] != 0xAA))
+      continue;
+    const uint8_t * stamp = &data[offset + 3];
+    char when[24];
+    snprintf(when, sizeof(when), "20%02u-%02u-%02uT%02u:%02u:%02u",
+             stamp[0] % 100, stamp[1] % 100, stamp[2] % 100,
+             stamp[3] % 100, stamp[4] % 100, stamp[5] % 100);
+    std::cout << when << ",STAMP:" << offset
+              << ",TYPE:" << int(data[offset + 11]) << endl;
+    stamps++;
+  }
+
+  stringstream msg;
+  msg << "INDEXED:" << stamps << ",BYTES:" << data.size()
+      << ",METHOD:" << scanner.getMethod() << ",RATE:" << fixed
+      << setprecision(0)
+      << ((took.count() > 0) ? data.size() / took.count() / 1e6 : 0.0)
+      << "MB/s";
+  outMessage(msg.str());
+  return 0;
+}
+
 int
 main(int argc, char **argv) {
   // register signal SIGABRT and signal handler
@@ -61,52 +677,104 @@ main(int argc, char **argv) {
   // Default to CPM output
   string gqgmc_command = "cpm";
 
+  // Default to polling every second
+  uint32_t period_ms = 1000;
+
   if (argc == 2)
     usb_device = argv[1];
-  else if (argc == 3) {
+  else if (argc >= 3) {
     usb_device = argv[1];
     gqgmc_command = argv[2];
   }
+  string argument;
+  if (argc == 4)
+    argument = argv[3];
+  if (!argument.empty() && (gqgmc_command != "dump") &&
+      (gqgmc_command != "sync") && (gqgmc_command != "mirror") &&
+      (gqgmc_command != "decode") && (gqgmc_command != "index"))
+    period_ms = uint32_t(atof(argument.c_str()) * 1000.0 + 0.5);
+
+  if ((usb_device.find(',') != string::npos) && (gqgmc_command == "cps"))
+    return serveDevices(usb_device);
+  if (gqgmc_command == "daemon")
+    return collectDevices(usb_device);
+  if (gqgmc_command == "decode")
+    return decodeHistory(argument.empty() ? "flash.bin" : argument);
+  if (gqgmc_command == "index")
+    return indexHistory(argument.empty() ? "flash.bin" : argument);
 
   // Instantiate the GQGMC object on the heap
   GQGMC * gqgmc = new GQGMC;
 
-  // Open USB port
-  gqgmc->openUSB(usb_device);
+  // Open USB port, at the baud rate it had last time if known, or play
+  // back the trace given by GQGMC_REPLAY instead
+  const char * replay_file = getenv("GQGMC_REPLAY");
+  ReplayTransport * replay = NULL;
+  gqgmc->setBaudCacheFile(baudCacheFile());
+  if (replay_file != NULL) {
+    replay = new ReplayTransport(replay_file);
+    gqgmc->openTransport(replay);
+  } else {
+    traceFile(*gqgmc);
+    readerThread(*gqgmc);
+    gqgmc->openUSB(usb_device);
+    readerCheck(*gqgmc, "");
+  }
 
-  // Check success of opening USB port
-  if (gqgmc->getErrorCode() == eNoProblem) {
+  // Check success of opening USB port. A dump waits for the counter to
+  // answer, eg, while it finishes sending the reply to a dump which was
+  // interrupted.
+  if ((gqgmc->getErrorCode() == eNoProblem) ||
+      ((gqgmc_command == "dump") && gqgmc->isLinkLost())) {
     // cout << "GQGMC; USB open: " << usb_device << "; Command: " << gqgmc_command << endl;
     cout << "GQ GMC data feed" << endl;
   } else {
     outError(*gqgmc); // dereference to pass by reference
     gqgmc->closeUSB();
+    delete gqgmc;
+    delete replay;
     return 0;
   }
 
-  // Output CPM every second
+  // The exit status of the commands which report one, 1 if they failed
+  int exit_status = 0;
+
+  // Output CPM once per period, on the deadlines of the timer rather
+  // than a sleep after each poll, so that the rate does not drift.
   if (gqgmc_command == "cpm") {
     uint16_t cpm;
+    bool lost = false;
+    GQPeriodicTimer timer(period_ms);
 
     while(1) {
       if (sigExit)
         break;
 
-      cpm = gqgmc->getCPM();
-      if (gqgmc->getErrorCode() == eNoProblem) {
+      if (linkUp(*gqgmc, lost)) {
+        cpm = gqgmc->getCPM();
+        if (gqgmc->getErrorCode() == eNoProblem) {
+          stringstream msg;
+          msg << "CPM:" << cpm;
+          outMessage(msg.str());
+        } else if (!gqgmc->isLinkLost())
+          outError(*gqgmc);
+      }
+
+      int skipped = timer.wait();
+      if (skipped > 0) {
         stringstream msg;
-        msg << "CPM:" << cpm;
+        msg << "Overrun:" << skipped;
         outMessage(msg.str());
-      } else
-        outError(*gqgmc);
-
-      sleep(1);
+      }
     } // end for loop
   }
   
-  // Output CPS
+  // Output CPS as each heartbeat frame arrives. getAutoCPS() waits for
+  // the next frame, so there is no sleep which would let them pile up.
   else if (gqgmc_command == "cps") {
-    uint16_t cps = 0;
+    cps_sample_t sample;
+    uint32_t resyncs = 0;
+    bool lost = false;
 
     cout << "CPS On" << endl;
     gqgmc->turnOnCPS();
@@ -116,17 +784,27 @@ main(int argc, char **argv) {
     while(1) {
       if (sigExit)
         break;
-      
-      cps = gqgmc->getAutoCPS();
-      if (gqgmc->getErrorCode() == eNoProblem) {
+
+      // reconnect() turns the heartbeat back on
+      if (!linkUp(*gqgmc, lost)) {
+        sleep(1);
+        continue;
+      }
+
+      gqgmc->getAutoCPS(sample);
+      if (gqgmc->getResyncCount() != resyncs) {
+        resyncs = gqgmc->getResyncCount();
         stringstream msg;
-        msg << "CPS:" << cps;
+        msg << "Resync:" << resyncs;
         outMessage(msg.str());
+      }
+      if (gqgmc->getErrorCode() == eNoProblem) {
+        stringstream msg;
+        msg << "CPS:" << sample.cps;
+        outSample(msg.str(), sample);
         // cout << dec << "s=" << i << " " << cps << endl;  // debug
-      } else
+      } else if (!gqgmc->isLinkLost())
         outError(*gqgmc);
-
-      sleep(1);
     } // end for loop
 
     // Turn off CPS reporting
@@ -136,6 +814,59 @@ main(int argc, char **argv) {
       outError(*gqgmc);
   }
   
+  // Output CPM once per period and the slower values in between
+  else if (gqgmc_command == "poll") {
+    bool lost = false;
+    PollOutput output;
+    GQPollScheduler scheduler(gqgmc, &output);
+    output.scheduler = &scheduler;
+
+    scheduler.addQuery(eQuery_CPM,     period_ms, 0);
+    scheduler.addQuery(eQuery_Voltage, 60000,     1);
+    scheduler.addQuery(eQuery_Serial,  3600000,   2);
+    scheduler.addQuery(eQuery_Config,  3600000,   2);
+    scheduler.start();
+
+    while (!sigExit) {
+      linkUp(*gqgmc, lost);
+      scheduler.step();
+    }
+  }
+
+  // Copy the flash to the file given, by default flash.bin
+  else if (gqgmc_command == "dump") {
+    exit_status = dumpFlash(*gqgmc,
+                            argument.empty() ? "flash.bin" : argument);
+  }
+
+  // Append the new history to a file in the directory given, by default
+  // the current one
+  else if (gqgmc_command == "sync") {
+    exit_status = syncHistory(*gqgmc, argument.empty() ? "." : argument);
+  }
+
+  // Update the mirror of the flash in the directory given, by default
+  // the current one
+  else if (gqgmc_command == "mirror") {
+    exit_status = mirrorFlash(*gqgmc, argument.empty() ? "." : argument);
+  }
+
+  // Output version, serial number, battery voltage and CPM once
+  else if (gqgmc_command == "status") {
+    gmc_status_t status;
+
+    gqgmc->getStatus(status);
+    if (gqgmc->getErrorCode() == eNoProblem) {
+      stringstream msg;
+      msg << "VER:" << status.version
+          << ",SERIAL:" << status.serial_number
+          << ",VOLT:" << fixed << setprecision(1) << status.battery_voltage
+          << ",CPM:" << status.cpm;
+      outMessage(msg.str());
+    } else
+      outError(*gqgmc);
+  }
+
   // Unknown command
   else {
     std::cout << "Unknown command" << endl;
@@ -143,10 +874,14 @@ main(int argc, char **argv) {
   
   std::cout << "Exiting..." << endl;
 
+  if ((replay != NULL) && replay->hasDiverged())
+    outMessage("The replay left the trace: the commands differ");
+
   // Close USB port
   gqgmc->closeUSB();
 
   delete gqgmc;
+  delete replay;
 
-  return 0;
+  return exit_status;
 } // end main()